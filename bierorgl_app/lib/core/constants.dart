@@ -48,6 +48,9 @@ abstract class BleConstants {
   // UUID für State Machine
   static const statusUuid = "9b6d1c3a-91a2-4f23-8c11-1a2b3c4d5e6f";
 
+  // UUID für die Übertragung per Notify mit ACK/NACK (neuere Firmware)
+  static const transferUuid = "5c0e4a71-2d8b-4b9e-9f3a-7c61e2d40b58";
+
   static const String deviceInfoServiceUuid = '180a';
   static const String firmwareRevisionUuid = '2a28';
 
@@ -59,6 +62,22 @@ abstract class BleConstants {
   static const headerSize = 4;
   static const offsetCount = 4;
   static const offsetVolFactor = 6;
+  static const offsetSeq = 12;
+  static const offsetPayloadBytes = 14;
+  static const offsetEncoding = 16;
+  static const offsetFlags = 18;
+
+  // --- Session-Flags (im START-Paket) ---
+  static const int sessionFlagInterpolated = 0x01; // Ticks zwischen Zählerabfragen gleichmäßig verteilt, nicht gemessen
+
+  // --- Kodierung der Nutzdaten (im START-Paket angekündigt) ---
+  static const int encodingRaw = 0x00; // u32 LE pro Tick
+  static const int encodingVarint = 0x01; // u32 Basis, danach zigzag/varint der zweiten Differenzen
+
+  // --- Transfer-Characteristic: ANTWORT VOM HANDY (Write) ---
+  static const int transferOpAck = 0x01; // + u16 Session-Seq
+  static const int transferOpNack = 0x02; // + u16 erster Chunk, u16 Anzahl Chunks
+  static const int transferOpEncoding = 0x03; // + u8 Kodierung, gilt für die Verbindung
 
   // --- State Machine: VOM GERÄT GEMELDET (Read/Notify) ---
   static const int stateIdle = 0x00;
@@ -22,6 +22,8 @@ class SessionScreen extends ConsumerStatefulWidget {
   final List<int>? allValues;
   final double? calibrationFactor;
   final int? calculatedVolumeML;
+  // Vom Gerät ohne Interrupt pro Puls aufgezeichnet: die Ticks sind interpoliert, es gibt keinen Peak
+  final bool isInterpolated;
 
   const SessionScreen({
     super.key,
@@ -30,6 +32,7 @@ class SessionScreen extends ConsumerStatefulWidget {
     this.allValues,
     this.calibrationFactor,
     this.calculatedVolumeML,
+    this.isInterpolated = false,
   });
 
   @override
@@ -631,8 +634,12 @@ class _SessionScreenState extends ConsumerState<SessionScreen> {
       },
       {
         'label': 'PEAK FLOW',
-        'value': '${peakFlow.toStringAsFixed(2)} L/s',
-        'sub': 'Maximale Saugkraft'
+        'value': widget.isInterpolated
+            ? '–'
+            : '${peakFlow.toStringAsFixed(2)} L/s',
+        'sub': widget.isInterpolated
+            ? 'Nicht gemessen, Ticks interpoliert'
+            : 'Maximale Saugkraft'
       },
     ];
 
@@ -51,6 +51,7 @@ class _TrichternScreenState extends ConsumerState<TrichternScreen> {
             allValues: next.msValues,
             calibrationFactor: next.volumeCalibrationFactor?.toDouble(),
             calculatedVolumeML: calculatedVolumeML,
+            isInterpolated: next.isInterpolated,
           ),
         ),
       ).then((_) => _onReturnFromSession());
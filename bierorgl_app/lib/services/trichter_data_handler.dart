@@ -17,6 +17,7 @@ class TrichterDataState {
   final double? timeCalibrationFactor;
   final bool isSessionFinished;
   final int lastDurationMS;
+  final bool isInterpolated;
   final String? error;
 
   TrichterDataState({
@@ -27,6 +28,7 @@ class TrichterDataState {
     this.timeCalibrationFactor,
     this.isSessionFinished = false,
     this.lastDurationMS = 0,
+    this.isInterpolated = false,
     this.error,
   });
 
@@ -38,6 +40,7 @@ class TrichterDataState {
     double? timeCalibrationFactor,
     bool? isSessionFinished,
     int? lastDurationMS,
+    bool? isInterpolated,
     String? error,
   }) {
     return TrichterDataState(
@@ -50,6 +53,7 @@ class TrichterDataState {
           timeCalibrationFactor ?? this.timeCalibrationFactor,
       isSessionFinished: isSessionFinished ?? this.isSessionFinished,
       lastDurationMS: lastDurationMS ?? this.lastDurationMS,
+      isInterpolated: isInterpolated ?? this.isInterpolated,
       error: error,
     );
   }
@@ -66,6 +70,15 @@ class TrichterDataState {
 
 class TrichterDataHandler extends Notifier<TrichterDataState> {
   StreamSubscription? _dataSubscription;
+
+  // Nur gesetzt, wenn die Firmware die Transfer-Characteristic kennt.
+  // Dann kommen Chunks per Notify und fehlende werden per NACK nachgefordert.
+  BluetoothCharacteristic? _transferChar;
+  final Map<int, List<int>> _chunks = {};
+  int _chunkSize = 0;
+  int? _sessionSeq;
+  int _encoding = BleConstants.encodingRaw;
+  int _payloadBytes = 0;
   
   // Um zu verhindern, dass wir streams doppelt aufsetzen, wenn doch mal ein Rebuild passiert
   String? _currentlyConnectedDeviceId; 
@@ -100,6 +113,8 @@ class TrichterDataHandler extends Notifier<TrichterDataState> {
     _dataSubscription?.cancel();
     _dataSubscription = null;
     _currentlyConnectedDeviceId = null;
+    _transferChar = null;
+    _chunks.clear();
   }
 
   void resetSession() {
@@ -117,7 +132,9 @@ class TrichterDataHandler extends Notifier<TrichterDataState> {
     try {
       // Hinweis: FBP cacht services, daher ist discoverServices hier meist schnell/sicher
       final services = await device.discoverServices();
-      
+      BluetoothCharacteristic? sessionChar;
+      BluetoothCharacteristic? transferChar;
+
       for (var service in services) {
         for (var char in service.characteristics) {
           final uuid = char.uuid.toString().toLowerCase();
@@ -134,30 +151,49 @@ class TrichterDataHandler extends Notifier<TrichterDataState> {
             }
           }
 
-          // 2. Daten-Indication abonnieren (Notify/Indicate Property)
           if (uuid == BleConstants.sessionUuid) {
-            
-            // FIX 2: REIHENFOLGE TAUSCHEN & STREAM WECHSELN
-            
-            // A) Erst aufräumen
-            await _dataSubscription?.cancel();
-
-            // B) ZUERST ZUHÖREN (onValueReceived statt lastValueStream!)
-            // onValueReceived feuert nur bei wirklich neuen Daten-Events.
-            _dataSubscription = char.onValueReceived.listen((data) {
-                _handleIncomingRawData(data);
-            });
-            
-            // Sicherheitsnetz: Stream killen, wenn Device disconnected
-            device.cancelWhenDisconnected(_dataSubscription!);
-
-            // C) DANACH NOTIFICATIONS AKTIVIEREN
-            // Jetzt sind wir bereit, Daten zu empfangen.
-            await char.setNotifyValue(true);
-            
-            print("Data Stream erfolgreich registriert für ${char.uuid}");
+            sessionChar = char;
+          }
+          if (uuid == BleConstants.transferUuid) {
+            transferChar = char;
+          }
+        }
+      }
+
+      // 2. Daten abonnieren: Transfer-Characteristic bevorzugen, sonst Indications der Session-Characteristic
+      final dataChar = transferChar ?? sessionChar;
+      if (dataChar != null) {
+        _transferChar = transferChar;
+
+        // FIX 2: REIHENFOLGE TAUSCHEN & STREAM WECHSELN
+
+        // A) Erst aufräumen
+        await _dataSubscription?.cancel();
+
+        // B) ZUERST ZUHÖREN (onValueReceived statt lastValueStream!)
+        // onValueReceived feuert nur bei wirklich neuen Daten-Events.
+        _dataSubscription = dataChar.onValueReceived.listen((data) {
+            _handleIncomingRawData(data);
+        });
+
+        // Sicherheitsnetz: Stream killen, wenn Device disconnected
+        device.cancelWhenDisconnected(_dataSubscription!);
+
+        // Komprimierte Übertragung anfordern, bevor das Gerät zu senden beginnt
+        if (transferChar != null) {
+          try {
+            await transferChar.write(
+                [BleConstants.transferOpEncoding, BleConstants.encodingVarint]);
+          } catch (e) {
+            print("Firmware kennt keine Kodierung, bleibe bei Rohdaten: $e");
           }
         }
+
+        // C) DANACH NOTIFICATIONS AKTIVIEREN
+        // Jetzt sind wir bereit, Daten zu empfangen.
+        await dataChar.setNotifyValue(true);
+
+        print("Data Stream erfolgreich registriert für ${dataChar.uuid}");
       }
     } catch (e) {
       // Nur loggen, State Error würde UI evtl. verwirren, wenn es nur ein kleiner Glitch ist
@@ -187,9 +223,27 @@ class TrichterDataHandler extends Notifier<TrichterDataState> {
         final int volFactor =
             bd.getUint16(BleConstants.offsetVolFactor, Endian.little);
 
+        _chunks.clear();
+        _chunkSize = bd.getUint8(3);
+        _sessionSeq = rawData.length >= BleConstants.offsetSeq + 2
+            ? bd.getUint16(BleConstants.offsetSeq, Endian.little)
+            : null;
+        final hasEncoding = rawData.length > BleConstants.offsetEncoding;
+        _encoding = hasEncoding
+            ? bd.getUint8(BleConstants.offsetEncoding)
+            : BleConstants.encodingRaw;
+        _payloadBytes = hasEncoding
+            ? bd.getUint16(BleConstants.offsetPayloadBytes, Endian.little)
+            : count * 4;
+        // Ältere Firmware kennt keine Flags, dort ist jeder Tick gemessen
+        final flags = rawData.length > BleConstants.offsetFlags
+            ? bd.getUint8(BleConstants.offsetFlags)
+            : 0;
+
         state = state.copyWith(
           expectedTickCount: count,
           volumeCalibrationFactor: volFactor,
+          isInterpolated: (flags & BleConstants.sessionFlagInterpolated) != 0,
           isSessionFinished: false,
           rawTicks: [],
           msValues: [],
@@ -209,7 +263,13 @@ class TrichterDataHandler extends Notifier<TrichterDataState> {
             BleConstants.headerSize, BleConstants.headerSize + reportedSize);
 
         if (payload.length == reportedSize) {
-          if (payload.isNotEmpty && payload.length % 4 == 0) {
+          if (_transferChar != null && payload.isNotEmpty) {
+            // Nachgeforderte Chunks kommen außer der Reihe, doppelte überschreiben sich
+            _chunks[chunkIndex] = payload;
+            state = state.copyWith(rawTicks: _decodeReceivedPayload());
+            print(
+                "Chunk $chunkIndex: ${payload.length} Bytes. (Total: ${state.rawTicks.length}/${state.expectedTickCount})");
+          } else if (payload.isNotEmpty && payload.length % 4 == 0) {
             final incomingTicks = _parseTo32Bit(Uint8List.fromList(payload));
 
             state = state.copyWith(
@@ -226,7 +286,11 @@ class TrichterDataHandler extends Notifier<TrichterDataState> {
 
       case BleConstants.flagEnd:
         print("Protocol: END Flag empfangen.");
-        _checkAndFinalize();
+        if (_transferChar != null) {
+          _acknowledgeTransfer();
+        } else {
+          _checkAndFinalize();
+        }
         break;
 
       default:
@@ -260,6 +324,92 @@ class TrichterDataHandler extends Notifier<TrichterDataState> {
     }
   }
 
+  /// Fordert fehlende Chunks per NACK nach oder bestätigt die komplette Session per ACK.
+  Future<void> _acknowledgeTransfer() async {
+    final char = _transferChar;
+    final seq = _sessionSeq;
+    if (char == null || seq == null || _chunkSize == 0) {
+      return; // START verpasst, das Gerät schickt die Session später erneut
+    }
+
+    final numChunks = (_payloadBytes + _chunkSize - 1) ~/ _chunkSize;
+    final missing = <List<int>>[];
+    for (int i = 0; i < numChunks; i++) {
+      if (_chunks.containsKey(i)) continue;
+      if (missing.isNotEmpty && missing.last[0] + missing.last[1] == i) {
+        missing.last[1]++;
+      } else {
+        missing.add([i, 1]);
+      }
+    }
+
+    try {
+      if (missing.isEmpty) {
+        if (!state.isSessionFinished) {
+          _checkAndFinalize();
+        }
+        final bd = ByteData(3)
+          ..setUint8(0, BleConstants.transferOpAck)
+          ..setUint16(1, seq, Endian.little);
+        await char.write(bd.buffer.asUint8List(), withoutResponse: true);
+        return;
+      }
+
+      print("Transfer: ${missing.length} Lücken, fordere nach");
+      for (final range in missing) {
+        final bd = ByteData(5)
+          ..setUint8(0, BleConstants.transferOpNack)
+          ..setUint16(1, range[0], Endian.little)
+          ..setUint16(3, range[1], Endian.little);
+        await char.write(bd.buffer.asUint8List(), withoutResponse: true);
+      }
+    } catch (e) {
+      print("Transfer-Antwort fehlgeschlagen: $e");
+    }
+  }
+
+  /// Dekodiert die lückenlos empfangenen Chunks ab Chunk 0.
+  List<int> _decodeReceivedPayload() {
+    final bytes = <int>[];
+    for (int i = 0; _chunks.containsKey(i); i++) {
+      bytes.addAll(_chunks[i]!);
+    }
+    if (_encoding == BleConstants.encodingVarint) {
+      return decodeVarintTicks(bytes);
+    }
+    return _parseTo32Bit(
+        Uint8List.fromList(bytes.sublist(0, bytes.length - bytes.length % 4)));
+  }
+
+  /// Referenzdecoder zu capture_store.c: Basis-Tick als u32 LE, danach pro Tick die zigzag-kodierte
+  /// Änderung des Abstands zum vorherigen Tick als LEB128-Varint. Bricht beim ersten unvollständigen Eintrag ab.
+  static List<int> decodeVarintTicks(List<int> bytes) {
+    if (bytes.length < 4) return [];
+    final bd = ByteData.sublistView(Uint8List.fromList(bytes));
+    int tick = bd.getUint32(0, Endian.little);
+    int delta = 0;
+    final result = <int>[tick];
+
+    int i = 4;
+    while (i < bytes.length) {
+      int value = 0;
+      int shift = 0;
+      int b;
+      do {
+        if (i >= bytes.length) return result;
+        b = bytes[i++];
+        value |= (b & 0x7F) << shift;
+        shift += 7;
+      } while ((b & 0x80) != 0 && shift < 35);
+
+      final diff = (value >> 1) ^ -(value & 1);
+      delta = (delta + diff) & 0xFFFFFFFF;
+      tick = (tick + delta) & 0xFFFFFFFF;
+      result.add(tick);
+    }
+    return result;
+  }
+
   List<int> _parseTo32Bit(Uint8List bytes) {
     final List<int> result = [];
     final byteData = ByteData.sublistView(bytes);
@@ -0,0 +1,56 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:project_camel/services/session_calculator_service.dart';
+
+// Aufgezeichnete Session aus trichter-device/tests/common/recorded_session.h (300 Pulse, Kalibrierung 300).
+// Das Gerät rechnet Peak und Durchschnitt beim Run-Ende selbst aus (src/flow_stats.c),
+// trichter-device/tests/flow_stats prüft es gegen die Werte hier.
+const recordedSessionTicks = [
+  0, 3579, 7238, 10556, 13843, 16868, 19683, 22604, 25152, 27601,
+  29877, 32079, 34181, 36231, 38056, 39644, 41265, 42711, 43919, 45080,
+  46198, 47370, 48479, 49614, 50757, 51841, 52957, 54073, 55271, 56461,
+  57618, 58795, 59942, 61079, 62185, 63299, 64377, 65467, 66531, 67697,
+  68808, 69974, 71119, 72257, 73369, 74486, 75580, 76694, 77771, 78924,
+  79960, 81003, 82096, 83154, 84196, 85229, 86270, 87389, 88495, 89630,
+  90764, 91833, 92856, 93967, 95004, 96130, 97144, 98207, 99229, 100296,
+  101387, 102446, 103548, 104637, 105726, 106744, 107751, 108773, 109818, 110866,
+  111864, 112905, 113898, 114970, 116032, 117026, 118030, 119094, 120132, 121213,
+  122247, 123235, 124208, 125220, 126216, 127206, 128263, 129324, 130402, 131400,
+  132412, 133491, 134536, 135596, 136616, 137686, 138702, 139773, 140771, 141796,
+  142826, 143857, 144897, 145888, 146884, 147893, 148911, 149873, 150919, 151979,
+  153036, 154019, 155063, 156078, 157061, 158039, 158986, 160001, 160971, 161936,
+  162949, 163991, 164939, 165971, 166933, 167909, 168959, 169956, 170943, 171931,
+  172944, 173996, 174958, 175971, 176947, 177910, 178894, 179847, 180822, 181771,
+  181796, 182793, 183795, 184743, 185710, 186767, 187786, 188778, 189734, 190776,
+  191774, 192724, 193713, 194719, 195675, 196664, 197699, 198644, 199634, 200632,
+  201596, 202611, 203637, 204664, 205618, 206587, 207595, 208574, 209600, 210645,
+  211622, 212654, 213638, 214633, 215627, 216596, 217553, 218512, 219535, 220598,
+  221579, 222628, 223662, 224659, 225722, 226741, 227735, 228799, 229771, 230731,
+  231768, 232792, 233836, 234877, 235891, 236883, 237906, 238875, 239901, 240953,
+  241982, 243010, 244001, 245088, 246169, 247180, 248231, 249233, 250318, 251383,
+  252378, 253383, 254485, 255513, 256582, 257599, 258659, 259760, 260771, 261796,
+  262802, 263796, 264801, 265823, 266853, 267917, 269029, 270078, 271200, 272322,
+  273440, 274542, 275573, 276664, 277737, 278848, 279903, 281004, 282077, 283157,
+  284200, 285249, 286380, 287479, 288548, 289690, 290815, 291908, 293008, 294051,
+  295120, 296230, 297288, 298354, 299511, 300637, 301806, 302928, 304031, 305197,
+  306389, 307434, 308458, 309512, 310611, 311750, 312915, 314106, 315398, 316795,
+  318160, 319615, 321275, 323025, 324898, 326830, 328862, 331015, 333350, 335987,
+  338846, 341933, 344960, 348113, 351588, 355248, 359084, 363321, 367631, 372471,
+];
+
+void main() {
+  // Wie TrichterDataHandler._checkAndFinalize() mit 8 µs pro Tick
+  final msValues = recordedSessionTicks.map((t) => ((t * 8.0) / 1000).round()).toList();
+
+  test('Peak Flow der aufgezeichneten Session', () {
+    expect(SessionCalculatorService.calculatePeakFlow(msValues, 300), closeTo(0.213420838, 1e-9));
+  });
+
+  test('Durchschnittlicher Flow der aufgezeichneten Session', () {
+    expect(msValues.last, 2980);
+    expect(SessionCalculatorService.calculateAverageFlow(msValues.last, 500), closeTo(0.167785235, 1e-9));
+  });
+
+  test('Pulse im selben ms zählen nicht als Intervall', () {
+    expect(msValues.sublist(149, 152), [1454, 1454, 1462]);
+  });
+}
@@ -0,0 +1,44 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:project_camel/services/trichter_data_handler.dart';
+
+// Bytes wie sie capture_store_encoded_read() auf dem Gerät liefert (trichter-device/src/capture_store.c),
+// jeweils mit den Ticks, die vorher per capture_store_append() gespeichert wurden.
+void main() {
+  group('decodeVarintTicks', () {
+    test('gleichmäßiger Fluss, 1 Byte pro Puls', () {
+      const bytes = [0x00, 0x00, 0x00, 0x00, 0xC4, 0x13, 0x00, 0x03, 0x0A, 0x07, 0x02];
+      expect(TrichterDataHandler.decodeVarintTicks(bytes),
+          [0, 1250, 2500, 3748, 5001, 6250, 7500]);
+    });
+
+    test('Überlauf des 32-Bit-Timers', () {
+      const bytes = [0x00, 0xF0, 0xFF, 0xFF, 0xCA, 0x0F, 0x02, 0x01, 0x02, 0x01, 0x02];
+      expect(TrichterDataHandler.decodeVarintTicks(bytes),
+          [4294963200, 4294964197, 4294965195, 4294966192, 4294967190, 891, 1889]);
+    });
+
+    test('Abstände ab 64 Ticks, mehrbytige Varints', () {
+      const bytes = [
+        0x64, 0x00, 0x00, 0x00, 0x80, 0x01, 0x02, 0x7E, 0xD0, 0x0D, 0xB0, 0x70, //
+        0x90, 0xA1, 0x0E, 0x8F, 0xA0, 0x0F, 0xE0, 0xE0, 0xC9, 0x03,
+      ];
+      expect(TrichterDataHandler.decodeVarintTicks(bytes),
+          [100, 164, 229, 357, 1357, 9549, 134549, 134613, 3884613]);
+    });
+
+    test('Sprung über den halben Zahlenbereich, 5-Byte-Varints', () {
+      const bytes = [
+        0x05, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F, //
+        0xFD, 0xFF, 0xFF, 0xFF, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F,
+      ];
+      expect(TrichterDataHandler.decodeVarintTicks(bytes), [5, 5, 2147483653, 2147483654, 7]);
+    });
+
+    test('bricht beim ersten unvollständigen Eintrag ab', () {
+      const bytes = [0x64, 0x00, 0x00, 0x00, 0x80, 0x01, 0x02, 0x7E, 0xD0];
+      expect(TrichterDataHandler.decodeVarintTicks(bytes), [100, 164, 229, 357]);
+      expect(TrichterDataHandler.decodeVarintTicks(bytes.sublist(0, 4)), [100]);
+      expect(TrichterDataHandler.decodeVarintTicks(bytes.sublist(0, 3)), isEmpty);
+    });
+  });
+}
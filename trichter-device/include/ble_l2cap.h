@@ -0,0 +1,24 @@
+#ifndef BLE_L2CAP_H
+#define BLE_L2CAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/bluetooth/conn.h>
+#include "session.h"
+
+/*
+Bulk session download over an L2CAP connection oriented channel.
+The app connects to the PSM published in the PSM characteristic. Per session it receives:
+  START SDU: {flag 0xAA, u16 0, u8 0} + start payload (same as the GATT START packet)
+  DATA SDUs: {flag 0xBB, u16 byte offset in the payload, u8 0} + payload bytes up to the end of the SDU
+  END SDU:   {flag 0xCC, u16 0, u8 0}
+The payload is encoded as announced in START. Flow control and segmentation are done by the stack,
+so DATA SDUs are as large as the app's MTU allows. An encoded session that fits into one SDU is not
+copied at all: the SDU points into the capture store, which is lent to the stack until it is sent.
+*/
+int ble_l2cap_init(void);
+uint16_t ble_l2cap_psm(void);
+bool ble_l2cap_is_connected(const struct bt_conn *conn);
+int ble_l2cap_send_session(struct session *session, uint8_t encoding);
+
+#endif /* BLE_L2CAP_H */
@@ -0,0 +1,62 @@
+#ifndef BLE_LINK_H
+#define BLE_LINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+
+typedef enum {
+    BLE_LINK_PROFILE_IDLE = 0,      // long interval with peripheral latency, saves power in READY/IDLE
+    BLE_LINK_PROFILE_TRANSFER,      // short interval, no latency, while sessions are sent
+    BLE_LINK_PROFILE_MAX
+} ble_link_profile_t;
+
+/*
+Negotiated parameters of the current connection, as reported by the controller.
+Interval in units of 1.25 ms, supervision timeout in units of 10 ms.
+*/
+struct ble_link_info {
+    uint8_t tx_phy;
+    uint8_t rx_phy;
+    uint16_t tx_data_len;
+    uint16_t rx_data_len;
+    uint16_t interval;
+    uint16_t latency;
+    uint16_t timeout;
+    uint16_t mtu;
+    uint8_t profile;                // profile the granted parameters fall into, BLE_LINK_PROFILE_MAX if none
+};
+
+/*
+Per connection link state, kept with the peer that owns the connection. Every link negotiates 2M PHY,
+data length and MTU on connect; only the link sessions are sent to gets the transfer profile, all
+others stay in the idle profile.
+*/
+struct ble_link {
+    struct bt_conn *conn;           // NULL: not attached
+    ble_link_profile_t applied;     // profile the parameters granted by the central fall into
+    ble_link_profile_t requested;   // last profile requested from the central
+    uint8_t retries;                // requests of that profile the central refused or ignored
+    bool negotiated;                // PHY and data length update were started on this connection
+    struct ble_link_info info;
+    struct k_work_delayable update_work;
+};
+
+/*PUBLIC API*/
+
+void ble_link_init(struct ble_link *link);
+void ble_link_attach(struct ble_link *link, struct bt_conn *conn);
+void ble_link_detach(struct ble_link *link);
+void ble_link_select(struct ble_link *link);
+
+void ble_link_profile_idle(void);
+void ble_link_profile_transfer(void);
+void ble_link_hold_transfer(bool hold);
+
+void ble_link_get_info(const struct ble_link *link, struct ble_link_info *info);
+
+/*Provided by the owner of the connections (bluetooth.c), NULL for a connection it did not accept*/
+struct ble_link *ble_link_of(const struct bt_conn *conn);
+
+#endif /* BLE_LINK_H */
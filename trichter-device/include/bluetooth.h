@@ -3,15 +3,43 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "state_machine.h"
+#include "session.h"
+#include "flow_stats.h"
 
+#define START_PAYLOAD_SIZE      15 //count, calibration, missed pulses, end of run timeout, session seq, payload size, encoding, lane | race place << 4, session flags
+
+enum transmission_flags {
+    TX_FLAG_START = 0xAA,
+    TX_FLAG_DATA = 0xBB,
+    TX_FLAG_END = 0xCC,
+    TX_FLAG_LIVE = 0xDD,        //pulses of the running session, chunk index is the index of the first one
+    TX_FLAG_LIVE_END = 0xDE     //start payload and crc32 of all raw ticks, closes a live streamed session
+};
+
+/*Written by the app to the transfer characteristic*/
+enum transfer_opcode {
+    TRANSFER_OP_ACK = 0x01,     // u16 session seq: everything received
+    TRANSFER_OP_NACK = 0x02,    // u16 first chunk, u16 number of chunks: resend these
+    TRANSFER_OP_ENCODING = 0x03,// u8 session_encoding the app can decode, for the rest of the connection
+    TRANSFER_OP_LIVE = 0x04     // u8 1: stream pulses while running, for the rest of the connection
+};
+
+#define BLE_LIVE_BATCH_PULSES   CONFIG_TRICHTER_BLE_LIVE_BATCH_PULSES
+#define BLE_LIVE_BATCH_MS       CONFIG_TRICHTER_BLE_LIVE_BATCH_MS
 
 int init_ble(uint8_t timer_tick_duration);
 
 int ble_send_start();
 bool is_ble_connected();
 int ble_send_chunk();
-int ble_prepare_send(uint32_t *data_buffer, const uint32_t num_elements);
+int ble_prepare_send(const struct session *session);
 bool ble_is_sending();
+void ble_sender_kick();
+bool ble_live_active();
+bool ble_live_submit(uint16_t seq, uint16_t first, const uint32_t *ticks, uint8_t count);
+uint16_t ble_fill_start_payload(const struct session *session, uint8_t encoding, uint8_t *payload);
+uint16_t ble_payload_size(const struct session *session, uint8_t encoding);
+uint16_t ble_fill_payload(const struct session *session, uint8_t encoding, uint16_t offset, uint8_t *buf, uint16_t len);
 void delete_all_connections();
 
 typedef enum RemoteState {
@@ -25,5 +53,6 @@ typedef void (*RemoteStateInputHandler)(RemoteState);
 void ble_register_state_input_handler(RemoteStateInputHandler handler);
 void ble_state_notifier(StateID_t state);
 void ble_calibration_attempt_notifier(bool success);
+void ble_flow_result_notifier(const struct session_header *header, const struct flow_summary *summary);
 
 #endif //TRICHTER_BLUETOOTH_H
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "state_machine.h"
+#include "flow_stats.h"
 
 typedef enum {
     BLE_ADV_OFF = 0,
@@ -18,6 +19,8 @@ void bluetooth_advertising_fsm_start(void);
 void bluetooth_advertising_start_fast(void);
 void bluetooth_advertising_start_slow(void);
 void bluetooth_advertising_stop(void);
+void bluetooth_advertising_start_broadcast(void);
+void bluetooth_advertising_set_result(uint16_t seq, const struct flow_summary *summary);
 
 bool bluetooth_advertising_is_active(void);
 
@@ -11,5 +11,19 @@
 
 #define BT_UUID_REMOTE_STATE_CHAR_VAL BT_UUID_128_ENCODE(0x9b6d1c3a, 0x91a2, 0x4f23, 0x8c11, 0x1a2b3c4d5e6f)
 
+#define BT_UUID_TRANSFER_CHAR_VAL BT_UUID_128_ENCODE(0x5c0e4a71, 0x2d8b, 0x4b9e, 0x9f3a, 0x7c61e2d40b58)
+
+#define BT_UUID_LINK_INFO_CHAR_VAL BT_UUID_128_ENCODE(0xd3a81f26, 0x6e04, 0x4c57, 0xb1d9, 0x28f5a0c7e913)
+
+#define BT_UUID_L2CAP_PSM_CHAR_VAL BT_UUID_128_ENCODE(0x71b4e09c, 0x3f52, 0x4a1d, 0x8e67, 0xc90d5b2a4f18)
+
+#define BT_UUID_SESSION_INFO_CHAR_VAL BT_UUID_128_ENCODE(0x0e8f6b43, 0x95c1, 0x4d2a, 0xa7f0, 0x3b64d1e8c52a)
+
+#define BT_UUID_SESSION_DATA_CHAR_VAL BT_UUID_128_ENCODE(0x8a27c5d9, 0x14e6, 0x4f8b, 0xbc35, 0x6e0f9a2d7b41)
+
+#define BT_UUID_SESSION_LOG_CHAR_VAL BT_UUID_128_ENCODE(0xb5d2e714, 0x7a9c, 0x4e03, 0x96b8, 0x1f4c3a7d20e6)
+
+#define BT_UUID_FLOW_RESULT_CHAR_VAL BT_UUID_128_ENCODE(0x2f6d91c8, 0x3b07, 0x4a5e, 0x8d14, 0xc7e0b95a6f32)
+
 
 #endif /* BLUETOOTH_COMMON_H */
@@ -0,0 +1,44 @@
+#ifndef CAPTURE_BACKEND_H
+#define CAPTURE_BACKEND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CAPTURE_BACKEND_MAX_LANES   2
+#define CAPTURE_COUNTER_CC_FSM      0 //pulse counter snapshots of the FSM thread
+#define CAPTURE_COUNTER_CC_ISR      1 //pulse counter snapshots of the sensor ISR
+
+/*
+Everything the capture path needs from the hardware: a free running timebase ticking at
+TIMER_FREQUENCY_HZ, one capture register per lane latched by the sensor edge, one compare that ends
+the run, an optional pulse counter per lane and the sensor interrupts.
+On the board this is TIMER2/TIMER3 wired to GPIOTE through PPI (capture_backend_nrfx.c), on
+native_sim a pulse train injector replays recorded ticks (capture_backend_sim.c).
+Both callbacks run in interrupt context.
+*/
+struct capture_backend_cb {
+    void (*pulse)(uint8_t lane);    //sensor edge, its tick is in capture_backend_read(lane)
+    void (*compare)(void);          //timebase reached the tick set with capture_backend_compare_set
+};
+
+int capture_backend_init(const struct capture_backend_cb *cb);
+
+/*Timebase*/
+void capture_backend_start(void);
+void capture_backend_stop(void);
+void capture_backend_clear(void);   //back to zero, captures and compare cleared
+uint32_t capture_backend_now(void);
+uint32_t capture_backend_read(uint8_t lane);
+
+/*End of run compare*/
+void capture_backend_compare_set(uint32_t tick);
+void capture_backend_compare_disable(void);
+
+/*Pulse counters, every edge is counted even if the capture was overwritten before it was read*/
+bool capture_backend_counter_present(uint8_t lane);
+uint32_t capture_backend_counter(uint8_t lane, uint8_t cc_channel);
+
+/*Sensor interrupts, pulses are still counted while disabled*/
+void capture_backend_irq_enable(uint8_t lane, bool enable);
+
+#endif //CAPTURE_BACKEND_H
@@ -0,0 +1,74 @@
+#ifndef CAPTURE_STORE_H
+#define CAPTURE_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CAPTURE_STORE_BYTES                 2048
+#define CAPTURE_STORE_MAX_TICKS             2048
+#define CAPTURE_STORE_CHECKPOINT_INTERVAL   128
+#define CAPTURE_STORE_NUM_CHECKPOINTS       (CAPTURE_STORE_MAX_TICKS / CAPTURE_STORE_CHECKPOINT_INTERVAL)
+#define CAPTURE_STORE_ENCODED_BASE_BYTES    4
+#define CAPTURE_STORE_TX_HEADROOM           32
+
+/*
+Compact in-RAM representation of one session.
+The first tick is kept as absolute base value. Every following tick is stored as the zigzag encoded
+difference between its interval and the previous interval, written as LEB128 varint. For a steady
+flow this is one byte per pulse; a long gap simply spills into more bytes (the continuation bit acts
+as escape), up to 5 bytes for a full 32 bit jump.
+Every CAPTURE_STORE_CHECKPOINT_INTERVAL ticks the decoder state is saved, so reconstruction can start
+at any index after decoding at most CAPTURE_STORE_CHECKPOINT_INTERVAL - 1 entries.
+Density: a steady session costs 1 byte per pulse plus 10 / 128 bytes of checkpoints, ~1.08 bytes
+against 4 for a raw u32 (~3.7x). Byte aligned varints cannot go beyond 4x; denser checkpoints would
+make random access cheaper but eat into it.
+*/
+#pragma pack(push, 1)
+struct capture_checkpoint {
+    uint16_t offset;        //byte offset of the entry for tick idx * CAPTURE_STORE_CHECKPOINT_INTERVAL
+    uint32_t tick;          //absolute tick before that entry
+    uint32_t delta;         //interval before that entry
+};
+#pragma pack(pop)
+
+struct capture_store {
+    uint32_t base;
+    uint32_t last;
+    uint32_t last_delta;
+    uint16_t count;         //number of ticks stored
+    uint16_t used;          //bytes of data in use
+    uint8_t tx_headroom[CAPTURE_STORE_TX_HEADROOM]; //transport headers and the base go here while the data is lent out
+    uint8_t data[CAPTURE_STORE_BYTES];
+    struct capture_checkpoint checkpoints[CAPTURE_STORE_NUM_CHECKPOINTS];
+};
+
+struct capture_store_iter {
+    const struct capture_store *store;
+    uint16_t idx;           //index of the tick returned by the next call to capture_store_iter_next
+    uint16_t offset;
+    uint32_t tick;
+    uint32_t delta;
+};
+
+void capture_store_reset(struct capture_store *store);
+int capture_store_append(struct capture_store *store, uint32_t tick);
+uint16_t capture_store_count(const struct capture_store *store);
+uint32_t capture_store_last(const struct capture_store *store);
+
+/*Reconstruction of absolute ticks*/
+void capture_store_iter_init(struct capture_store_iter *it, const struct capture_store *store, uint16_t start_idx);
+bool capture_store_iter_next(struct capture_store_iter *it, uint32_t *tick);
+uint16_t capture_store_read(const struct capture_store *store, uint16_t start_idx, uint32_t *ticks, uint16_t max_ticks);
+
+/*
+Encoded form for transfer: the base tick as u32 little endian, followed by the varint entries as stored.
+capture_store_decode is the reference decoder, it stops at the first truncated entry.
+*/
+uint16_t capture_store_encoded_size(const struct capture_store *store);
+uint16_t capture_store_encoded_read(const struct capture_store *store, uint16_t offset, uint8_t *buf, uint16_t len);
+uint16_t capture_store_decode(const uint8_t *encoded, uint16_t len, uint32_t *ticks, uint16_t max_ticks);
+
+/*Rebuilds a store whose varint entries were copied into data, e.g. from flash. Fails on inconsistent input.*/
+int capture_store_restore(struct capture_store *store, uint32_t base, uint16_t count, uint16_t used);
+
+#endif //CAPTURE_STORE_H
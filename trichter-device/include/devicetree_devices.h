@@ -3,9 +3,6 @@
 
 #include <zephyr/device.h>
 #include <zephyr/drivers/gpio.h>
-#include <nrfx_gpiote.h>
-#include <helpers/nrfx_gppi.h>
-#include <hal/nrf_gpiote.h>
 
 #define BUTTON_READY	    DT_ALIAS(buttonrdy)
 #define BUTTON_PAIRING      DT_ALIAS(buttonpairing)
@@ -19,21 +16,30 @@
     #error "Unsupported board: buttonPair devicetree alias is not defined"
     #endif
 #endif
-#if !DT_NODE_HAS_STATUS_OKAY(BUTTON_TEST_SENSOR)
-#error "Unsupported board: buttonTest devicetree alias is not defined"
+#ifdef CONFIG_TRICHTER_CAPTURE_BACKEND_NRFX //the simulated backend has no sensor pins
+    #if !DT_NODE_HAS_STATUS_OKAY(BUTTON_TEST_SENSOR)
+    #error "Unsupported board: buttonTest devicetree alias is not defined"
+    #endif
+    #if CONFIG_TRICHTER_CAPTURE_LANES > 1
+        #define BUTTON_TEST_SENSOR_1    DT_ALIAS(buttontest1)
+        #if !DT_NODE_HAS_STATUS_OKAY(BUTTON_TEST_SENSOR_1)
+        #error "Race mode needs the second sensor: buttonTest1 devicetree alias is not defined"
+        #endif
+    #endif
 #endif
 
-#define GPIOTE_INST	NRF_DT_GPIOTE_INST(BUTTON_TEST_SENSOR, gpios)
-#define GPIOTE_NODE	DT_NODELABEL(_CONCAT(gpiote, GPIOTE_INST))
-
 #ifndef CONFIG_BUTTONLESS
 static const struct gpio_dt_spec button_ready = GPIO_DT_SPEC_GET_OR(BUTTON_READY, gpios, {0});
 static const struct gpio_dt_spec button_pairing = GPIO_DT_SPEC_GET_OR(BUTTON_PAIRING, gpios, {0});
 #endif
+#ifdef CONFIG_TRICHTER_CAPTURE_BACKEND_NRFX
 static const struct gpio_dt_spec button_test_sensor = GPIO_DT_SPEC_GET_OR(BUTTON_TEST_SENSOR, gpios, {0});
+#if CONFIG_TRICHTER_CAPTURE_LANES > 1
+static const struct gpio_dt_spec button_test_sensor_1 = GPIO_DT_SPEC_GET_OR(BUTTON_TEST_SENSOR_1, gpios, {0});
+#endif
+#endif
 
 static struct gpio_callback button_cb_data_1;
-static struct gpio_callback button_cb_data_2;
 
 /*
  * The led0 devicetree alias is optional. If present, we'll use it
@@ -41,7 +47,9 @@ static struct gpio_callback button_cb_data_2;
  */
 static struct gpio_dt_spec led = GPIO_DT_SPEC_GET_OR(DT_ALIAS(led0), gpios, {0});
 
+#ifdef CONFIG_TRICHTER_CAPTURE_BACKEND_NRFX
 static const struct device *hw_timer_1 = DEVICE_DT_GET(DT_ALIAS(hw_timer));
+#endif
 static bool g_timer_initialized = false;
 
 
@@ -0,0 +1,21 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+
+#define DISPLAY_REFRESH_INTERVAL_MS     33 //~30Hz, faster changes are not visible anyway
+
+/*
+Framebuffer on top of the TM1637 driver.
+The display_* calls only update the framebuffer and never block, so they may be called from any
+thread or ISR. A work item pushes the framebuffer to the TM1637 when its content or brightness
+differs from what was last sent, at most once per DISPLAY_REFRESH_INTERVAL_MS.
+*/
+void display_digits(const uint8_t digits[], uint8_t num_digits, uint8_t brightness, uint8_t dot_at);
+void display_ready(uint8_t brightness);
+void display_error_message(uint8_t brightness);
+void display_bier(uint8_t brightness);
+void display_cal(uint8_t brightness);
+void display_off(void);
+
+#endif //DISPLAY_H
@@ -0,0 +1,31 @@
+#ifndef END_OF_RUN_H
+#define END_OF_RUN_H
+
+#include <stdint.h>
+
+#define END_OF_RUN_MIN_SAMPLES      4 //intervals needed before the estimate replaces max_ticks
+
+/*
+Adaptive end of run detection.
+Tracks the smoothed pulse interval and its mean deviation (same estimator as the TCP retransmit
+timer) and declares the run over after multiple * interval + 4 * deviation without a pulse, clamped
+to [min_ticks, max_ticks]. Until enough intervals are known, max_ticks is used.
+All values are in timer ticks. Updated from the capture path, read from the FSM thread.
+*/
+struct end_of_run {
+    uint32_t min_ticks;
+    uint32_t max_ticks;
+    uint8_t multiple;
+    uint32_t last;          //tick of the previous pulse
+    uint32_t srtt;          //smoothed interval, scaled by 8
+    uint32_t rttvar;        //mean deviation, scaled by 4
+    uint16_t pulses;        //pulses seen since the last reset
+    uint32_t timeout;       //current verdict in ticks
+};
+
+void end_of_run_init(struct end_of_run *eor, uint32_t min_ticks, uint32_t max_ticks, uint8_t multiple);
+void end_of_run_reset(struct end_of_run *eor);
+uint32_t end_of_run_update(struct end_of_run *eor, uint32_t tick);
+uint32_t end_of_run_timeout(const struct end_of_run *eor);
+
+#endif //END_OF_RUN_H
@@ -0,0 +1,46 @@
+#ifndef FLOW_STATS_H
+#define FLOW_STATS_H
+
+#include <stdint.h>
+
+#define FLOW_STATS_HALF_WINDOW      6 //smoothing window is +/- this many intervals, same as the app chart
+#define FLOW_STATS_WINDOW           (2 * FLOW_STATS_HALF_WINDOW + 1)
+#define FLOW_STATS_MAX_ML_PER_S     5000 //single intervals above this are sensor bounce
+#define FLOW_STATS_MIN_PULSES       5 //fewer pulses give no peak, like the app
+
+/*
+Incremental flow analytics of one run, fed with every stored tick. All integer, O(1) per pulse.
+Calibration is the number of pulses per 500 mL. The peak is the maximum of the raw interval flows
+smoothed over a centred window clipped at the run boundaries, the same value the app computes from
+the full tick array. Like the app, intervals are taken between ticks rounded to whole ms and those
+that round to 0 ms are skipped. Centres near the end of the run are only resolved in flow_stats_summary.
+*/
+struct flow_stats {
+    uint16_t calibration;
+    uint32_t ticks_per_ms;
+    uint32_t first;             //tick of the first pulse
+    uint32_t last;              //tick of the newest pulse
+    uint32_t last_ms;           //newest pulse rounded to ms, as the app gets it
+    uint32_t pulses;
+    uint32_t intervals;         //raw flows computed so far, zero length intervals are skipped
+    uint16_t recent[FLOW_STATS_WINDOW]; //ring of the newest raw flows in mL/s
+    uint32_t recent_sum;        //sum of the newest min(intervals, FLOW_STATS_WINDOW) raw flows
+    uint16_t peak;              //highest smoothed flow of all resolved centres
+};
+
+/*Result of a finished run, little endian on the flow result characteristic in this order*/
+struct flow_summary {
+    uint16_t pulses;
+    uint16_t volume_ml;
+    uint32_t duration_ms;       //first to last pulse
+    uint16_t avg_ml_per_s;
+    uint16_t peak_ml_per_s;
+};
+
+void flow_stats_reset(struct flow_stats *fs, uint16_t calibration, uint32_t ticks_per_s);
+void flow_stats_update(struct flow_stats *fs, uint32_t tick);
+uint16_t flow_stats_current(const struct flow_stats *fs);
+uint16_t flow_stats_volume_ml(const struct flow_stats *fs);
+void flow_stats_summary(const struct flow_stats *fs, uint32_t ticks_per_ms, struct flow_summary *summary);
+
+#endif //FLOW_STATS_H
@@ -6,14 +6,21 @@
 
 extern StateMachine_t g_stateMachine;
 
+#define FSM_PERIOD_NONE                         0 //runLoop is only called on events
 #define FSM_PERIOD_FAST_MS                      9
 #define FSM_PERIOD_SLOW_MS                      300
+#define FSM_PERIOD_DISPLAY_MS                   33 //~30Hz, enough for states that only refresh the display
+
+#define FSM_REQUEST_QUEUE_DEPTH                 8
+#define FSM_EVENT_RESCHEDULE                    0xFF //wakes the engine without requesting a transition
 
 void fsm_init();
 void fsm_start();
 void fsm_main(void *p1, void *p2, void *p3);
 uint8_t fsm_transition(StateID_t targetState);
 uint8_t fsm_transition_deferred(StateID_t state);
+void fsm_engine_run(StateMachine_t *sm, uint8_t *run);
+void fsm_state_timeout(StateMachine_t *sm, uint32_t timeout_ms, StateID_t target);
 
 uint8_t ble_fsm_transition(StateMachine_t *sm, StateID_t state);
 uint8_t ble_fsm_transition_deferred(StateMachine_t *sm, StateID_t state);
@@ -0,0 +1,17 @@
+#ifndef LOG_HOT_H
+#define LOG_HOT_H
+
+#include <zephyr/logging/log.h>
+
+/*
+Debug logging for paths that run per pulse, per FSM tick or per BLE chunk.
+With deferred logging these calls only copy the arguments into the log buffer; release images
+(CONFIG_TRICHTER_LOG_HOT_PATH=n) compile them out completely, including argument evaluation.
+*/
+#ifdef CONFIG_TRICHTER_LOG_HOT_PATH
+#define LOG_HOT_DBG(...)    LOG_DBG(__VA_ARGS__)
+#else
+#define LOG_HOT_DBG(...)    do { } while (0)
+#endif
+
+#endif //LOG_HOT_H
@@ -6,6 +6,7 @@
 
 /*MEMORY ID DEFINITIONS*/
 #define CALIBRATION_VALUE_ID    1
+#define SESSION_LOG_ACK_ID      2
 
 
 /*MEMORY GLOBAL RAM DATA DEFINITIONS*/
@@ -14,5 +15,7 @@ void save_counter_ram_to_rom();
 int init_memory_nv();
 int initialize_and_mount_fs(struct nvs_fs *filesys, const struct device *device, const off_t offset, const uint16_t partition_size);
 int read_counter_from_rom(uint16_t *counter_value);
+int memory_read_value(uint16_t id, void *data, size_t len);
+int memory_write_value(uint16_t id, const void *data, size_t len);
 
 #endif //APPL_MEMORY_H
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef PULSE_INJECTOR_H
+#define PULSE_INJECTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/*
+Drives the native_sim capture backend with recorded pulse trains: tick arrays at
+TIMER_FREQUENCY_HZ, as stored in a session or decoded from a download. Only the distances between
+ticks matter, the train starts right away. With a speedup of n the timebase and every train run
+n times faster than real time, so captured ticks are still those of the recording.
+The tick array must stay valid until the train is done.
+*/
+void pulse_injector_set_speedup(uint16_t speedup);
+int pulse_injector_play(uint8_t lane, const uint32_t *ticks, uint16_t count);
+int pulse_injector_wait(uint8_t lane, k_timeout_t timeout);
+bool pulse_injector_busy(uint8_t lane);
+void pulse_injector_stop(uint8_t lane);
+
+#endif //PULSE_INJECTOR_H
@@ -0,0 +1,32 @@
+#ifndef PULSE_RING_H
+#define PULSE_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PULSE_RING_SIZE     128 //must be a power of two
+#define PULSE_RING_MASK     (PULSE_RING_SIZE - 1)
+
+/*
+Lock-free single-producer/single-consumer ring for captured timer values.
+The producer (sensor ISR) only writes head, the consumer (FSM thread) only writes tail.
+Both are free running sequence numbers, so head - tail is the fill level and head is the
+total number of pulses ever pushed.
+*/
+struct pulse_ring {
+    uint32_t buf[PULSE_RING_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped;  //pushes rejected because the ring was full
+};
+
+/*Producer side*/
+bool pulse_ring_push(struct pulse_ring *ring, uint32_t value);
+uint32_t pulse_ring_produced(const struct pulse_ring *ring);
+
+/*Consumer side*/
+bool pulse_ring_pop(struct pulse_ring *ring, uint32_t *value);
+void pulse_ring_skip_to(struct pulse_ring *ring, uint32_t seq);
+uint32_t pulse_ring_available(const struct pulse_ring *ring);
+
+#endif //PULSE_RING_H
@@ -8,8 +8,11 @@
 
 #define TIMER_FREQUENCY_HZ				125000
 #define TIMER_TICK_DURATION_US			8
-#define MEARUEMENT_END_TIMEOUT_MS		1000 //TODO Adapt to real values with: max_drinking_time / (TICKS_PER_LTR/2) = max_time_between ticks
-#define TIMER_TIMEOUT_TIMESTAMP_DIFF	TIMER_FREQUENCY_HZ / 1000 * MEARUEMENT_END_TIMEOUT_MS
+#define TIMER_TICKS_PER_MS				(TIMER_FREQUENCY_HZ / 1000)
+#define END_OF_RUN_MIN_TICKS			(TIMER_TICKS_PER_MS * CONFIG_TRICHTER_END_OF_RUN_MIN_MS)
+#define END_OF_RUN_MAX_TICKS			(TIMER_TICKS_PER_MS * CONFIG_TRICHTER_END_OF_RUN_MAX_MS) //also used until the pulse rate is known
+
+#define CAPTURE_LANES					CONFIG_TRICHTER_CAPTURE_LANES
 
 void init_seven_seg();
 
@@ -17,14 +20,15 @@ void endless_loop();
 
 void init_gpio_outputs();
 
+void capture_lanes_init();
 uint8_t init_gpio_inputs();
+uint8_t setup_isr_for_gpio_in(const struct gpio_dt_spec *input, struct gpio_callback *cb, gpio_callback_handler_t handler, unsigned long flags);
 
 void input_request_state_ready();
 void input_request_pairing_mode();
 void input_request_state_calibrating();
 void ble_remote_state_dispatch(RemoteState state);
 
-void sensor_triggered_isr(const struct device *dev, struct gpio_callback *cb, unsigned int pins);
 void ble_delete_active_connection();
 
 int get_timer_tick_duration();
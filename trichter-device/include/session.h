@@ -0,0 +1,36 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "capture_store.h"
+
+/*Metadata recorded alongside the pulses of one session*/
+struct session_header {
+    uint16_t seq;               //session sequence number, increments with every run
+    uint16_t missed_pulses;     //pulses counted by the hardware counter but not stored
+    uint16_t end_of_run_ms;     //silence after the last pulse that ended the run
+    uint8_t lane;               //sensor input the run was captured on, not kept in the flash log
+    uint8_t place;              //finishing place in a race, 0 if no other lane ran
+    uint8_t flags;              //SESSION_FLAG_*
+};
+
+/*Bits of session_header.flags, sent in the START payload*/
+enum session_flags {
+    SESSION_FLAG_INTERPOLATED = 0x01,   //ticks after the first were spread evenly between counter samples, not captured
+};
+
+/*Payload encodings of a session on the wire, announced in the START packet*/
+enum session_encoding {
+    SESSION_ENCODING_RAW = 0,       //absolute ticks, u32 little endian each
+    SESSION_ENCODING_VARINT = 1,    //capture store encoding, see capture_store_encoded_read
+    SESSION_ENCODING_MAX
+};
+
+struct session {
+    struct session_header header;
+    bool persisted;             //also held in the flash session log
+    struct capture_store store;
+};
+
+#endif //SESSION_H
@@ -0,0 +1,26 @@
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "session.h"
+
+/*
+Append only ring of finished sessions on the session_log flash partition, so runs recorded without a
+phone survive until the next sync, even across power cycles. Sessions count as pending until the app
+acknowledges them; acknowledged ones are only erased when their sector is needed again.
+*/
+struct session_log_info {
+    uint16_t pending;           //sessions not acknowledged yet
+    uint16_t first_pending_seq;
+    uint16_t last_seq;          //newest session in the log
+    uint16_t dropped;           //pending sessions erased because the log was full
+};
+
+int session_log_init(void);
+int session_log_append(const struct session *session);
+bool session_log_queue_next(void);
+void session_log_ack(uint16_t seq);
+void session_log_get_info(struct session_log_info *info);
+
+#endif //SESSION_LOG_H
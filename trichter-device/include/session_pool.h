@@ -0,0 +1,41 @@
+#ifndef SESSION_POOL_H
+#define SESSION_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "session.h"
+
+#ifdef CONFIG_TRICHTER_SESSION_SLOTS
+#define SESSION_POOL_SLOTS      CONFIG_TRICHTER_SESSION_SLOTS
+#else
+#define SESSION_POOL_SLOTS      3
+#endif
+
+/*
+Fixed set of session slots, so a new run can be captured while earlier ones are still sent.
+A slot cycles FREE -> CAPTURING -> QUEUED -> SENDING -> FREE. Queued sessions are sent oldest first.
+If no slot is free, acquiring steals the oldest queued session (nobody is there to receive it);
+the slot currently being sent is never touched.
+Safe to call from the FSM thread and the BLE sender thread concurrently.
+*/
+struct session *session_pool_acquire(void);
+struct session *session_pool_acquire_restore(uint16_t seq);
+void session_pool_set_next_seq(uint16_t seq);
+void session_pool_commit(struct session *session);
+void session_pool_release(struct session *session);
+
+/*Sender side*/
+struct session *session_pool_next_queued(void);
+void session_pool_requeue(struct session *session);
+uint16_t session_pool_num_queued(void);
+uint32_t session_pool_num_dropped(void);
+
+/*
+Random access to completed sessions, queued or already sent, until their slot is captured into again.
+A pinned session is never overwritten; pin only for the duration of one read.
+*/
+bool session_pool_latest_seq(uint16_t *seq);
+const struct session *session_pool_pin(uint16_t seq);
+void session_pool_unpin(const struct session *session);
+
+#endif //SESSION_POOL_H
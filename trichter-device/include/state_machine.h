@@ -69,11 +69,20 @@ typedef struct {
     const State_t *current;
     const State_t *states;
     uint8_t num_states;
-    StateID_t requestStateDeferred;
+    StateID_t errorState;
+    struct k_msgq *requests;        // Deferred transition requests, FIFO, posted from any context
+    uint8_t lastRequest;            // Newest queued request, used to coalesce duplicates
+    int64_t timeoutAt;              // Uptime in ms at which timeoutTarget is requested, 0 = no state timeout
+    StateID_t timeoutTarget;
     int error;
     struct k_mutex lock;
-    uint16_t period_ms;
+    uint16_t period_ms;             // runLoop period, FSM_PERIOD_NONE = only run on events
+    k_tid_t engine;                 // Thread in fsm_engine_run, it picks up its own changes without a wake up
     bool notify;
+#ifdef CONFIG_TRICHTER_FSM_TIMING
+    uint32_t maxTransitionCycles;   // Slowest transition so far, onExit and onEntry included
+    uint32_t maxRunCycles;          // Slowest runLoop so far
+#endif
 } StateMachine_t;
 
 
@@ -22,6 +22,18 @@
 #define TM1637_BRIGHTNESS_MID      0x05
 #define TM1637_BRIGHTNESS_LOW      0x01
 
+#define TM1637_FRAME_MAX_SEGMENTS  6
+
+/* One complete display update: segment data from address 0xC0 on, then the display control byte */
+struct tm1637_frame {
+    uint8_t segments[TM1637_FRAME_MAX_SEGMENTS];
+    uint8_t num_segments;
+    uint8_t control;        /* TM1637_CMD_SET_BRIGHT | brightness or TM1637_CMD_DISPLAY_OFF */
+};
+
+/* Called from the timer ISR with TM1637_OK, -EIO if the chip did not ACK or -ECANCELED if replaced */
+typedef void (*tm1637_complete_cb)(int result, void *user_data);
+
 /**
  * @brief Initialize the TM1637 GPIO pins
  *
@@ -31,7 +43,28 @@
  */
 int tm1637_init(void);
 
+/**
+ * @brief Queue a frame for transmission and return immediately
+ *
+ * The frame is copied. If a frame is already on the wire, this one is sent after it and
+ * replaces any other frame still waiting.
+ *
+ * @return TM1637_OK if queued, -EINVAL for too many segments
+ */
+int tm1637_submit(const struct tm1637_frame *frame, tm1637_complete_cb cb, void *user_data);
+
+bool tm1637_busy(void);
+
+
+/* Frame builders, fill a frame without sending it */
+void tm1637_frame_off(struct tm1637_frame *frame);
+void tm1637_frame_digits(struct tm1637_frame *frame, const uint8_t digits[], uint8_t num_digits, uint8_t brightness, uint8_t dot_at);
+void tm1637_frame_ready(struct tm1637_frame *frame, uint8_t brightness);
+void tm1637_frame_error_message(struct tm1637_frame *frame, uint8_t brightness);
+void tm1637_frame_bier(struct tm1637_frame *frame, uint8_t brightness);
+void tm1637_frame_cal(struct tm1637_frame *frame, uint8_t brightness);
 
+/* Immediate helpers: build and submit. States should use display.h instead */
 void tm1637_display_digits(uint8_t digits[], uint8_t num_digits, uint8_t brightness, uint8_t dot_at);
 
 void tm1637_display_ready(uint8_t brightness);
@@ -0,0 +1,250 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/l2cap.h>
+#include <zephyr/net_buf.h>
+
+#include "ble_l2cap.h"
+#include "bluetooth.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(ble_l2cap, CONFIG_TRICHTER_BLE_LOG_LEVEL);
+
+
+#define BLE_L2CAP_SDU_MAX           1024 //bytes per DATA SDU, the app's MTU may lower it
+#define BLE_L2CAP_TX_BUFS           2
+#define BLE_L2CAP_HEADER_SIZE       4
+#define BLE_L2CAP_ALLOC_TIMEOUT_MS  5000
+#define BLE_L2CAP_SENT_TIMEOUT_MS   5000
+
+#define BLE_L2CAP_LEND_TIMEOUT_MS   30000 //the stack drops its references at the latest on disconnect
+
+NET_BUF_POOL_DEFINE(l2cap_tx_pool, BLE_L2CAP_TX_BUFS, BT_L2CAP_SDU_BUF_SIZE(BLE_L2CAP_SDU_MAX), 0, NULL);
+
+static void l2cap_lent_destroy(struct net_buf *buf);
+NET_BUF_POOL_DEFINE(l2cap_lent_pool, 1, 0, 0, l2cap_lent_destroy); //external data only, no buffer memory
+
+BUILD_ASSERT(CAPTURE_STORE_TX_HEADROOM >= BT_L2CAP_SDU_CHAN_SEND_RESERVE + BLE_L2CAP_HEADER_SIZE + CAPTURE_STORE_ENCODED_BASE_BYTES,
+             "capture store headroom too small for the L2CAP and SDU headers");
+
+static struct bt_l2cap_le_chan g_l2cap_chan;
+static volatile bool g_l2cap_connected = false;
+
+K_SEM_DEFINE(l2cap_sent_sem, 0, K_SEM_MAX_LIMIT);
+K_SEM_DEFINE(l2cap_returned_sem, 0, 1);
+
+
+static void l2cap_lent_destroy(struct net_buf *buf)
+{
+    net_buf_destroy(buf);
+    k_sem_give(&l2cap_returned_sem); //the capture store is ours again
+}
+
+
+static void l2cap_connected(struct bt_l2cap_chan *chan)
+{
+    LOG_INF("L2CAP channel connected, TX MTU %d, MPS %d", g_l2cap_chan.tx.mtu, g_l2cap_chan.tx.mps);
+    g_l2cap_connected = true;
+    ble_sender_kick();
+}
+
+
+static void l2cap_disconnected(struct bt_l2cap_chan *chan)
+{
+    LOG_INF("L2CAP channel disconnected");
+    g_l2cap_connected = false;
+    k_sem_give(&l2cap_sent_sem); //wake a waiting send, it notices the disconnect
+}
+
+
+static int l2cap_recv(struct bt_l2cap_chan *chan, struct net_buf *buf)
+{
+    LOG_DBG("Ignoring %d bytes received on the L2CAP channel", buf->len);
+    return 0;
+}
+
+
+static void l2cap_sent(struct bt_l2cap_chan *chan)
+{
+    k_sem_give(&l2cap_sent_sem);
+}
+
+
+static const struct bt_l2cap_chan_ops l2cap_ops = {
+    .connected = l2cap_connected,
+    .disconnected = l2cap_disconnected,
+    .recv = l2cap_recv,
+    .sent = l2cap_sent,
+};
+
+
+static int l2cap_accept(struct bt_conn *conn, struct bt_l2cap_server *server, struct bt_l2cap_chan **chan)
+{
+    if (g_l2cap_chan.chan.conn != NULL) {
+        return -ENOMEM; //one channel, the first central to open it gets it, the others download over GATT
+    }
+    memset(&g_l2cap_chan, 0, sizeof(g_l2cap_chan));
+    g_l2cap_chan.chan.ops = &l2cap_ops;
+    *chan = &g_l2cap_chan.chan;
+    return 0;
+}
+
+
+static struct bt_l2cap_server g_l2cap_server = {
+    .psm = 0, //dynamic, published through the PSM characteristic
+    .sec_level = BT_SECURITY_L1,
+    .accept = l2cap_accept,
+};
+
+
+int ble_l2cap_init(void)
+{
+    int err = bt_l2cap_server_register(&g_l2cap_server);
+    if (err) {
+        LOG_ERR("L2CAP server registration failed (%d)", err);
+        return err;
+    }
+    LOG_DBG("L2CAP server on PSM 0x%04x", g_l2cap_server.psm);
+    return 0;
+}
+
+
+uint16_t ble_l2cap_psm(void)
+{
+    return g_l2cap_server.psm;
+}
+
+
+/*The channel is open and belongs to conn*/
+bool ble_l2cap_is_connected(const struct bt_conn *conn)
+{
+    return g_l2cap_connected && conn != NULL && g_l2cap_chan.chan.conn == conn;
+}
+
+
+static struct net_buf *l2cap_alloc_sdu(uint8_t flag, uint16_t index)
+{
+    struct net_buf *buf = net_buf_alloc(&l2cap_tx_pool, K_MSEC(BLE_L2CAP_ALLOC_TIMEOUT_MS));
+    if (buf == NULL) {
+        return NULL;
+    }
+    net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
+    net_buf_add_u8(buf, flag);
+    net_buf_add_le16(buf, index);
+    net_buf_add_u8(buf, 0);
+    return buf;
+}
+
+
+static int l2cap_send_sdu(struct net_buf *buf)
+{
+    if (buf == NULL) {
+        return -ENOBUFS;
+    }
+    if (!g_l2cap_connected) {
+        net_buf_unref(buf);
+        return -ENOTCONN;
+    }
+    int err = bt_l2cap_chan_send(&g_l2cap_chan.chan, buf);
+    if (err < 0) {
+        net_buf_unref(buf);
+        return err;
+    }
+    return 0;
+}
+
+
+/*
+Lends the encoded store to the stack as a single DATA SDU: header and base tick are written into the
+headroom right in front of the varint data, the stack prepends its own headers in front of those.
+Returns only once the stack dropped its last reference, so the slot can be captured into again.
+*/
+static int l2cap_send_lent(struct session *session, uint16_t *num_sdus)
+{
+    struct capture_store *store = &session->store;
+    const uint16_t headroom = sizeof(store->tx_headroom) - BLE_L2CAP_HEADER_SIZE - CAPTURE_STORE_ENCODED_BASE_BYTES;
+    uint8_t *sdu = &store->tx_headroom[headroom];
+    struct net_buf *buf;
+    int err;
+
+    sdu[0] = TX_FLAG_DATA;
+    sys_put_le16(0, &sdu[1]);
+    sdu[3] = 0;
+    sys_put_le32(store->base, &sdu[BLE_L2CAP_HEADER_SIZE]);
+
+    buf = net_buf_alloc_with_data(&l2cap_lent_pool, store->tx_headroom,
+                                  sizeof(store->tx_headroom) + store->used, K_MSEC(BLE_L2CAP_ALLOC_TIMEOUT_MS));
+    if (buf == NULL) {
+        return -ENOBUFS;
+    }
+    net_buf_pull(buf, headroom);
+    k_sem_reset(&l2cap_returned_sem);
+
+    err = l2cap_send_sdu(buf); //unrefs on error, which returns the store right away
+    if (err == 0) {
+        (*num_sdus)++;
+    }
+    if (k_sem_take(&l2cap_returned_sem, K_MSEC(BLE_L2CAP_LEND_TIMEOUT_MS)) != 0) {
+        LOG_ERR("Stack did not return the lent session %d", session->header.seq);
+        return -ETIMEDOUT;
+    }
+    return err;
+}
+
+
+/*
+Hands the session to the stack in as few SDUs as the app's MTU allows and waits until all of them
+went out. Buffers are freed by the stack as SDUs complete, so allocating the next one is the backpressure.
+*/
+int ble_l2cap_send_session(struct session *session, uint8_t encoding)
+{
+    const uint16_t payload_bytes = ble_payload_size(session, encoding);
+    const uint16_t sdu_size = MIN(BLE_L2CAP_SDU_MAX, g_l2cap_chan.tx.mtu);
+    const uint16_t bytes_per_sdu = ROUND_DOWN(sdu_size - BLE_L2CAP_HEADER_SIZE, sizeof(uint32_t));
+    struct net_buf *buf;
+    uint16_t payload_bytes_sent = 0;
+    uint16_t num_sdus = 0;
+    int err;
+
+    if (sdu_size <= BLE_L2CAP_HEADER_SIZE || bytes_per_sdu == 0) {
+        return -EMSGSIZE;
+    }
+    k_sem_reset(&l2cap_sent_sem);
+
+    buf = l2cap_alloc_sdu(TX_FLAG_START, 0);
+    if (buf != NULL) {
+        ble_fill_start_payload(session, encoding, net_buf_add(buf, START_PAYLOAD_SIZE));
+    }
+    err = l2cap_send_sdu(buf);
+    num_sdus++;
+
+    if (err == 0 && encoding == SESSION_ENCODING_VARINT && payload_bytes > 0 &&
+        BLE_L2CAP_HEADER_SIZE + payload_bytes <= g_l2cap_chan.tx.mtu) {
+        err = l2cap_send_lent(session, &num_sdus);
+        payload_bytes_sent = payload_bytes;
+    }
+    for (uint16_t offset = payload_bytes_sent; err == 0 && offset < payload_bytes; offset += bytes_per_sdu) {
+        const uint16_t len = MIN(bytes_per_sdu, payload_bytes - offset);
+        buf = l2cap_alloc_sdu(TX_FLAG_DATA, offset);
+        if (buf != NULL) {
+            ble_fill_payload(session, encoding, offset, net_buf_add(buf, len), len);
+        }
+        err = l2cap_send_sdu(buf);
+        num_sdus++;
+    }
+
+    if (err == 0) {
+        err = l2cap_send_sdu(l2cap_alloc_sdu(TX_FLAG_END, 0));
+        num_sdus++;
+    }
+    while (err == 0 && num_sdus > 0) {
+        if (k_sem_take(&l2cap_sent_sem, K_MSEC(BLE_L2CAP_SENT_TIMEOUT_MS)) != 0) {
+            err = -ETIMEDOUT;
+        } else if (!g_l2cap_connected) {
+            err = -ENOTCONN;
+        }
+        num_sdus--;
+    }
+    return err;
+}
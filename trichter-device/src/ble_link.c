@@ -0,0 +1,340 @@
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/hci.h>
+
+#include "ble_link.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(ble_link, CONFIG_TRICHTER_BLE_LOG_LEVEL);
+
+
+#define BLE_LINK_SETUP_DELAY_MS         1000 //some centrals reject updates requested right after connecting
+#define BLE_LINK_RETRY_MS               5000 //no matching update by then counts as refused
+#define BLE_LINK_MAX_RETRIES            3 //then wait for the next profile change
+
+// Transfer: 7.5 - 15 ms, no latency
+#define BLE_LINK_TRANSFER_INT_MIN       6
+#define BLE_LINK_TRANSFER_INT_MAX       12
+#define BLE_LINK_TRANSFER_LATENCY       0
+#define BLE_LINK_TRANSFER_TIMEOUT       400 //4 s
+
+// Idle: 30 - 50 ms, the peripheral may skip 4 connection events
+#define BLE_LINK_IDLE_INT_MIN           24
+#define BLE_LINK_IDLE_INT_MAX           40
+#define BLE_LINK_IDLE_LATENCY           4
+#define BLE_LINK_IDLE_TIMEOUT           400 //4 s, > (1 + latency) * interval * 2
+
+
+static const struct bt_le_conn_param g_link_params[BLE_LINK_PROFILE_MAX] = {
+    [BLE_LINK_PROFILE_IDLE] = BT_LE_CONN_PARAM_INIT(BLE_LINK_IDLE_INT_MIN, BLE_LINK_IDLE_INT_MAX,
+                                                    BLE_LINK_IDLE_LATENCY, BLE_LINK_IDLE_TIMEOUT),
+    [BLE_LINK_PROFILE_TRANSFER] = BT_LE_CONN_PARAM_INIT(BLE_LINK_TRANSFER_INT_MIN, BLE_LINK_TRANSFER_INT_MAX,
+                                                        BLE_LINK_TRANSFER_LATENCY, BLE_LINK_TRANSFER_TIMEOUT),
+};
+
+static struct {
+    ble_link_profile_t requested;   // profile of the FSM state
+    bool hold_transfer;             // sender is busy, keep the transfer profile regardless of the state
+    struct ble_link *target;        // link sessions go to, the only one that gets the transfer profile
+} g_link = {
+    .requested = BLE_LINK_PROFILE_IDLE,
+    .hold_transfer = false,
+    .target = NULL,
+};
+
+static struct k_spinlock g_link_lock;
+
+
+static ble_link_profile_t link_wanted_profile(const struct ble_link *link)
+{
+    if (link != g_link.target) {
+        return BLE_LINK_PROFILE_IDLE;
+    }
+    return g_link.hold_transfer ? BLE_LINK_PROFILE_TRANSFER : g_link.requested;
+}
+
+
+/*Profile whose interval range and latency the granted parameters meet*/
+static ble_link_profile_t link_profile_of(uint16_t interval, uint16_t latency)
+{
+    for (int profile = 0; profile < BLE_LINK_PROFILE_MAX; profile++) {
+        const struct bt_le_conn_param *param = &g_link_params[profile];
+
+        if (interval >= param->interval_min && interval <= param->interval_max && latency <= param->latency) {
+            return (ble_link_profile_t)profile;
+        }
+    }
+    return BLE_LINK_PROFILE_MAX;
+}
+
+
+static void link_mtu_exchanged(struct bt_conn *conn, uint8_t err, struct bt_gatt_exchange_params *params)
+{
+    LOG_DBG("MTU exchange %s, MTU %d", err ? "failed" : "done", bt_gatt_get_mtu(conn));
+}
+
+static struct bt_gatt_exchange_params g_mtu_exchange = {
+    .func = link_mtu_exchanged
+};
+
+
+static void link_negotiate(struct bt_conn *conn)
+{
+    int err;
+
+    err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+    if (err) {
+        LOG_WRN("PHY update request failed (%d)", err);
+    }
+    err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+    if (err) {
+        LOG_WRN("Data length update request failed (%d)", err);
+    }
+    err = bt_gatt_exchange_mtu(conn, &g_mtu_exchange);
+    if (err && err != -EALREADY) { //the central usually exchanged the MTU already
+        LOG_DBG("MTU exchange not started (%d)", err);
+    }
+}
+
+
+/*
+Runs on the system workqueue: the connection parameters are only touched from here, so profile
+requests from the FSM thread and the sender cannot race each other. A profile only counts as applied
+once the central granted matching parameters; a request it refuses or ignores is repeated after
+BLE_LINK_RETRY_MS, up to BLE_LINK_MAX_RETRIES times.
+*/
+static void link_update_handler(struct k_work *work)
+{
+    struct ble_link *link = CONTAINER_OF(k_work_delayable_from_work(work), struct ble_link, update_work);
+    struct bt_conn *conn;
+    ble_link_profile_t wanted;
+    ble_link_profile_t applied;
+    bool negotiate;
+
+    k_spinlock_key_t key = k_spin_lock(&g_link_lock);
+    conn = link->conn ? bt_conn_ref(link->conn) : NULL;
+    wanted = link_wanted_profile(link);
+    applied = link->applied;
+    negotiate = !link->negotiated;
+    link->negotiated = true;
+    k_spin_unlock(&g_link_lock, key);
+
+    if (conn == NULL) {
+        return;
+    }
+    if (negotiate) {
+        link_negotiate(conn);
+    }
+    if (wanted != applied) {
+        if (wanted != link->requested) {
+            link->requested = wanted;
+            link->retries = 0;
+        } else if (link->retries < BLE_LINK_MAX_RETRIES) {
+            link->retries++;
+        } else {
+            bt_conn_unref(conn);
+            return; //the central keeps refusing this profile
+        }
+        int err = bt_conn_le_param_update(conn, &g_link_params[wanted]);
+        if (err) {
+            LOG_WRN("Connection parameter update to profile %d failed (%d)", wanted, err);
+        }
+        k_work_reschedule(&link->update_work, K_MSEC(BLE_LINK_RETRY_MS));
+    } else {
+        link->requested = BLE_LINK_PROFILE_MAX; //the next request of any profile gets fresh retries
+    }
+    bt_conn_unref(conn);
+}
+
+
+static void link_request(struct ble_link *link)
+{
+    if (link == NULL) {
+        return;
+    }
+    k_spinlock_key_t key = k_spin_lock(&g_link_lock);
+    const bool negotiated = link->negotiated;
+    k_spin_unlock(&g_link_lock, key);
+    if (negotiated) {
+        k_work_reschedule(&link->update_work, K_NO_WAIT); //a new profile does not wait for a pending retry
+    } else {
+        k_work_schedule(&link->update_work, K_NO_WAIT); //keeps the setup delay
+    }
+}
+
+
+void ble_link_init(struct ble_link *link)
+{
+    link->conn = NULL;
+    k_work_init_delayable(&link->update_work, link_update_handler);
+}
+
+
+/*From the connected callback of the owner. The first link is the transfer target until the sender picks one.*/
+void ble_link_attach(struct ble_link *link, struct bt_conn *conn)
+{
+    struct bt_conn_info conn_info;
+
+    k_spinlock_key_t key = k_spin_lock(&g_link_lock);
+    link->conn = bt_conn_ref(conn);
+    link->applied = BLE_LINK_PROFILE_MAX;
+    link->requested = BLE_LINK_PROFILE_MAX;
+    link->retries = 0;
+    link->negotiated = false;
+    link->info = (struct ble_link_info){
+        .tx_phy = BT_GAP_LE_PHY_1M,
+        .rx_phy = BT_GAP_LE_PHY_1M,
+        .tx_data_len = BT_GAP_DATA_LEN_DEFAULT,
+        .rx_data_len = BT_GAP_DATA_LEN_DEFAULT,
+    };
+    if (bt_conn_get_info(conn, &conn_info) == 0) {
+        link->info.interval = conn_info.le.interval;
+        link->info.latency = conn_info.le.latency;
+        link->info.timeout = conn_info.le.timeout;
+        link->applied = link_profile_of(conn_info.le.interval, conn_info.le.latency);
+    }
+    if (g_link.target == NULL) {
+        g_link.target = link;
+    }
+    k_spin_unlock(&g_link_lock, key);
+
+    k_work_reschedule(&link->update_work, K_MSEC(BLE_LINK_SETUP_DELAY_MS));
+}
+
+
+void ble_link_detach(struct ble_link *link)
+{
+    struct bt_conn *conn;
+
+    k_work_cancel_delayable(&link->update_work);
+    k_spinlock_key_t key = k_spin_lock(&g_link_lock);
+    conn = link->conn;
+    link->conn = NULL;
+    if (g_link.target == link) {
+        g_link.target = NULL;
+        g_link.hold_transfer = false;
+    }
+    k_spin_unlock(&g_link_lock, key);
+    if (conn != NULL) {
+        bt_conn_unref(conn);
+    }
+}
+
+
+/*The sender is about to send to this link: it gets the transfer profile, the previous target relaxes*/
+void ble_link_select(struct ble_link *link)
+{
+    struct ble_link *previous;
+
+    k_spinlock_key_t key = k_spin_lock(&g_link_lock);
+    previous = g_link.target;
+    g_link.target = link;
+    k_spin_unlock(&g_link_lock, key);
+
+    if (previous != link) {
+        link_request(previous);
+        link_request(link);
+    }
+}
+
+
+void ble_link_profile_idle(void)
+{
+    g_link.requested = BLE_LINK_PROFILE_IDLE;
+    link_request(g_link.target);
+}
+
+
+void ble_link_profile_transfer(void)
+{
+    g_link.requested = BLE_LINK_PROFILE_TRANSFER;
+    link_request(g_link.target);
+}
+
+
+void ble_link_hold_transfer(bool hold)
+{
+    if (g_link.hold_transfer != hold) {
+        g_link.hold_transfer = hold;
+        link_request(g_link.target);
+    }
+}
+
+
+void ble_link_get_info(const struct ble_link *link, struct ble_link_info *info)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_link_lock);
+    struct bt_conn *conn = link->conn ? bt_conn_ref(link->conn) : NULL;
+    *info = link->info;
+    info->profile = link->applied;
+    k_spin_unlock(&g_link_lock, key);
+
+    info->mtu = 0;
+    if (conn) {
+        info->mtu = bt_gatt_get_mtu(conn);
+        bt_conn_unref(conn);
+    }
+}
+
+
+// Connection callbacks, the owner attaches and detaches the links itself
+static void link_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+    struct ble_link *link = ble_link_of(conn);
+
+    LOG_INF("Connection parameters: interval %d.%02d ms, latency %d, timeout %d ms",
+            (interval * 125) / 100, (interval * 125) % 100, latency, timeout * 10);
+    if (link == NULL) {
+        return;
+    }
+    k_spinlock_key_t key = k_spin_lock(&g_link_lock);
+    link->info.interval = interval;
+    link->info.latency = latency;
+    link->info.timeout = timeout;
+    link->applied = link_profile_of(interval, latency);
+    const bool mismatch = (link->conn != NULL) && (link->applied != link_wanted_profile(link));
+    k_spin_unlock(&g_link_lock, key);
+
+    if (mismatch) {
+        k_work_schedule(&link->update_work, K_MSEC(BLE_LINK_RETRY_MS)); //not what we asked for, ask again later
+    }
+}
+
+
+static void link_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+    struct ble_link *link = ble_link_of(conn);
+
+    LOG_INF("PHY updated: TX %d, RX %d", param->tx_phy, param->rx_phy);
+    if (link == NULL) {
+        return;
+    }
+    k_spinlock_key_t key = k_spin_lock(&g_link_lock);
+    link->info.tx_phy = param->tx_phy;
+    link->info.rx_phy = param->rx_phy;
+    k_spin_unlock(&g_link_lock, key);
+}
+
+
+static void link_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info)
+{
+    struct ble_link *link = ble_link_of(conn);
+
+    LOG_INF("Data length updated: TX %d bytes, RX %d bytes", info->tx_max_len, info->rx_max_len);
+    if (link == NULL) {
+        return;
+    }
+    k_spinlock_key_t key = k_spin_lock(&g_link_lock);
+    link->info.tx_data_len = info->tx_max_len;
+    link->info.rx_data_len = info->rx_max_len;
+    k_spin_unlock(&g_link_lock, key);
+}
+
+
+BT_CONN_CB_DEFINE(link_callbacks) = {
+    .le_param_updated = link_param_updated,
+    .le_phy_updated = link_phy_updated,
+    .le_data_len_updated = link_data_len_updated,
+};
@@ -1,7 +1,7 @@
 #include <stdint.h>
 #include <zephyr/kernel.h>
 #include <zephyr/kernel_structs.h>
-#include <zephyr/sys/printk.h>
+#include <zephyr/sys/byteorder.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/gatt.h>
@@ -14,15 +14,52 @@
 #include "memory.h"
 #include "bluetooth_common.h"
 #include "bluetooth_advertising.h"
+#include "capture_store.h"
+#include "session.h"
+#include "session_pool.h"
+#include "ble_link.h"
+#include "ble_l2cap.h"
+#include "session_log.h"
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+#include "log_hot.h"
+
+LOG_MODULE_REGISTER(bluetooth, CONFIG_TRICHTER_BLE_LOG_LEVEL);
 
-#define MAX_TIMESTAMPS          300
 #define CHUNK_SIZE              10
 #define MAX_INDICATION_RETRIES  3
 #define INDICATION_TIMEOUT_MS   5000
 #define MAX_SDU_SIZE_BYTE       243 //247 MTU - 4 byte header
-#define COUNT_BYTES(num)        (num * sizeof(uint32_t))
+#define COUNT_BYTES(num)        ((num) * sizeof(uint32_t))
+
+#define BLE_SENDER_STACK_SIZE   1024
+#define BLE_SENDER_PRIO         6
+#define BLE_SENDER_RETRY_MS     1000 //after a failed send, the sender tries again this much later
+
+// Connected centrals
+#define BLE_MAX_PEERS           CONFIG_BT_MAX_CONN
+
+/*
+Per connection state. The first central to connect is the controller: only it may change the
+remote state. Everyone else can subscribe, download sessions and read results.
+*/
+struct ble_peer {
+    struct bt_conn *conn;       // NULL: slot free
+    uint16_t sdu_size;          // payload bytes per packet, from the ATT MTU of this connection
+    uint8_t encoding;           // requested by the app, raw unless it opted in
+    bool pull_selected;         // app selected a session by seq, otherwise the latest is served
+    uint16_t pull_seq;
+    volatile bool live;         // app opted into live streaming
+    bool live_valid;            // every pulse of live_seq up to live_sent reached the stack in order
+    uint16_t live_seq;
+    uint16_t live_sent;
+    struct k_sem credits;       // notifications this connection may still have in flight
+    struct ble_link link;       // PHY, data length and connection interval of this connection
+};
 
-static bool g_is_connected = false;
+static struct ble_peer g_peers[BLE_MAX_PEERS];
+static struct ble_peer *g_controller = NULL;
+static uint8_t g_num_peers = 0;
 
 static uint8_t g_timer_tick_duration = 0;
 
@@ -30,18 +67,58 @@ static uint8_t indication_retry_count = 0;
 static struct bt_gatt_indicate_params last_ind_params;
 
 K_SEM_DEFINE(indication_sem, 0, 1);
+K_SEM_DEFINE(sender_wakeup_sem, 0, 1);
+
+// Windowed transfer
+#define TRANSFER_WINDOW             CONFIG_TRICHTER_BLE_TRANSFER_WINDOW
+#define TRANSFER_ACK_TIMEOUT_MS     3000
+#define TRANSFER_MAX_ROUNDS         5 //END + NACK rounds before the session is requeued
+#define TRANSFER_NACK_QUEUE_DEPTH   8
+#define TRANSFER_ATTR_IDX           12 //value attribute of the transfer characteristic
+
+struct transfer_range {
+    uint16_t first;
+    uint16_t count;
+};
+
+static struct {
+    uint16_t seq;
+    volatile bool acked;
+} g_transfer;
+
+K_SEM_DEFINE(transfer_ctrl_sem, 0, 1);
+K_MSGQ_DEFINE(transfer_nack_queue, sizeof(struct transfer_range), TRANSFER_NACK_QUEUE_DEPTH, 2);
+
+// Transfer benchmark, one log line per session and central (CONFIG_TRICHTER_BLE_TRANSFER_STATS)
+static struct {
+    const char *path;           // GATT indications, windowed notifications, L2CAP or live stream
+    uint16_t retries;           // indications repeated and chunks resent after a NACK
+} g_transfer_stats;
+
+// Live streaming while running
+#define LIVE_QUEUE_DEPTH            4
+#define LIVE_END_PAYLOAD_SIZE       (START_PAYLOAD_SIZE + sizeof(uint32_t))
+
+struct live_batch {
+    uint16_t seq;
+    uint16_t first;             // index of ticks[0] within the session
+    uint8_t count;
+    uint32_t ticks[BLE_LIVE_BATCH_PULSES];
+};
+
+K_MSGQ_DEFINE(live_queue, sizeof(struct live_batch), LIVE_QUEUE_DEPTH, 4);
+
+// Pull based download of completed sessions
+#define PULL_ATT_ERR_SESSION_GONE   0x80 //application error: the slot of the selected session was reused
+#define PULL_INFO_SIZE              8
+
+static uint8_t pull_buffer[MAX_SDU_SIZE_BYTE + 2 * sizeof(uint32_t)];
 
 // Work Queue Stuff
 K_THREAD_STACK_DEFINE(retry_work_stack, 512);
 struct k_work_q retry_work;
 struct k_work work; // For retry
 
-enum transmission_flags {
-    TX_FLAG_START = 0xAA,
-    TX_FLAG_DATA = 0xBB,
-    TX_FLAG_END = 0xCC
-};
-
 static struct nvs_fs fs_ble;
 
 #define NVS_PARTITION_BLE           storage_partition_ble
@@ -66,26 +143,92 @@ struct ble_transmission_packet {
 
 //Datastructure for Characteristic holding the data
 struct bulk_data_service {
-    uint8_t timestamp_bytes[COUNT_BYTES(MAX_TIMESTAMPS)];
+    const struct session *session; // Session to send, absolute ticks are reconstructed per chunk
     uint16_t count;        // Number of valid timestamps
     uint16_t idx_to_send;   // Index of next timestamp to send
     bool transmission_active;
-    struct bt_conn *current_conn;
-    uint16_t sdu_size;
+    struct bt_conn *current_conn;  // Referenced while a session is sent to this connection
+    struct ble_peer *peer;         // Its per connection state
+    uint16_t chunk_size;    // sdu_size of the peer latched for the session being sent
+    uint8_t encoding;       // payload encoding latched for the session being sent
+    uint16_t payload_bytes; // size of the encoded payload
 };
 
 //Actual Characteristic holding the data
 static struct bulk_data_service g_bulk_service = {
+    .session = NULL,
     .count = 0,
     .idx_to_send = 0,
     .transmission_active = false,
     .current_conn = NULL,
-    .sdu_size = 16 //23 = default MTU, minus header size (4byte) yields 19byte --> 16 is next one div by 4
+    .peer = NULL,
+    .chunk_size = 16,
+    .encoding = SESSION_ENCODING_RAW,
+    .payload_bytes = 0
 };
 
 static struct bt_gatt_indicate_params ind_params;
 static uint8_t tx_buffer[sizeof(struct ble_packet_header) + MAX_SDU_SIZE_BYTE];
 
+#define PEER_DEFAULT_SDU_SIZE   16 //23 = default MTU, minus header size (4byte) yields 19byte --> 16 is next one div by 4
+
+static struct k_spinlock g_peers_lock; //conn pointers change in the connection callbacks, the sender takes references
+
+static struct ble_peer *peer_of(const struct bt_conn *conn)
+{
+    for (uint8_t i = 0; conn != NULL && i < BLE_MAX_PEERS; i++) {
+        if (g_peers[i].conn == conn) {
+            return &g_peers[i];
+        }
+    }
+    return NULL;
+}
+
+struct ble_link *ble_link_of(const struct bt_conn *conn)
+{
+    struct ble_peer *peer = peer_of(conn);
+
+    return (peer != NULL) ? &peer->link : NULL;
+}
+
+/*Reference to the connection of a peer, NULL if the slot is free. Release with bt_conn_unref.*/
+static struct bt_conn *peer_ref(const struct ble_peer *peer)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_peers_lock);
+    struct bt_conn *conn = (peer->conn != NULL) ? bt_conn_ref(peer->conn) : NULL;
+    k_spin_unlock(&g_peers_lock, key);
+    return conn;
+}
+
+/*The sender's target is still connected*/
+static bool peer_connected(void)
+{
+    return g_bulk_service.peer != NULL && g_bulk_service.current_conn != NULL &&
+           g_bulk_service.peer->conn == g_bulk_service.current_conn;
+}
+
+/*
+Makes peer the target of the following transfer calls, holding a reference to its connection.
+Sessions are sent to one central after the other, all reading from the same capture store.
+*/
+static bool peer_target_begin(struct ble_peer *peer)
+{
+    g_bulk_service.current_conn = peer_ref(peer);
+    g_bulk_service.peer = peer;
+    return g_bulk_service.current_conn != NULL;
+}
+
+static void peer_target_end(void)
+{
+    struct bt_conn *conn = g_bulk_service.current_conn;
+
+    g_bulk_service.current_conn = NULL;
+    g_bulk_service.peer = NULL;
+    if (conn != NULL) {
+        bt_conn_unref(conn);
+    }
+}
+
 static StateID_t g_remote_state;
 bool g_is_valid_calibration_attempt = false;
 
@@ -93,6 +236,13 @@ static struct bt_uuid_128 custom_service_uuid = BT_UUID_INIT_128(BT_UUID_CUSTOM_
 static struct bt_uuid_128 drinking_char_uuid = BT_UUID_INIT_128(BT_UUID_ARRAY_CHARACTERISTIC_VAL);
 static struct bt_uuid_128 time_constant_char_uuid = BT_UUID_INIT_128(BT_UUID_CALIB_CHAR_VAL);
 static struct bt_uuid_128 remote_state_char_uuid = BT_UUID_INIT_128(BT_UUID_REMOTE_STATE_CHAR_VAL);
+static struct bt_uuid_128 transfer_char_uuid = BT_UUID_INIT_128(BT_UUID_TRANSFER_CHAR_VAL);
+static struct bt_uuid_128 link_info_char_uuid = BT_UUID_INIT_128(BT_UUID_LINK_INFO_CHAR_VAL);
+static struct bt_uuid_128 l2cap_psm_char_uuid = BT_UUID_INIT_128(BT_UUID_L2CAP_PSM_CHAR_VAL);
+static struct bt_uuid_128 session_info_char_uuid = BT_UUID_INIT_128(BT_UUID_SESSION_INFO_CHAR_VAL);
+static struct bt_uuid_128 session_data_char_uuid = BT_UUID_INIT_128(BT_UUID_SESSION_DATA_CHAR_VAL);
+static struct bt_uuid_128 session_log_char_uuid = BT_UUID_INIT_128(BT_UUID_SESSION_LOG_CHAR_VAL);
+static struct bt_uuid_128 flow_result_char_uuid = BT_UUID_INIT_128(BT_UUID_FLOW_RESULT_CHAR_VAL);
 
 static RemoteStateInputHandler g_remote_input_handler = NULL;
 
@@ -103,11 +253,14 @@ static void ccc_cfg_changed(const struct bt_gatt_attr *attr, uint16_t value)
     bool indicate_enabled = (value == BT_GATT_CCC_INDICATE);
     bool notify_enabled = (value == BT_GATT_CCC_NOTIFY);
     
-    printk("CCC Change: Value 0x%04x (Indicate: %d, Notify: %d)\n", value, indicate_enabled, notify_enabled);
+    LOG_DBG("CCC Change: Value 0x%04x (Indicate: %d, Notify: %d)", value, indicate_enabled, notify_enabled);
 
+    if (indicate_enabled) {
+        ble_sender_kick(); //queued sessions can go out now
+    }
     if (!indicate_enabled && !notify_enabled) {
         if (g_bulk_service.transmission_active) {
-            printk("CCC disabled: Stopping transmission and releasing semaphore.\n");
+            LOG_WRN("CCC disabled: Stopping transmission and releasing semaphore.");
             g_bulk_service.transmission_active = false;
             k_sem_give(&indication_sem); 
         }
@@ -130,6 +283,9 @@ static ssize_t write_remote_state(struct bt_conn *conn,
     if (len != sizeof(uint8_t)) {
         return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
     }
+    if (peer_of(conn) != g_controller) {
+        return BT_GATT_ERR(BT_ATT_ERR_WRITE_NOT_PERMITTED); //spectators only watch
+    }
     
     RemoteState state = (RemoteState)(*((const uint8_t *)buf));
     if (g_remote_input_handler) {
@@ -147,16 +303,295 @@ static ssize_t read_remote_state(struct bt_conn *conn,
                              &g_remote_state, sizeof(g_remote_state));
 }
 
+/*
+Subscribing to the transfer characteristic opts the app into the windowed transfer.
+*/
+static void transfer_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value)
+{
+    LOG_DBG("Transfer CCC Change: Value 0x%04x", value);
+    if (value == BT_GATT_CCC_NOTIFY) {
+        ble_sender_kick();
+    } else {
+        k_sem_give(&transfer_ctrl_sem); //wake a waiting transfer, it fails and requeues the session
+    }
+}
+
+static ssize_t write_transfer(struct bt_conn *conn,
+                              const struct bt_gatt_attr *attr,
+                              const void *buf, uint16_t len,
+                              uint16_t offset, uint8_t flags)
+{
+    const uint8_t *data = buf;
+    struct ble_peer *peer = peer_of(conn);
+    const bool transferring = (conn == g_bulk_service.current_conn); //ACK and NACK only count from the target
+
+    if (offset != 0 || len < 1) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+    if (peer == NULL) {
+        return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+    }
+    switch (data[0]) {
+    case TRANSFER_OP_ACK:
+        if (len != 3) {
+            return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+        }
+        if (!transferring) {
+            return len;
+        }
+        if (sys_get_le16(data + 1) == g_transfer.seq) {
+            g_transfer.acked = true;
+        }
+        break;
+    case TRANSFER_OP_NACK: {
+        if (len != 5) {
+            return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+        }
+        struct transfer_range range = {
+            .first = sys_get_le16(data + 1),
+            .count = sys_get_le16(data + 3)
+        };
+        if (!transferring) {
+            return len;
+        }
+        if (k_msgq_put(&transfer_nack_queue, &range, K_NO_WAIT) != 0) {
+            LOG_WRN("NACK queue full, dropping range %d+%d", range.first, range.count); //the next END asks again
+        }
+        break;
+    }
+    case TRANSFER_OP_ENCODING:
+        if (len != 2) {
+            return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+        }
+        if (data[1] >= SESSION_ENCODING_MAX) {
+            return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+        }
+        peer->encoding = data[1];
+        LOG_DBG("App requested encoding %d", data[1]);
+        return len;
+    case TRANSFER_OP_LIVE:
+        if (len != 2) {
+            return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+        }
+        peer->live = (data[1] != 0);
+        LOG_DBG("Live streaming %s", peer->live ? "on" : "off");
+        return len;
+    default:
+        return BT_GATT_ERR(BT_ATT_ERR_NOT_SUPPORTED);
+    }
+    k_sem_give(&transfer_ctrl_sem);
+    return len;
+}
+
+/*
+Negotiated link parameters of the reading connection, little endian: tx phy, rx phy, tx data length,
+rx data length, interval (1.25 ms), latency, supervision timeout (10 ms), ATT MTU, link profile.
+*/
+static ssize_t read_link_info(struct bt_conn *conn,
+                              const struct bt_gatt_attr *attr,
+                              void *buf, uint16_t len, uint16_t offset)
+{
+    struct ble_link_info info;
+    uint8_t value[15];
+    const struct ble_link *link = ble_link_of(conn);
+
+    if (link == NULL) {
+        return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+    }
+    ble_link_get_info(link, &info);
+    value[0] = info.tx_phy;
+    value[1] = info.rx_phy;
+    sys_put_le16(info.tx_data_len, &value[2]);
+    sys_put_le16(info.rx_data_len, &value[4]);
+    sys_put_le16(info.interval, &value[6]);
+    sys_put_le16(info.latency, &value[8]);
+    sys_put_le16(info.timeout, &value[10]);
+    sys_put_le16(info.mtu, &value[12]);
+    value[14] = info.profile;
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, sizeof(value));
+}
+
+static ssize_t read_l2cap_psm(struct bt_conn *conn,
+                              const struct bt_gatt_attr *attr,
+                              void *buf, uint16_t len, uint16_t offset)
+{
+    uint8_t value[sizeof(uint16_t)];
+
+    sys_put_le16(ble_l2cap_psm(), value);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, sizeof(value));
+}
+
+static bool pull_session_seq(const struct ble_peer *peer, uint16_t *seq)
+{
+    if (peer == NULL) {
+        return false;
+    }
+    if (peer->pull_selected) {
+        *seq = peer->pull_seq;
+        return true;
+    }
+    return session_pool_latest_seq(seq);
+}
+
+/*
+Session info: u16 seq, u16 number of ticks, u16 payload bytes, u8 encoding, u8 available.
+Describes the selected session, or the latest completed one until the app writes a u16 seq.
+*/
+static ssize_t read_session_info(struct bt_conn *conn,
+                                 const struct bt_gatt_attr *attr,
+                                 void *buf, uint16_t len, uint16_t offset)
+{
+    uint8_t value[PULL_INFO_SIZE] = {0};
+    const struct ble_peer *peer = peer_of(conn);
+    const struct session *session = NULL;
+    uint16_t seq;
+
+    if (pull_session_seq(peer, &seq)) {
+        session = session_pool_pin(seq);
+        sys_put_le16(seq, &value[0]);
+    }
+    if (session != NULL) {
+        sys_put_le16(capture_store_count(&session->store), &value[2]);
+        sys_put_le16(ble_payload_size(session, peer->encoding), &value[4]);
+        value[6] = peer->encoding;
+        value[7] = 1;
+        session_pool_unpin(session);
+    }
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, sizeof(value));
+}
+
+static ssize_t write_session_info(struct bt_conn *conn,
+                                  const struct bt_gatt_attr *attr,
+                                  const void *buf, uint16_t len,
+                                  uint16_t offset, uint8_t flags)
+{
+    struct ble_peer *peer = peer_of(conn);
+
+    if (offset != 0 || len != sizeof(uint16_t)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+    if (peer == NULL) {
+        return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+    }
+    peer->pull_seq = sys_get_le16(buf);
+    peer->pull_selected = true;
+    return len;
+}
+
+/*
+Any byte range of the selected session payload, using the offset of (long) reads. The slot is pinned
+only while one read is served, so the app can fetch ranges in any order, even after reconnecting.
+*/
+static ssize_t read_session_data(struct bt_conn *conn,
+                                 const struct bt_gatt_attr *attr,
+                                 void *buf, uint16_t len, uint16_t offset)
+{
+    const struct ble_peer *peer = peer_of(conn);
+    const struct session *session = NULL;
+    uint16_t seq;
+
+    if (pull_session_seq(peer, &seq)) {
+        session = session_pool_pin(seq);
+    }
+    if (session == NULL) {
+        return BT_GATT_ERR(PULL_ATT_ERR_SESSION_GONE);
+    }
+
+    const uint8_t encoding = peer->encoding;
+    const uint16_t size = ble_payload_size(session, encoding);
+    ssize_t ret;
+
+    if (offset > size) {
+        ret = BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    } else {
+        const uint16_t num = MIN(MIN(len, MAX_SDU_SIZE_BYTE), size - offset);
+
+        if (encoding == SESSION_ENCODING_RAW) {
+            //raw payloads are built from whole timestamps, so start at the enclosing one
+            const uint16_t start = ROUND_DOWN(offset, sizeof(uint32_t));
+            const uint16_t skip = offset - start;
+
+            ble_fill_payload(session, encoding, start, pull_buffer, ROUND_UP(num + skip, sizeof(uint32_t)));
+            memcpy(buf, pull_buffer + skip, num);
+        } else {
+            ble_fill_payload(session, encoding, offset, buf, num); //straight from the store into the response
+        }
+        ret = num;
+    }
+    session_pool_unpin(session);
+    return ret;
+}
+
+/*
+Flash session log: u16 pending sessions, u16 oldest pending seq, u16 newest seq, u16 sessions lost
+because the log was full. Writing {0x01, u16 seq} acknowledges every session up to seq.
+Pending sessions are sent automatically once the app is subscribed.
+*/
+#define SESSION_LOG_OP_ACK  0x01
+
+static ssize_t read_session_log(struct bt_conn *conn,
+                                const struct bt_gatt_attr *attr,
+                                void *buf, uint16_t len, uint16_t offset)
+{
+    struct session_log_info info;
+    uint8_t value[8];
+
+    session_log_get_info(&info);
+    sys_put_le16(info.pending, &value[0]);
+    sys_put_le16(info.first_pending_seq, &value[2]);
+    sys_put_le16(info.last_seq, &value[4]);
+    sys_put_le16(info.dropped, &value[6]);
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, sizeof(value));
+}
+
+static ssize_t write_session_log(struct bt_conn *conn,
+                                 const struct bt_gatt_attr *attr,
+                                 const void *buf, uint16_t len,
+                                 uint16_t offset, uint8_t flags)
+{
+    const uint8_t *data = buf;
+
+    if (offset != 0 || len != 3) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+    if (data[0] != SESSION_LOG_OP_ACK) {
+        return BT_GATT_ERR(BT_ATT_ERR_NOT_SUPPORTED);
+    }
+    if (peer_of(conn) != g_controller) {
+        return BT_GATT_ERR(BT_ATT_ERR_WRITE_NOT_PERMITTED); //an ACK drops the session from flash for everyone
+    }
+    session_log_ack(sys_get_le16(data + 1));
+    return len;
+}
+
+/*
+Flow result of the newest run, computed on the device while capturing: u16 seq, u16 pulses,
+u16 volume mL, u32 duration ms, u16 average mL/s, u16 peak mL/s, u8 lane, u8 race place. Notified
+as soon as the run ends, before the session itself is transferred, once per lane in a race with the
+winner last. All zero until the first run.
+*/
+#define FLOW_RESULT_SIZE        16
+#define FLOW_RESULT_ATTR_IDX    25
+
+static uint8_t g_flow_result[FLOW_RESULT_SIZE];
+
+static ssize_t read_flow_result(struct bt_conn *conn,
+                                const struct bt_gatt_attr *attr,
+                                void *buf, uint16_t len, uint16_t offset)
+{
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, g_flow_result, sizeof(g_flow_result));
+}
+
 static void indication_retry_handler(struct k_work *work)
 {
-    printk("Retrying :(\n");
-    if (!g_is_connected || !g_bulk_service.current_conn) {
-        printk("Retry aborted: Disconnected\n");
+    LOG_WRN("Retrying :(");
+    if (!peer_connected()) {
+        LOG_WRN("Retry aborted: Disconnected");
         return;
     }
     int err = bt_gatt_indicate(g_bulk_service.current_conn, &last_ind_params);
     if (err) {
-        printk("Retry failed to start: %d\n", err);
+        LOG_WRN("Retry failed to start: %d", err);
     }
 }
 
@@ -170,8 +605,12 @@ static ssize_t read_custom(struct bt_conn *conn,
 
 void mtu_updated(struct bt_conn *conn, uint16_t tx, uint16_t rx)
 {
-    printk("Updated MTU: TX: %d RX: %d bytes\n", tx, rx);
-    g_bulk_service.sdu_size = MIN(tx, rx) - sizeof(struct ble_packet_header) - 3;
+    LOG_DBG("Updated MTU: TX: %d RX: %d bytes", tx, rx);
+    struct ble_peer *peer = peer_of(conn);
+    uint16_t sdu_size = MIN(MIN(tx, rx) - sizeof(struct ble_packet_header) - 3, MAX_SDU_SIZE_BYTE);
+    if (peer != NULL) {
+        peer->sdu_size = sdu_size & ~(sizeof(uint32_t) - 1); //chunks must only contain whole timestamps
+    }
 }
 
 static struct bt_gatt_cb gatt_callbacks = {
@@ -220,7 +659,52 @@ BT_GATT_SERVICE_DEFINE(custom_svc,
                            read_remote_state, write_remote_state, &g_remote_state),
                            
     // FIX: Hier ccc_cfg_changed
-    BT_GATT_CCC(ccc_cfg_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE)          /*Index 10*/
+    BT_GATT_CCC(ccc_cfg_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),         /*Index 10*/
+
+    /* Windowed transfer: session packets as notifications, ACK/NACK written back by the app */
+    BT_GATT_CHARACTERISTIC(&transfer_char_uuid.uuid,                              /*Index 11-12 (12 is the value)*/
+                           BT_GATT_CHRC_WRITE | BT_GATT_CHRC_WRITE_WITHOUT_RESP | BT_GATT_CHRC_NOTIFY,
+                           BT_GATT_PERM_WRITE,
+                           NULL, write_transfer, NULL),
+
+    BT_GATT_CCC(transfer_ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),    /*Index 13*/
+
+    /* Negotiated PHY, data length and connection parameters */
+    BT_GATT_CHARACTERISTIC(&link_info_char_uuid.uuid,                             /*Index 14-15 (15 is the value)*/
+                           BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ,
+                           read_link_info, NULL, NULL),
+
+    /* PSM of the L2CAP channel for bulk session download */
+    BT_GATT_CHARACTERISTIC(&l2cap_psm_char_uuid.uuid,                             /*Index 16-17 (17 is the value)*/
+                           BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ,
+                           read_l2cap_psm, NULL, NULL),
+
+    /* Pull based download: session info, then any byte range of its payload */
+    BT_GATT_CHARACTERISTIC(&session_info_char_uuid.uuid,                          /*Index 18-19 (19 is the value)*/
+                           BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+                           read_session_info, write_session_info, NULL),
+
+    BT_GATT_CHARACTERISTIC(&session_data_char_uuid.uuid,                          /*Index 20-21 (21 is the value)*/
+                           BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ,
+                           read_session_data, NULL, NULL),
+
+    /* Flash session log of runs recorded while no app was connected */
+    BT_GATT_CHARACTERISTIC(&session_log_char_uuid.uuid,                           /*Index 22-23 (23 is the value)*/
+                           BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+                           BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+                           read_session_log, write_session_log, NULL),
+
+    /* Flow analytics of the newest run */
+    BT_GATT_CHARACTERISTIC(&flow_result_char_uuid.uuid,                           /*Index 24-25 (25 is the value)*/
+                           BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+                           BT_GATT_PERM_READ,
+                           read_flow_result, NULL, NULL),
+
+    BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE)                     /*Index 26*/
 );
 
 
@@ -228,11 +712,11 @@ void ble_state_notifier(StateID_t state)
 {
     g_remote_state = state;
 
-    if (!g_is_connected || !g_bulk_service.current_conn) {
+    if (g_num_peers == 0) {
         return;
     }
     int combined_state = g_remote_state | (g_is_valid_calibration_attempt ? 0x80 : 0x0);
-    bt_gatt_notify(g_bulk_service.current_conn,
+    bt_gatt_notify(NULL, //every subscribed central
                    &custom_svc.attrs[9],
                    &combined_state,
                    sizeof(combined_state));
@@ -243,48 +727,125 @@ void ble_calibration_attempt_notifier(bool success)
     g_is_valid_calibration_attempt = success;
 }
 
+/*
+While centrals are connected: connectable advertising as long as a slot is free, so more phones can
+join, otherwise only the non-connectable result broadcast.
+*/
+static void ble_advertise_connected(void)
+{
+    if (g_num_peers < BLE_MAX_PEERS) {
+        bluetooth_advertising_start_fast();
+    } else {
+        bluetooth_advertising_start_broadcast();
+    }
+}
+
+void ble_flow_result_notifier(const struct session_header *header, const struct flow_summary *summary)
+{
+    const uint16_t seq = header->seq;
+
+    sys_put_le16(seq, &g_flow_result[0]);
+    sys_put_le16(summary->pulses, &g_flow_result[2]);
+    sys_put_le16(summary->volume_ml, &g_flow_result[4]);
+    sys_put_le32(summary->duration_ms, &g_flow_result[6]);
+    sys_put_le16(summary->avg_ml_per_s, &g_flow_result[10]);
+    sys_put_le16(summary->peak_ml_per_s, &g_flow_result[12]);
+    g_flow_result[14] = header->lane;
+    g_flow_result[15] = header->place;
+    bluetooth_advertising_set_result(seq, summary);
+    if (g_num_peers > 0) {
+        ble_advertise_connected(); //advertising was stopped for the run
+        bt_gatt_notify(NULL, &custom_svc.attrs[FLOW_RESULT_ATTR_IDX], g_flow_result, sizeof(g_flow_result));
+    }
+}
+
 // Connection callbacks
 static void connected(struct bt_conn *conn, uint8_t err)
 {
     if (err) {
-        printk("Connection failed (err 0x%02x)\n", err);
+        LOG_ERR("Connection failed (err 0x%02x)", err);
         return;
     }
     
-    printk("Connected\n");
-    if (g_is_connected) {
+    struct ble_peer *peer = NULL;
+    for (uint8_t i = 0; peer == NULL && i < BLE_MAX_PEERS; i++) {
+        if (g_peers[i].conn == NULL) {
+            peer = &g_peers[i];
+        }
+    }
+    if (peer == NULL) {
+        LOG_WRN("No free peer slot");
         bt_conn_disconnect(conn, BT_HCI_ERR_CONN_LIMIT_EXCEEDED);
         return;
     }
-    g_is_connected = true;
-    g_bulk_service.current_conn = bt_conn_ref(conn);
-    bluetooth_advertising_stop();
+
+    peer->sdu_size = PEER_DEFAULT_SDU_SIZE;
+    peer->encoding = SESSION_ENCODING_RAW;
+    peer->pull_selected = false;
+    peer->live = false;
+    peer->live_valid = false;
+    k_sem_init(&peer->credits, TRANSFER_WINDOW, TRANSFER_WINDOW); //credits of a dropped link never come back
+    k_spinlock_key_t key = k_spin_lock(&g_peers_lock);
+    peer->conn = bt_conn_ref(conn);
+    g_num_peers++;
+    k_spin_unlock(&g_peers_lock, key);
+    ble_link_attach(&peer->link, conn);
+    if (g_controller == NULL) {
+        g_controller = peer;
+    }
+    LOG_INF("Connected, %d of %d centrals%s", g_num_peers, BLE_MAX_PEERS, (g_controller == peer) ? ", controller" : "");
+
+    bluetooth_advertising_stop(); //the stack ended the connectable set
+    ble_advertise_connected();
+    ble_sender_kick();
 }
 
 void ble_delete_active_connection()
 {
-    if (g_bulk_service.current_conn && g_is_connected) {
-        bt_conn_disconnect(g_bulk_service.current_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    for (uint8_t i = 0; i < BLE_MAX_PEERS; i++) {
+        struct bt_conn *conn = peer_ref(&g_peers[i]);
+        if (conn != NULL) {
+            bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+            bt_conn_unref(conn);
+        }
     }
 }
 
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
-    printk("Disconnected (reason 0x%02x)\n", reason);
-    g_is_connected = false;
-    g_bulk_service.transmission_active = false;
-    k_sem_give(&indication_sem);
+    struct ble_peer *peer = peer_of(conn);
 
-    if (g_bulk_service.current_conn) {
-        bt_conn_unref(g_bulk_service.current_conn);
-        g_bulk_service.current_conn = NULL;
+    LOG_INF("Disconnected (reason 0x%02x)", reason);
+    if (peer == NULL) {
+        return;
+    }
+    ble_link_detach(&peer->link);
+    k_spinlock_key_t key = k_spin_lock(&g_peers_lock);
+    peer->conn = NULL;
+    g_num_peers--;
+    k_spin_unlock(&g_peers_lock, key);
+    bt_conn_unref(conn);
+
+    if (conn == g_bulk_service.current_conn) {
+        g_bulk_service.transmission_active = false;
+        k_sem_give(&indication_sem);
+        k_sem_give(&transfer_ctrl_sem);
+        k_sem_give(&peer->credits);
+    }
+    if (g_controller == peer) {
+        g_controller = NULL;
+        for (uint8_t i = 0; g_controller == NULL && i < BLE_MAX_PEERS; i++) {
+            if (g_peers[i].conn != NULL) {
+                g_controller = &g_peers[i]; //the next central takes over
+            }
+        }
     }
 }
 
 static void recycled()
 {
-    printk("Recycled callback\n");
+    LOG_DBG("Recycled callback");
     bluetooth_advertising_start_fast();
 }
 
@@ -301,6 +862,9 @@ int init_ble(uint8_t timer_tick_duration)
     k_work_queue_init(&retry_work);
     k_work_queue_start(&retry_work, retry_work_stack, K_THREAD_STACK_SIZEOF(retry_work_stack), 4, NULL);
     k_work_init(&work, indication_retry_handler);
+    for (uint8_t i = 0; i < BLE_MAX_PEERS; i++) {
+        ble_link_init(&g_peers[i].link);
+    }
 
     err = initialize_and_mount_fs(&fs_ble, NVS_PARTITION_DEVICE_BLE, NVS_PARTITION_OFFSET_BLE, NVS_PARTITION_SIZE_BLE);
     if (err)
@@ -313,6 +877,9 @@ int init_ble(uint8_t timer_tick_duration)
         settings_load();
     }
     bt_gatt_cb_register(&gatt_callbacks);
+    if (err == 0) {
+        ble_l2cap_init(); //without it, sessions still go out over GATT
+    }
 
     g_timer_tick_duration = timer_tick_duration;
 
@@ -321,7 +888,7 @@ int init_ble(uint8_t timer_tick_duration)
 
 bool is_ble_connected()
 {
-    return g_is_connected;
+    return g_num_peers > 0;
 };
 
 
@@ -334,56 +901,148 @@ static void indicate_cb(struct bt_conn *conn,
                         uint8_t err)
 {
     if (err != 0U && indication_retry_count < MAX_INDICATION_RETRIES) {
-        printk("Indication failed, retry %d/3\n", indication_retry_count + 1);
+        LOG_WRN("Indication failed, retry %d/3", indication_retry_count + 1);
         indication_retry_count++;
+        g_transfer_stats.retries++;
         
         memcpy(&last_ind_params, params, sizeof(struct bt_gatt_indicate_params));
         k_work_submit_to_queue(&retry_work, &work);
     } else {
         if (err == 0U) {
-            // printk("Indication success\n"); // Zu viel Spam
+            LOG_HOT_DBG("Indication success");
             indication_retry_count = 0;
             // Signal success to allow next packet
             k_sem_give(&indication_sem);
         } else {
-            printk("Indication failed after %d retries\n", MAX_INDICATION_RETRIES);
+            LOG_ERR("Indication failed after %d retries", MAX_INDICATION_RETRIES);
             // Auch bei Fehler Semaphore geben, damit es nicht hängt!
             k_sem_give(&indication_sem);
         }
     }
 }
 
-int ble_send_start()
+/*
+Start payload: count, calibration, then session header fields and the payload encoding. Older apps
+ignore the trailing fields. Shared by the GATT and the L2CAP transfer.
+*/
+uint16_t ble_fill_start_payload(const struct session *session, uint8_t encoding, uint8_t *payload)
 {
-    if (g_bulk_service.transmission_active != 1)
+    static uint16_t ram_copy_counter = 0;
+    read_counter_from_rom(&ram_copy_counter);
+
+    sys_put_le16(capture_store_count(&session->store), payload);
+    sys_put_le16(ram_copy_counter, payload + 2);
+    sys_put_le16(session->header.missed_pulses, payload + 4);
+    sys_put_le16(session->header.end_of_run_ms, payload + 6);
+    sys_put_le16(session->header.seq, payload + 8);
+    sys_put_le16(ble_payload_size(session, encoding), payload + 10);
+    payload[12] = encoding;
+    payload[13] = (uint8_t)((session->header.place << 4) | (session->header.lane & 0x0F));
+    payload[14] = session->header.flags;
+    return START_PAYLOAD_SIZE;
+}
+
+
+uint16_t ble_payload_size(const struct session *session, uint8_t encoding)
+{
+    if (encoding == SESSION_ENCODING_VARINT)
     {
-        return 1;
+        return capture_store_encoded_size(&session->store);
     }
+    return COUNT_BYTES(capture_store_count(&session->store));
+}
+
+
+/*
+Copies len bytes of the session payload, starting at byte offset, into buf. Raw payloads are only
+split at whole timestamps, so offset and len must be multiples of 4 there.
+*/
+uint16_t ble_fill_payload(const struct session *session, uint8_t encoding, uint16_t offset, uint8_t *buf, uint16_t len)
+{
+    struct capture_store_iter it;
+    uint32_t tick;
+    uint16_t num = 0;
+
+    if (encoding == SESSION_ENCODING_VARINT)
+    {
+        return capture_store_encoded_read(&session->store, offset, buf, len);
+    }
+    capture_store_iter_init(&it, &session->store, offset / sizeof(uint32_t));
+    while (num + sizeof(uint32_t) <= len && capture_store_iter_next(&it, &tick))
+    {
+        sys_put_le32(tick, buf + num);
+        num += sizeof(uint32_t);
+    }
+    return num;
+}
+
+
+/*
+Packet builders, shared by the indication and the windowed notification transfer.
+Each returns the packet length in tx_buffer.
+*/
+static uint16_t ble_fill_start(uint8_t *buf)
+{
     struct ble_packet_header header = {
         .flag = TX_FLAG_START,
         .chunk_index = 0,
-        .data_size_bytes = g_bulk_service.sdu_size
+        .data_size_bytes = g_bulk_service.chunk_size
     };
 
-    int err;
-    static uint16_t ram_copy_counter = 0;
-    err = read_counter_from_rom(&ram_copy_counter);
+    memcpy(buf, &header, sizeof(header));
+    return sizeof(header) + ble_fill_start_payload(g_bulk_service.session, g_bulk_service.encoding, buf + sizeof(header));
+}
 
-    memcpy(tx_buffer, &header, sizeof(header));
-    memcpy(tx_buffer + sizeof(header), &g_bulk_service.count, sizeof(g_bulk_service.count));
-    memcpy(tx_buffer + sizeof(header) + sizeof(g_bulk_service.count), &ram_copy_counter, sizeof(ram_copy_counter));
+static uint16_t ble_fill_data(uint8_t *buf, uint16_t chunk_index)
+{
+    const uint32_t byte_idx = (uint32_t)chunk_index * g_bulk_service.chunk_size;
+    struct ble_packet_header header;
+
+    if (byte_idx >= g_bulk_service.payload_bytes)
+    {
+        return 0;
+    }
+    header.flag = TX_FLAG_DATA;
+    header.chunk_index = chunk_index;
+    header.data_size_bytes = MIN(g_bulk_service.chunk_size, g_bulk_service.payload_bytes - byte_idx);
+    LOG_HOT_DBG("sending index %d", header.chunk_index);
+
+    memcpy(buf, &header, sizeof(header));
+    ble_fill_payload(g_bulk_service.session, g_bulk_service.encoding, byte_idx, buf + sizeof(header), header.data_size_bytes);
+    return sizeof(header) + header.data_size_bytes;
+}
+
+static uint16_t ble_fill_end(uint8_t *buf)
+{
+    struct ble_packet_header header = {
+        .flag = TX_FLAG_END,
+        .chunk_index = 0,
+        .data_size_bytes = 0
+    };
+    memcpy(buf, &header, sizeof(header));
+    return sizeof(header);
+}
+
+
+int ble_send_start()
+{
+    if (g_bulk_service.transmission_active != 1)
+    {
+        return 1;
+    }
+    int err;
 
     ind_params.attr = &custom_svc.attrs[2]; // Prüfen ob Index stimmt (Drinking Char)
     ind_params.func = indicate_cb;
     ind_params.data = tx_buffer;
-    ind_params.len = sizeof(header) + sizeof(g_bulk_service.count) + sizeof(ram_copy_counter);
+    ind_params.len = ble_fill_start(tx_buffer);
 
     k_sem_reset(&indication_sem);
 
-    if (g_bulk_service.current_conn) {
+    if (peer_connected()) {
         err = bt_gatt_indicate(g_bulk_service.current_conn, &ind_params);
         if (err) {
-            printk("Failed to indicate in send start: %d\n", err);
+            LOG_ERR("Failed to indicate in send start: %d", err);
         }
         return err;
     }
@@ -396,28 +1055,27 @@ bool ble_is_sending()
 }
 
 
-int ble_prepare_send(uint32_t *data_buffer, const uint32_t num_elements)
+int ble_prepare_send(const struct session *session)
 {
-    if (data_buffer == NULL)
+    if (session == NULL)
     {
         return 1;
-    } else if (num_elements == 0 || num_elements > MAX_TIMESTAMPS)
+    } else if (capture_store_count(&session->store) == 0)
     {
         return 1;
     };
-    
-    const uint8_t *bytes = (const uint8_t *)data_buffer;
-    memcpy(g_bulk_service.timestamp_bytes, bytes, COUNT_BYTES(num_elements));
-    
-    /* Debug Print sparsamer machen oder entfernen
-    printk("Sending Data:\n");
-    for (int i = 0; i < COUNT_BYTES(num_elements); i++) {
-        printk("%02X-", bytes[i]);
-    }
-    printk("\n");
-    */
 
-    g_bulk_service.count = num_elements;
+    g_bulk_service.session = session;
+    g_bulk_service.count = capture_store_count(&session->store);
+    if (!peer_connected())
+    {
+        return -ENOTCONN;
+    }
+    g_bulk_service.chunk_size = g_bulk_service.peer->sdu_size; //an MTU update must not reshuffle chunks mid session
+    g_bulk_service.encoding = g_bulk_service.peer->encoding;
+    g_bulk_service.payload_bytes = ble_payload_size(session, g_bulk_service.encoding);
+    LOG_DBG("Session %d: %d ticks, %d payload bytes in encoding %d", session->header.seq,
+            g_bulk_service.count, g_bulk_service.payload_bytes, g_bulk_service.encoding);
     g_bulk_service.transmission_active = true;
     g_bulk_service.idx_to_send = 0;
     return 0;
@@ -425,52 +1083,33 @@ int ble_prepare_send(uint32_t *data_buffer, const uint32_t num_elements)
 
 int ble_send_chunk()
 {
-    // printk("Sending chunk\n"); // Kann Performance kosten
 
     // 1. Warten
     if (k_sem_take(&indication_sem, K_MSEC(INDICATION_TIMEOUT_MS)) != 0) {
-        printk("Previous indication timeout\n");
+        LOG_WRN("Previous indication timeout");
         return -ETIMEDOUT;
     }
     
     // 2. FIX: Prüfen ob wir überhaupt noch verbunden sind (nach dem Warten)
-    if (!g_is_connected || !g_bulk_service.current_conn) {
-        printk("Aborting send: Disconnected\n");
+    if (!peer_connected()) {
+        LOG_WRN("Aborting send: Disconnected");
         return -ENOTCONN;
     }
 
     // 3. FIX: Prüfen ob Übertragung noch aktiv (z.B. durch CCC deaktiviert)
     if (g_bulk_service.transmission_active != true) {
-        printk("Aborting send: Stopped by User\n");
+        LOG_WRN("Aborting send: Stopped by User");
         return -ECANCELED;
     }
 
     int err;
-    struct ble_packet_header header;
-    const uint16_t next_byte_idx = g_bulk_service.idx_to_send;
     uint16_t tx_length = 0;
 
-    if (next_byte_idx < COUNT_BYTES(g_bulk_service.count))
+    if (g_bulk_service.idx_to_send < g_bulk_service.payload_bytes)
     {
-        header.flag = TX_FLAG_DATA;
-        header.chunk_index = next_byte_idx / g_bulk_service.sdu_size; 
-        header.data_size_bytes = MIN(g_bulk_service.sdu_size, (COUNT_BYTES(g_bulk_service.count) - g_bulk_service.idx_to_send));
-        
-        // printk("sending index %d\n", header.chunk_index); 
-        tx_length = sizeof(header) + header.data_size_bytes;
-
-        if (header.data_size_bytes <= (sizeof(tx_buffer)/sizeof(tx_buffer[0])))
-        {
-            memcpy(tx_buffer, &header, sizeof(header));
-            memcpy(tx_buffer + sizeof(header), &g_bulk_service.timestamp_bytes[next_byte_idx], header.data_size_bytes);
-        }
-
+        tx_length = ble_fill_data(tx_buffer, g_bulk_service.idx_to_send / g_bulk_service.chunk_size);
     } else {
-        header.flag = TX_FLAG_END;
-        header.chunk_index = 0;
-        header.data_size_bytes = 0;
-        tx_length = sizeof(header);
-        memcpy(tx_buffer, &header, sizeof(header));
+        tx_length = ble_fill_end(tx_buffer);
         g_bulk_service.transmission_active = false; // Ende erreicht
     }
     
@@ -482,12 +1121,544 @@ int ble_send_chunk()
     err = bt_gatt_indicate(g_bulk_service.current_conn, &ind_params);
     if (err)
     {
-        printk("Failed to indicate in send_chunk: %d\n", err);
+        LOG_ERR("Failed to indicate in send_chunk: %d", err);
         // Semaphor wieder freigeben, da kein Callback kommen wird!
         k_sem_give(&indication_sem);
         return err;
     }
-    g_bulk_service.idx_to_send += g_bulk_service.sdu_size;
+    g_bulk_service.idx_to_send += g_bulk_service.chunk_size;
 
     return err;
 }
+
+
+// =========================================================================
+//  WINDOWED TRANSFER (notifications, app ACK/NACK)
+// =========================================================================
+
+static void transfer_sent_cb(struct bt_conn *conn, void *user_data)
+{
+    struct ble_peer *peer = peer_of(conn);
+    if (peer != NULL) {
+        k_sem_give(&peer->credits);
+    }
+}
+
+/*
+Waits for a free slot in the in-flight window, then queues one notification.
+The stack copies the data, so tx_buffer may be reused right away.
+*/
+static int ble_transfer_notify(uint16_t len)
+{
+    struct bt_gatt_notify_params params = {
+        .attr = &custom_svc.attrs[TRANSFER_ATTR_IDX],
+        .data = tx_buffer,
+        .len = len,
+        .func = transfer_sent_cb,
+    };
+
+    if (!peer_connected()) {
+        return -ENOTCONN;
+    }
+    struct k_sem *credits = &g_bulk_service.peer->credits;
+    if (k_sem_take(credits, K_MSEC(INDICATION_TIMEOUT_MS)) != 0) {
+        return -ETIMEDOUT;
+    }
+    if (!peer_connected()) {
+        return -ENOTCONN;
+    }
+    int err = bt_gatt_notify_cb(g_bulk_service.current_conn, &params);
+    if (err) {
+        k_sem_give(credits); //no callback for a packet that was never queued
+    }
+    return err;
+}
+
+static int ble_transfer_chunks(uint32_t first, uint32_t count, uint16_t num_chunks)
+{
+    int err = 0;
+    for (uint32_t chunk = first; err == 0 && chunk < first + count && chunk < num_chunks; chunk++) {
+        err = ble_transfer_notify(ble_fill_data(tx_buffer, (uint16_t)chunk));
+    }
+    return err;
+}
+
+/*
+START, all chunks and END go out back to back, limited only by the window. The app then answers with
+an ACK for the session or NACKs chunk ranges; only those are resent, followed by another END.
+*/
+static int ble_transfer_session(const struct session *session)
+{
+    int err = ble_prepare_send(session);
+    if (err != 0) {
+        return err;
+    }
+    const uint16_t num_chunks = DIV_ROUND_UP(g_bulk_service.payload_bytes, g_bulk_service.chunk_size);
+
+    g_transfer.seq = session->header.seq;
+    g_transfer.acked = false;
+    k_msgq_purge(&transfer_nack_queue);
+    k_sem_reset(&transfer_ctrl_sem);
+
+    err = ble_transfer_notify(ble_fill_start(tx_buffer));
+    if (err == 0) {
+        err = ble_transfer_chunks(0, num_chunks, num_chunks);
+    }
+    for (uint8_t round = 0; err == 0 && round < TRANSFER_MAX_ROUNDS; round++) {
+        struct transfer_range range;
+
+        err = ble_transfer_notify(ble_fill_end(tx_buffer));
+        if (err != 0) {
+            break;
+        }
+        if (k_sem_take(&transfer_ctrl_sem, K_MSEC(TRANSFER_ACK_TIMEOUT_MS)) != 0) {
+            err = -ETIMEDOUT;
+            break;
+        }
+        if (g_transfer.acked) {
+            break;
+        }
+        while (err == 0 && k_msgq_get(&transfer_nack_queue, &range, K_NO_WAIT) == 0) {
+            LOG_DBG("Resending chunks %d..%d", range.first, range.first + range.count - 1);
+            g_transfer_stats.retries += range.count;
+            err = ble_transfer_chunks(range.first, range.count, num_chunks);
+        }
+    }
+    if (err == 0 && !g_transfer.acked) {
+        err = -EIO;
+    }
+    g_bulk_service.transmission_active = false;
+    return err;
+}
+
+
+// =========================================================================
+//  LIVE STREAMING (notifications while running)
+// =========================================================================
+
+/*
+Pulses go out on the transfer characteristic as soon as they are captured. Once the run is over, only
+the pulses not streamed yet follow, then a LIVE_END packet with the START payload and a crc32 over
+all ticks as raw u32 LE; the app ACKs it like a windowed transfer. Any gap in the stream (queue full,
+sender busy with an older session, new connection) falls back to the complete windowed transfer.
+*/
+static bool peer_live_capable(const struct ble_peer *peer, struct bt_conn *conn)
+{
+    return conn != NULL && peer->live && peer->sdu_size >= LIVE_END_PAYLOAD_SIZE &&
+           bt_gatt_is_subscribed(conn, &custom_svc.attrs[TRANSFER_ATTR_IDX], BT_GATT_CCC_NOTIFY);
+}
+
+/*At least one central wants the live stream*/
+bool ble_live_active()
+{
+    bool active = false;
+
+    for (uint8_t i = 0; !active && i < BLE_MAX_PEERS; i++) {
+        struct bt_conn *conn = peer_ref(&g_peers[i]);
+        if (conn != NULL) {
+            active = peer_live_capable(&g_peers[i], conn);
+            bt_conn_unref(conn);
+        }
+    }
+    return active;
+}
+
+/*Called from the capture path, never blocks. False if the batch did not fit, retry it later.*/
+bool ble_live_submit(uint16_t seq, uint16_t first, const uint32_t *ticks, uint8_t count)
+{
+    struct live_batch batch = {
+        .seq = seq,
+        .first = first,
+        .count = MIN(count, BLE_LIVE_BATCH_PULSES)
+    };
+
+    memcpy(batch.ticks, ticks, COUNT_BYTES(batch.count));
+    if (k_msgq_put(&live_queue, &batch, K_NO_WAIT) != 0) {
+        return false;
+    }
+    ble_sender_kick();
+    return true;
+}
+
+static uint16_t ble_fill_live(uint8_t *buf, uint16_t first, const uint32_t *ticks, uint8_t count)
+{
+    struct ble_packet_header header = {
+        .flag = TX_FLAG_LIVE,
+        .chunk_index = first,
+        .data_size_bytes = COUNT_BYTES(count)
+    };
+
+    memcpy(buf, &header, sizeof(header));
+    for (uint8_t i = 0; i < count; i++) {
+        sys_put_le32(ticks[i], buf + sizeof(header) + COUNT_BYTES(i));
+    }
+    return sizeof(header) + header.data_size_bytes;
+}
+
+static int ble_live_notify(uint16_t first, const uint32_t *ticks, uint8_t count)
+{
+    const uint8_t per_packet = g_bulk_service.peer->sdu_size / sizeof(uint32_t);
+    int err = 0;
+
+    for (uint8_t done = 0; err == 0 && done < count; done += per_packet) {
+        err = ble_transfer_notify(ble_fill_live(tx_buffer, first + done, ticks + done, MIN(per_packet, count - done)));
+    }
+    return err;
+}
+
+/*A batch starting at 0 (re)starts the stream of its session on this central*/
+static void ble_live_forward(struct ble_peer *peer, const struct live_batch *batch)
+{
+    if (batch->first == 0) {
+        peer->live_seq = batch->seq;
+        peer->live_sent = 0;
+        peer->live_valid = true;
+    }
+    if (!peer->live_valid || batch->seq != peer->live_seq || batch->first != peer->live_sent) {
+        peer->live_valid = false;
+        return;
+    }
+    if (!peer_target_begin(peer) || !peer_live_capable(peer, g_bulk_service.current_conn) ||
+        ble_live_notify(batch->first, batch->ticks, batch->count) != 0) {
+        peer->live_valid = false;
+    } else {
+        peer->live_sent += batch->count;
+    }
+    peer_target_end();
+}
+
+/*Sends everything the capture path queued to every central that asked for it*/
+static void ble_live_flush()
+{
+    struct live_batch batch;
+
+    while (k_msgq_get(&live_queue, &batch, K_NO_WAIT) == 0) {
+        for (uint8_t i = 0; i < BLE_MAX_PEERS; i++) {
+            if (g_peers[i].live) {
+                ble_live_forward(&g_peers[i], &batch);
+            }
+        }
+    }
+}
+
+static bool ble_live_streamed(const struct session *session)
+{
+    const struct ble_peer *peer = g_bulk_service.peer;
+
+    return peer_live_capable(peer, g_bulk_service.current_conn) && peer->live_valid &&
+           peer->live_seq == session->header.seq && peer->live_sent <= capture_store_count(&session->store);
+}
+
+/*
+Finishes a live streamed session: the remaining pulses, then LIVE_END, then the app's ACK.
+Fails with -EAGAIN if the app reports a mismatch, the caller then sends the session completely.
+*/
+static int ble_live_finish(const struct session *session)
+{
+    const uint16_t count = capture_store_count(&session->store);
+    struct capture_store_iter it;
+    uint32_t ticks[BLE_LIVE_BATCH_PULSES];
+    uint32_t crc = 0;
+    uint8_t raw[sizeof(uint32_t)];
+    uint16_t index = 0;
+    uint8_t num = 0;
+    int err = 0;
+
+    g_transfer.seq = session->header.seq;
+    g_transfer.acked = false;
+    k_msgq_purge(&transfer_nack_queue);
+    k_sem_reset(&transfer_ctrl_sem);
+
+    capture_store_iter_init(&it, &session->store, 0);
+    while (err == 0 && capture_store_iter_next(&it, &ticks[num])) {
+        sys_put_le32(ticks[num], raw);
+        crc = crc32_ieee_update(crc, raw, sizeof(raw));
+        if (index++ < g_bulk_service.peer->live_sent) {
+            continue;
+        }
+        if (++num == BLE_LIVE_BATCH_PULSES) {
+            err = ble_live_notify(index - num, ticks, num);
+            num = 0;
+        }
+    }
+    if (err == 0 && num > 0) {
+        err = ble_live_notify(index - num, ticks, num);
+    }
+    if (err != 0) {
+        return err;
+    }
+
+    struct ble_packet_header header = {
+        .flag = TX_FLAG_LIVE_END,
+        .chunk_index = count,
+        .data_size_bytes = LIVE_END_PAYLOAD_SIZE
+    };
+    memcpy(tx_buffer, &header, sizeof(header));
+    ble_fill_start_payload(session, SESSION_ENCODING_RAW, tx_buffer + sizeof(header));
+    sys_put_le32(crc, tx_buffer + sizeof(header) + START_PAYLOAD_SIZE);
+    err = ble_transfer_notify(sizeof(header) + LIVE_END_PAYLOAD_SIZE);
+    if (err == 0 && k_sem_take(&transfer_ctrl_sem, K_MSEC(TRANSFER_ACK_TIMEOUT_MS)) != 0) {
+        err = -ETIMEDOUT;
+    }
+    if (err == 0 && !g_transfer.acked) {
+        err = -EAGAIN; //NACKed, the stream had a gap the app noticed
+    }
+    g_bulk_service.peer->live_valid = false;
+    return err;
+}
+
+
+// =========================================================================
+//  BACKGROUND SENDER
+// =========================================================================
+
+void ble_sender_kick()
+{
+    k_sem_give(&sender_wakeup_sem);
+}
+
+
+static bool ble_transfer_subscribed()
+{
+    return bt_gatt_is_subscribed(g_bulk_service.current_conn, &custom_svc.attrs[TRANSFER_ATTR_IDX], BT_GATT_CCC_NOTIFY);
+}
+
+
+static bool ble_conn_can_receive(struct bt_conn *conn)
+{
+    return ble_l2cap_is_connected(conn) ||
+           bt_gatt_is_subscribed(conn, &custom_svc.attrs[TRANSFER_ATTR_IDX], BT_GATT_CCC_NOTIFY) ||
+           bt_gatt_is_subscribed(conn, &custom_svc.attrs[2], BT_GATT_CCC_INDICATE);
+}
+
+
+/*At least one connected central can receive sessions*/
+static bool ble_can_send()
+{
+    bool can_send = false;
+
+    for (uint8_t i = 0; !can_send && i < BLE_MAX_PEERS; i++)
+    {
+        struct bt_conn *conn = peer_ref(&g_peers[i]);
+        if (conn != NULL)
+        {
+            can_send = ble_conn_can_receive(conn);
+            bt_conn_unref(conn);
+        }
+    }
+    return can_send;
+}
+
+
+/*Sends the session to the current target over the best path it opened*/
+static int ble_send_session_to_target(struct session *session)
+{
+    if (ble_live_streamed(session))
+    {
+        g_transfer_stats.path = "live";
+        int err = ble_live_finish(session);
+        if (err != -EAGAIN)
+        {
+            return err;
+        }
+        LOG_WRN("Live stream of session %d incomplete, sending it again", session->header.seq);
+    }
+    if (ble_l2cap_is_connected(g_bulk_service.current_conn))
+    {
+        g_transfer_stats.path = "L2CAP";
+        return ble_l2cap_send_session(session, g_bulk_service.peer->encoding);
+    }
+    if (ble_transfer_subscribed())
+    {
+        g_transfer_stats.path = "notifications";
+        return ble_transfer_session(session);
+    }
+    g_transfer_stats.path = "indications";
+    int err = ble_prepare_send(session);
+    if (err != 0)
+    {
+        return err;
+    }
+    err = ble_send_start();
+    while (err == 0 && ble_is_sending())
+    {
+        err = ble_send_chunk();
+    }
+    if (err == 0 && k_sem_take(&indication_sem, K_MSEC(INDICATION_TIMEOUT_MS)) != 0)
+    {
+        err = -ETIMEDOUT; //END was not confirmed, the app may not have the session
+    }
+    g_bulk_service.transmission_active = false;
+    return err;
+}
+
+
+/*
+Transfer time counts from the first packet queued to the last one confirmed, goodput only the session
+payload in the encoding of that central; START, END and packet headers are overhead.
+*/
+static void ble_transfer_stats_report(const struct session *session, int err, int64_t duration_ms)
+{
+    struct ble_link_info link;
+
+    if (!IS_ENABLED(CONFIG_TRICHTER_BLE_TRANSFER_STATS))
+    {
+        return;
+    }
+    ble_link_get_info(&g_bulk_service.peer->link, &link);
+    const uint32_t payload_bytes = ble_payload_size(session, g_bulk_service.peer->encoding);
+    const uint32_t goodput = (payload_bytes * 1000U) / MAX(duration_ms, 1);
+
+    LOG_INF("Session %d over %s (%d): %d B in %d ms, %d B/s, %d retries; MTU %d, PHY %d, DLE %d, interval %d.%02d ms",
+            session->header.seq, g_transfer_stats.path, err, payload_bytes, (uint32_t)duration_ms, goodput,
+            g_transfer_stats.retries, link.mtu, link.tx_phy, link.tx_data_len,
+            (link.interval * 125) / 100, (link.interval * 125) % 100);
+}
+
+
+/*The controlling central is connected and can receive sessions*/
+static bool ble_controller_can_receive()
+{
+    struct ble_peer *controller = g_controller;
+    struct bt_conn *conn = (controller != NULL) ? peer_ref(controller) : NULL;
+    bool can_receive = false;
+
+    if (conn != NULL)
+    {
+        can_receive = ble_conn_can_receive(conn);
+        bt_conn_unref(conn);
+    }
+    return can_receive;
+}
+
+
+/*
+Sends the session to every central that can receive it, one after the other. Succeeds if at least
+one of them got it; a central that failed gets later sessions again, or pulls this one.
+to_controller tells whether the controller was among them: only its copy lets a logged session go.
+*/
+static int ble_send_session(struct session *session, bool *to_controller)
+{
+    int result = -ENOTCONN;
+
+    *to_controller = false;
+    for (uint8_t i = 0; i < BLE_MAX_PEERS; i++)
+    {
+        if (peer_target_begin(&g_peers[i]) && ble_conn_can_receive(g_bulk_service.current_conn))
+        {
+            ble_link_select(&g_peers[i].link); //only the connection being served gets the transfer profile
+            int64_t started = k_uptime_get();
+            g_transfer_stats.retries = 0;
+            int err = ble_send_session_to_target(session);
+            ble_transfer_stats_report(session, err, k_uptime_delta(&started));
+            if (err != 0)
+            {
+                LOG_WRN("Session %d to central %d failed (%d)", session->header.seq, i, err);
+            }
+            else if (&g_peers[i] == g_controller)
+            {
+                *to_controller = true;
+            }
+            result = (err == 0 || result == 0) ? 0 : err;
+        }
+        peer_target_end();
+    }
+    return result;
+}
+
+
+/*
+Nobody to send to: move queued sessions into the flash log, so later runs cannot overwrite them.
+*/
+static void ble_sender_persist_queued()
+{
+    struct session *session;
+
+    while ((session = session_pool_next_queued()) != NULL)
+    {
+        if (!session->persisted && capture_store_count(&session->store) > 0 && session_log_append(session) != 0)
+        {
+            session_pool_requeue(session);
+            break;
+        }
+        session_pool_release(session);
+    }
+}
+
+
+static bool ble_sender_has_work()
+{
+    struct session_log_info info;
+
+    session_log_get_info(&info);
+    return session_pool_num_queued() > 0 || info.pending > 0;
+}
+
+
+/*
+Drains the session pool over BLE, oldest session first, independent of the FSM state, then everything
+still pending in the flash log while the controller can receive. A logged session is acknowledged
+only once the controller got it; one that only spectators got goes into the log for the controller.
+Sleeps until a session is queued or a central subscribes; only after a failed send it also wakes
+after BLE_SENDER_RETRY_MS to try again.
+*/
+static void ble_sender_main(void *p1, void *p2, void *p3)
+{
+    k_timeout_t wait = K_FOREVER;
+
+    while (true)
+    {
+        k_sem_take(&sender_wakeup_sem, wait);
+        wait = K_FOREVER;
+        if (!ble_can_send())
+        {
+            ble_sender_persist_queued();
+            continue;
+        }
+        ble_link_hold_transfer(ble_sender_has_work());
+        while (ble_can_send())
+        {
+            ble_live_flush(); //the newest pulses first, they may complete the session below
+            struct session *session = session_pool_next_queued();
+            bool to_controller;
+            if (session == NULL && ble_controller_can_receive() && session_log_queue_next()) //the log syncs to the controller
+            {
+                session = session_pool_next_queued();
+            }
+            if (session == NULL)
+            {
+                break;
+            }
+            if (capture_store_count(&session->store) == 0)
+            {
+                session_pool_release(session);
+                continue;
+            }
+            int err = ble_send_session(session, &to_controller);
+            if (err == 0 && session->persisted && !to_controller)
+            {
+                err = -EAGAIN; //a spectator's copy must not delete it from the log
+            }
+            if (err != 0)
+            {
+                LOG_WRN("Sending session %d failed (%d), keeping it queued", session->header.seq, err);
+                session_pool_requeue(session);
+                wait = K_MSEC(BLE_SENDER_RETRY_MS);
+                break;
+            }
+            LOG_INF("Session %d sent%s", session->header.seq, to_controller ? "" : " to spectators only");
+            if (session->persisted)
+            {
+                session_log_ack(session->header.seq);
+            }
+            else if (!to_controller && session_log_append(session) != 0) //synced once the controller can receive
+            {
+                LOG_WRN("Session %d not logged, the controller can only pull it", session->header.seq);
+            }
+            session_pool_release(session);
+        }
+        ble_link_hold_transfer(false);
+    }
+}
+
+K_THREAD_DEFINE(ble_sender, BLE_SENDER_STACK_SIZE, ble_sender_main, NULL, NULL, NULL, BLE_SENDER_PRIO, 0, 0);
@@ -1,20 +1,25 @@
 #include <zephyr/kernel.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/hci.h>
-#include <zephyr/sys/printk.h>
+#include <zephyr/sys/byteorder.h>
 
 #include "bluetooth_advertising.h"
 #include "bluetooth_common.h"
 #include "fsm_core.h"
 #include "state_machine.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(bluetooth_advertising, CONFIG_TRICHTER_BLE_LOG_LEVEL);
 
 
 #define BLE_ADV_FAST_TIMEOUT_SEC    30
 
-#define BT_SM_PERIOD_MS             500
+#define BLE_FSM_REQUEST_QUEUE_DEPTH 4
 
 #define BLE_ADV_SLOW_INT_MIN        1364  //852.5ms, as per apple developer guidelines
 #define BLE_ADV_SLOW_INT_MAX        1365
+#define BLE_ADV_BROADCAST_INT_MIN   BT_GAP_ADV_FAST_INT_MIN_2 //100ms, the minimum for non-connectable legacy advertising
+#define BLE_ADV_BROADCAST_INT_MAX   BT_GAP_ADV_FAST_INT_MAX_2
 #define BLE_FSM_THREAD_STACK_SIZE   1024
 #define BLE_FSM_THREAD_PRIO         3
 
@@ -30,6 +35,7 @@ typedef enum
     BLE_STATE_ADV_FAST,
     BLE_STATE_ADV_SLOW,
     BLE_STATE_STOP,
+    BLE_STATE_BROADCAST,
     BLE_STATE_ERROR,
     BLE_STATE_MAX
 } BleStateId_t;
@@ -38,15 +44,20 @@ typedef enum
 
 static StateMachine_t g_ble_sm;
 
+K_MSGQ_DEFINE(ble_fsm_request_queue, sizeof(uint8_t), BLE_FSM_REQUEST_QUEUE_DEPTH, 1);
+
 static struct k_timer adv_fast_timer;
 
 static bool g_adv_active = false;
+static bool g_adv_scannable = false;    //scan response set, only for the connectable states
 
 /* Forward declare */
 static uint8_t ble_state_idle(void);
 static uint8_t ble_state_adv_fast(void);
 static uint8_t ble_state_adv_slow(void);
 static uint8_t ble_state_stop(void);
+static uint8_t ble_state_broadcast(void);
+static uint8_t ble_state_broadcast_exit(void);
 static uint8_t ble_state_error(void);
 static uint8_t ble_state_no_impl(void);
 
@@ -59,7 +70,7 @@ static const State_t BLE_STATES[NUM_STATES_BLE] =
         .onEntry = ble_state_idle,
         .runLoop = ble_state_no_impl,
         .onExit  = ble_state_no_impl,
-        .allowedTransitions = {BLE_STATE_ADV_FAST, BLE_STATE_ADV_SLOW, BLE_STATE_ERROR, BLE_STATE_MAX, BLE_STATE_MAX}
+        .allowedTransitions = {BLE_STATE_ADV_FAST, BLE_STATE_ADV_SLOW, BLE_STATE_ERROR, BLE_STATE_BROADCAST, BLE_STATE_MAX}
     },
     [BLE_STATE_ADV_FAST] =
     {
@@ -67,7 +78,7 @@ static const State_t BLE_STATES[NUM_STATES_BLE] =
         .onEntry = ble_state_adv_fast,
         .runLoop = ble_state_no_impl,
         .onExit  = ble_state_no_impl,
-        .allowedTransitions = {BLE_STATE_STOP, BLE_STATE_ADV_SLOW, BLE_STATE_ERROR, BLE_STATE_MAX, BLE_STATE_MAX}
+        .allowedTransitions = {BLE_STATE_STOP, BLE_STATE_ADV_SLOW, BLE_STATE_ERROR, BLE_STATE_BROADCAST, BLE_STATE_MAX}
     },
     [BLE_STATE_ADV_SLOW] =
     {
@@ -75,7 +86,7 @@ static const State_t BLE_STATES[NUM_STATES_BLE] =
         .onEntry = ble_state_adv_slow,
         .runLoop = ble_state_no_impl,
         .onExit  = ble_state_no_impl,
-        .allowedTransitions = {BLE_STATE_STOP, BLE_STATE_ADV_FAST, BLE_STATE_ERROR, BLE_STATE_MAX, BLE_STATE_MAX}
+        .allowedTransitions = {BLE_STATE_STOP, BLE_STATE_ADV_FAST, BLE_STATE_ERROR, BLE_STATE_BROADCAST, BLE_STATE_MAX}
     },
     [BLE_STATE_STOP] =
     {
@@ -85,6 +96,14 @@ static const State_t BLE_STATES[NUM_STATES_BLE] =
         .onExit  = ble_state_no_impl,
         .allowedTransitions = {BLE_STATE_IDLE, BLE_STATE_ERROR, BLE_STATE_MAX, BLE_STATE_MAX, BLE_STATE_MAX}
     },
+    [BLE_STATE_BROADCAST] =
+    {
+        .id = BLE_STATE_BROADCAST,
+        .onEntry = ble_state_broadcast,
+        .runLoop = ble_state_no_impl,
+        .onExit  = ble_state_broadcast_exit,
+        .allowedTransitions = {BLE_STATE_STOP, BLE_STATE_ADV_FAST, BLE_STATE_ADV_SLOW, BLE_STATE_ERROR, BLE_STATE_MAX}
+    },
     [BLE_STATE_ERROR] =
     {
         .id = BLE_STATE_ERROR,
@@ -96,12 +115,32 @@ static const State_t BLE_STATES[NUM_STATES_BLE] =
 };
 
 
+/*
+Result of the newest run as manufacturer specific data, so any number of phones can show it without
+connecting: u16 company id, u8 record version, u16 session seq, u16 duration in 10ms,
+u16 volume mL, u16 average mL/s, u16 peak mL/s, all little endian. Sent in every advertising state,
+all zero after the version until the first run, and as non-connectable broadcast while a phone is
+connected.
+*/
+#define BLE_RESULT_COMPANY_ID       0xFFFF //reserved for testing, no company id is registered
+#define BLE_RESULT_VERSION          1
+#define BLE_RESULT_RECORD_SIZE      13
+
+static uint8_t g_result_record[BLE_RESULT_RECORD_SIZE] = {
+    BLE_RESULT_COMPANY_ID & 0xFF, BLE_RESULT_COMPANY_ID >> 8, BLE_RESULT_VERSION
+};
+static bool g_result_valid = false;
+K_MUTEX_DEFINE(adv_data_lock);   //result record vs. the stack copying the advertising data
+
 /* Advertising data */
 struct bt_data ad[] = {
     BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
     BT_DATA(BT_DATA_NAME_COMPLETE,
             CONFIG_BT_DEVICE_NAME,
-            sizeof(CONFIG_BT_DEVICE_NAME) - 1) // sizeof ist sicherer als strlen bei Konstanten
+            sizeof(CONFIG_BT_DEVICE_NAME) - 1), // sizeof ist sicherer als strlen bei Konstanten
+    #ifdef CONFIG_TRICHTER_BLE_RESULT_BROADCAST
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, g_result_record, sizeof(g_result_record))
+    #endif
 };
 
 struct bt_data sd[] = {
@@ -121,23 +160,17 @@ struct bt_le_adv_param *adv_slow_param =
                      BLE_ADV_SLOW_INT_MAX,
                      NULL);
 
+struct bt_le_adv_param *adv_broadcast_param =
+    BT_LE_ADV_PARAM(BT_LE_ADV_OPT_NONE,
+                     BLE_ADV_BROADCAST_INT_MIN,
+                     BLE_ADV_BROADCAST_INT_MAX,
+                     NULL);
 
-// Minimal FSM main for BLE
+
+// Minimal FSM main for BLE, no state polls, so the thread only wakes up on requests
 static void ble_fsm_main(void *p1, void *p2, void *p3)
 {
-    while (g_ble_fsm_run)
-    {
-        if (g_ble_sm.requestStateDeferred != BLE_STATE_MAX)
-        {
-            printk("Going to transition BLE\n");
-            ble_fsm_transition(&g_ble_sm, g_ble_sm.requestStateDeferred);
-
-            unsigned int key = irq_lock();
-            g_ble_sm.requestStateDeferred = BLE_STATE_MAX;
-            irq_unlock(key);
-        }
-        k_msleep(g_ble_sm.period_ms);
-    }
+    fsm_engine_run(&g_ble_sm, &g_ble_fsm_run);
 }
 
 
@@ -147,7 +180,7 @@ static void adv_fast_timeout(struct k_timer *timer)
 }
 
 
-static uint8_t ble_adv_start(const struct bt_le_adv_param *param)
+static uint8_t ble_adv_start(const struct bt_le_adv_param *param, bool scannable)
 {
     int err;
 
@@ -155,11 +188,14 @@ static uint8_t ble_adv_start(const struct bt_le_adv_param *param)
     {
         return ERR_NONE;
     }
-    printk("Starting advertising\n");
-    err = bt_le_adv_start(param, ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+    LOG_INF("Starting advertising");
+    k_mutex_lock(&adv_data_lock, K_FOREVER);
+    err = bt_le_adv_start(param, ad, ARRAY_SIZE(ad), sd, scannable ? ARRAY_SIZE(sd) : 0);
+    g_adv_scannable = scannable;
+    k_mutex_unlock(&adv_data_lock);
     if (err)
     {
-        printk("BLE adv start failed (%d)\n", err);
+        LOG_ERR("BLE adv start failed (%d)", err);
         return ERR_API;
     }
 
@@ -170,7 +206,7 @@ static uint8_t ble_adv_start(const struct bt_le_adv_param *param)
 
 static void ble_adv_stop(void)
 {
-    printk("Stopping advertising\n");
+    LOG_INF("Stopping advertising");
     if (!g_adv_active)
     {
         return;
@@ -188,12 +224,23 @@ static uint8_t ble_state_idle(void)
 
 static uint8_t ble_state_adv_fast(void)
 {
-    return ble_adv_start(adv_fast_param);
+    return ble_adv_start(adv_fast_param, true);
 }
 
 static uint8_t ble_state_adv_slow(void)
 {
-    return ble_adv_start(adv_slow_param);
+    return ble_adv_start(adv_slow_param, true);
+}
+
+static uint8_t ble_state_broadcast(void)
+{
+    return ble_adv_start(adv_broadcast_param, false);
+}
+
+static uint8_t ble_state_broadcast_exit(void)
+{
+    ble_adv_stop(); //the connectable states start their own advertising set
+    return ERR_NONE;
 }
 
 static uint8_t ble_state_stop(void)
@@ -221,8 +268,12 @@ void bluetooth_advertising_fsm_start(void)
 
     g_ble_sm.current = &BLE_STATES[BLE_STATE_IDLE];
     g_ble_sm.error = ERR_NONE;
-    g_ble_sm.period_ms = BT_SM_PERIOD_MS;
-    g_ble_sm.requestStateDeferred = BLE_STATE_MAX;
+    g_ble_sm.period_ms = FSM_PERIOD_NONE;
+    g_ble_sm.errorState = BLE_STATE_ERROR;
+    g_ble_sm.requests = &ble_fsm_request_queue;
+    g_ble_sm.lastRequest = FSM_EVENT_RESCHEDULE;
+    g_ble_sm.timeoutAt = 0;
+    g_ble_sm.timeoutTarget = BLE_STATE_MAX;
     g_ble_sm.name = "BLE FSM";
     g_ble_sm.states = BLE_STATES;
     g_ble_sm.num_states = NUM_STATES_BLE;
@@ -242,7 +293,7 @@ void bluetooth_advertising_fsm_start(void)
 
 void bluetooth_advertising_start_fast(void)
 {
-    printk("Requested fast adv\n");
+    LOG_INF("Requested fast adv");
     k_timer_start(&adv_fast_timer, K_SECONDS(BLE_ADV_FAST_TIMEOUT_SEC), K_NO_WAIT);
     ble_fsm_transition_deferred(&g_ble_sm, BLE_STATE_ADV_FAST);
 }
@@ -250,7 +301,7 @@ void bluetooth_advertising_start_fast(void)
 
 void bluetooth_advertising_start_slow(void)
 {
-    printk("Requested slow adv\n");
+    LOG_INF("Requested slow adv");
     k_timer_stop(&adv_fast_timer);
     ble_fsm_transition_deferred(&g_ble_sm, BLE_STATE_ADV_SLOW);
 }
@@ -263,6 +314,47 @@ void bluetooth_advertising_stop(void)
 }
 
 
+/*Non-connectable advertising of the result record, while the one connection is taken*/
+void bluetooth_advertising_start_broadcast(void)
+{
+    if (!IS_ENABLED(CONFIG_TRICHTER_BLE_RESULT_BROADCAST) || !g_result_valid)
+    {
+        return;
+    }
+    k_timer_stop(&adv_fast_timer);
+    ble_fsm_transition_deferred(&g_ble_sm, BLE_STATE_BROADCAST);
+}
+
+
+/*
+Replaces the result record. A running advertising set picks it up with its next event, scanners
+never see a half updated record.
+*/
+void bluetooth_advertising_set_result(uint16_t seq, const struct flow_summary *summary)
+{
+    if (!IS_ENABLED(CONFIG_TRICHTER_BLE_RESULT_BROADCAST))
+    {
+        return;
+    }
+    k_mutex_lock(&adv_data_lock, K_FOREVER);
+    sys_put_le16(seq, &g_result_record[3]);
+    sys_put_le16(MIN(summary->duration_ms / 10, UINT16_MAX), &g_result_record[5]);
+    sys_put_le16(summary->volume_ml, &g_result_record[7]);
+    sys_put_le16(summary->avg_ml_per_s, &g_result_record[9]);
+    sys_put_le16(summary->peak_ml_per_s, &g_result_record[11]);
+    g_result_valid = true;
+    if (g_adv_active)
+    {
+        int err = bt_le_adv_update_data(ad, ARRAY_SIZE(ad), sd, g_adv_scannable ? ARRAY_SIZE(sd) : 0);
+        if (err)
+        {
+            LOG_WRN("Result advertising update failed (%d)", err);
+        }
+    }
+    k_mutex_unlock(&adv_data_lock);
+}
+
+
 bool bluetooth_advertising_is_active(void)
 {
     return g_adv_active;
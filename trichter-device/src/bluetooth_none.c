@@ -0,0 +1,97 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bluetooth.h"
+#include "bluetooth_advertising.h"
+#include "ble_link.h"
+#include "runtime.h"
+
+/*
+Stands in for bluetooth.c, bluetooth_advertising.c, ble_link.c and ble_l2cap.c in builds without
+CONFIG_BT (native_sim). Nobody connects: finished sessions stay queued in the session pool, where
+the next run takes over the oldest one, and every notification goes nowhere.
+*/
+
+int init_ble(uint8_t timer_tick_duration)
+{
+    return 0;
+}
+
+
+bool is_ble_connected()
+{
+    return false;
+}
+
+
+void ble_sender_kick()
+{
+}
+
+
+bool ble_live_active()
+{
+    return false;
+}
+
+
+bool ble_live_submit(uint16_t seq, uint16_t first, const uint32_t *ticks, uint8_t count)
+{
+    return true;
+}
+
+
+void ble_delete_active_connection()
+{
+}
+
+
+void ble_register_state_input_handler(RemoteStateInputHandler handler)
+{
+}
+
+
+void ble_state_notifier(StateID_t state)
+{
+}
+
+
+void ble_calibration_attempt_notifier(bool success)
+{
+}
+
+
+void ble_flow_result_notifier(const struct session_header *header, const struct flow_summary *summary)
+{
+}
+
+
+void ble_link_profile_idle(void)
+{
+}
+
+
+void ble_link_profile_transfer(void)
+{
+}
+
+
+void bluetooth_advertising_fsm_start(void)
+{
+}
+
+
+void bluetooth_advertising_start_fast(void)
+{
+}
+
+
+void bluetooth_advertising_stop(void)
+{
+}
+
+
+bool bluetooth_advertising_is_active(void)
+{
+    return false;
+}
@@ -0,0 +1,254 @@
+#include <zephyr/kernel.h>
+#include <zephyr/irq.h>
+#include <zephyr/drivers/gpio.h>
+#include <hal/nrf_timer.h>
+#include <hal/nrf_gpiote.h>
+#include <nrfx_gpiote.h>
+#include <helpers/nrfx_gppi.h>
+
+#include "capture_backend.h"
+#include "runtime.h"
+#include "devicetree_devices.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(capture_nrfx, CONFIG_TRICHTER_RUNTIME_LOG_LEVEL);
+
+/*
+TIMER2 is the timebase: CC0 is sampled by the FSM, CC2 ends the run, CC1 and CC3 are latched through
+PPI by the sensor edge of lane 0 and 1. TIMER3 counts the edges of lane 0, TIMER4 clocks the display
+and TIMER0/1 belong to the radio, so further lanes have no pulse counter.
+*/
+#define CAPTURE_TIMER               NRF_TIMER2
+#define CAPTURE_TIMER_IRQ_PRIO      2
+#define CAPTURE_CC_NOW              NRF_TIMER_CC_CHANNEL0
+#define CAPTURE_CC_COMPARE          NRF_TIMER_CC_CHANNEL2
+#define PULSE_COUNTER_TIMER         NRF_TIMER3
+
+struct sensor_input {
+    const struct gpio_dt_spec *spec;
+    nrf_timer_cc_channel_t capture_cc;
+    NRF_TIMER_Type *counter;        //counter mode, fed by PPI from the sensor event; NULL if the lane has none
+    struct gpio_callback cb;
+    nrfx_gppi_handle_t ppi_channel;
+    nrfx_gppi_handle_t ppi_counter_channel;
+    uint8_t gpiote_channel;
+    uint8_t lane;
+};
+
+static struct sensor_input g_sensors[CAPTURE_LANES] = {
+    { .spec = &button_test_sensor, .capture_cc = NRF_TIMER_CC_CHANNEL1, .counter = PULSE_COUNTER_TIMER, .lane = 0 },
+#if CAPTURE_LANES > 1
+    { .spec = &button_test_sensor_1, .capture_cc = NRF_TIMER_CC_CHANNEL3, .counter = NULL, .lane = 1 },
+#endif
+};
+
+static const struct capture_backend_cb *g_cb;
+
+
+/*
+Forks the sensor event onto a second timer in counter mode. It counts every edge in hardware, even
+when a second pulse overwrites the capture register of TIMER2 before the sensor ISR could read it.
+*/
+static void setup_pulse_counter(struct sensor_input *input, uint32_t eep)
+{
+    nrfx_err_t err;
+    NRF_TIMER_Type *counter = input->counter;
+
+    nrf_timer_mode_set(counter, NRF_TIMER_MODE_COUNTER);
+    nrf_timer_bit_width_set(counter, NRF_TIMER_BIT_WIDTH_32);
+    nrf_timer_int_disable(counter, 0xFFFFFFFF);
+    nrf_timer_task_trigger(counter, NRF_TIMER_TASK_CLEAR);
+    nrf_timer_task_trigger(counter, NRF_TIMER_TASK_START);
+
+    uint32_t tep = nrf_timer_task_address_get(counter, NRF_TIMER_TASK_COUNT);
+    err = nrfx_gppi_conn_alloc(eep, tep, &input->ppi_counter_channel);
+    if (err != 0) {
+        LOG_ERR("GPPI counter conn alloc failed: 0x%08x", err);
+        return;
+    }
+    nrfx_gppi_conn_enable(input->ppi_counter_channel);
+}
+
+
+static void setup_ppi_for_sensor(struct sensor_input *input)
+{
+    const struct gpio_dt_spec *sensor = input->spec;
+    nrfx_err_t err;
+    static nrfx_gpiote_t gpiote = NRFX_GPIOTE_INSTANCE(NRF_GPIOTE);
+
+    if (false == nrfx_gpiote_init_check(&gpiote)) {
+        err = nrfx_gpiote_init(&gpiote, 0);
+        if (err != 0) {
+            LOG_ERR("GPIOTE init failed: %08x", err);
+            return;
+        }
+    }
+    // Allocate GPIOTE channel
+    err = nrfx_gpiote_channel_alloc(&gpiote, &input->gpiote_channel);
+    if (err != 0) {
+        LOG_ERR("GPIOTE channel alloc failed: %08x", err);
+        return;
+    }
+
+    // Configure input pin
+    nrfx_gpiote_trigger_config_t trigger_config = {
+        .trigger = NRFX_GPIOTE_TRIGGER_LOTOHI,
+        .p_in_channel = &input->gpiote_channel,
+    };
+
+    nrfx_gpiote_input_pin_config_t input_config = {
+        .p_pull_config = NULL,  // Use existing pull config
+        .p_trigger_config = &trigger_config,
+        .p_handler_config = NULL
+    };
+
+    err = nrfx_gpiote_input_configure(&gpiote, sensor->pin, &input_config);
+    if (err != 0) {
+        LOG_ERR("GPIOTE input config failed: %08x", err);
+        return;
+    }
+    nrfx_gpiote_trigger_enable(&gpiote, sensor->pin, false);
+
+    uint32_t eep = nrf_gpiote_event_address_get(NRF_GPIOTE, nrfx_gpiote_in_event_get(&gpiote, sensor->pin));
+    uint32_t tep = nrf_timer_task_address_get(CAPTURE_TIMER, nrf_timer_capture_task_get(input->capture_cc));
+
+    LOG_DBG("Lane %d EVENT addr IN : %08x; OUT : %08x", input->lane, eep, tep);
+
+    err = nrfx_gppi_conn_alloc(eep, tep, &input->ppi_channel);
+    if (err != 0) {
+        LOG_ERR("GPPI conn alloc failed: 0x%08x", err);
+        return;
+    }
+
+    // Enable the connection (replaces nrfx_gppi_channels_enable(BIT(channel)))
+    nrfx_gppi_conn_enable(input->ppi_channel);
+
+    if (input->counter != NULL) {
+        setup_pulse_counter(input, eep);
+    }
+}
+
+
+static void sensor_isr(const struct device *dev, struct gpio_callback *cb, uint32_t pins)
+{
+    const struct sensor_input *input = CONTAINER_OF(cb, struct sensor_input, cb);
+
+    g_cb->pulse(input->lane);
+}
+
+
+static void compare_isr(const void *arg)
+{
+    if (!nrf_timer_event_check(CAPTURE_TIMER, nrf_timer_compare_event_get(CAPTURE_CC_COMPARE))) {
+        return;
+    }
+    nrf_timer_event_clear(CAPTURE_TIMER, nrf_timer_compare_event_get(CAPTURE_CC_COMPARE));
+    nrf_timer_int_disable(CAPTURE_TIMER, nrf_timer_compare_int_get(CAPTURE_CC_COMPARE));
+    g_cb->compare();
+}
+
+
+int capture_backend_init(const struct capture_backend_cb *cb)
+{
+    int ret = 0;
+
+    g_cb = cb;
+    capture_backend_clear();
+    IRQ_CONNECT(TIMER2_IRQn, CAPTURE_TIMER_IRQ_PRIO, compare_isr, NULL, 0);
+    irq_enable(TIMER2_IRQn);
+
+    for (uint8_t lane = 0; lane < CAPTURE_LANES; lane++) {
+        ret |= setup_isr_for_gpio_in(g_sensors[lane].spec, &g_sensors[lane].cb, sensor_isr, GPIO_INT_EDGE_RISING);
+        setup_ppi_for_sensor(&g_sensors[lane]);
+    }
+    return ret;
+}
+
+
+void capture_backend_start(void)
+{
+    nrf_timer_task_trigger(CAPTURE_TIMER, NRF_TIMER_TASK_START); //starts timer in free running mode
+}
+
+
+void capture_backend_stop(void)
+{
+    nrf_timer_task_trigger(CAPTURE_TIMER, NRF_TIMER_TASK_STOP);
+}
+
+
+void capture_backend_clear(void)
+{
+    nrf_timer_task_trigger(CAPTURE_TIMER, NRF_TIMER_TASK_CLEAR);
+
+    for (uint8_t i = 0; i < NRF_TIMER_CC_CHANNEL_COUNT(2); i++) {
+        nrf_timer_cc_set(CAPTURE_TIMER, (nrf_timer_cc_channel_t)i, 0);
+    }
+    for (uint8_t i = 0; i < NRF_TIMER_CC_CHANNEL_COUNT(2); i++) {
+        nrf_timer_event_clear(CAPTURE_TIMER, nrf_timer_compare_event_get(i));
+    }
+
+    nrf_timer_int_disable(CAPTURE_TIMER, NRF_TIMER_INT_COMPARE0_MASK |
+                                         NRF_TIMER_INT_COMPARE1_MASK |
+                                         NRF_TIMER_INT_COMPARE2_MASK |
+                                         NRF_TIMER_INT_COMPARE3_MASK |
+                                         NRF_TIMER_INT_COMPARE4_MASK |
+                                         NRF_TIMER_INT_COMPARE5_MASK);
+
+    nrf_timer_prescaler_set(CAPTURE_TIMER, NRF_TIMER_FREQ_125kHz);
+    nrf_timer_mode_set(CAPTURE_TIMER, NRF_TIMER_MODE_TIMER);
+    nrf_timer_bit_width_set(CAPTURE_TIMER, NRF_TIMER_BIT_WIDTH_32);
+    nrf_timer_shorts_disable(CAPTURE_TIMER, NRF_TIMER_SHORT_COMPARE1_CLEAR_MASK | NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK);
+
+    LOG_DBG("Successfully reset timer");
+}
+
+
+/*Thread and ISR both trigger CC0, a thread preempted in between only reads a later time*/
+uint32_t capture_backend_now(void)
+{
+    nrf_timer_task_trigger(CAPTURE_TIMER, nrf_timer_capture_task_get(CAPTURE_CC_NOW));
+    return nrf_timer_cc_get(CAPTURE_TIMER, CAPTURE_CC_NOW);
+}
+
+
+uint32_t capture_backend_read(uint8_t lane)
+{
+    return nrf_timer_cc_get(CAPTURE_TIMER, g_sensors[lane].capture_cc);
+}
+
+
+void capture_backend_compare_set(uint32_t tick)
+{
+    nrf_timer_cc_set(CAPTURE_TIMER, CAPTURE_CC_COMPARE, tick);
+    nrf_timer_event_clear(CAPTURE_TIMER, nrf_timer_compare_event_get(CAPTURE_CC_COMPARE));
+    nrf_timer_int_enable(CAPTURE_TIMER, nrf_timer_compare_int_get(CAPTURE_CC_COMPARE));
+}
+
+
+void capture_backend_compare_disable(void)
+{
+    nrf_timer_int_disable(CAPTURE_TIMER, nrf_timer_compare_int_get(CAPTURE_CC_COMPARE));
+    nrf_timer_event_clear(CAPTURE_TIMER, nrf_timer_compare_event_get(CAPTURE_CC_COMPARE));
+}
+
+
+bool capture_backend_counter_present(uint8_t lane)
+{
+    return g_sensors[lane].counter != NULL;
+}
+
+
+uint32_t capture_backend_counter(uint8_t lane, uint8_t cc_channel)
+{
+    NRF_TIMER_Type *counter = g_sensors[lane].counter;
+
+    nrf_timer_task_trigger(counter, nrf_timer_capture_task_get((nrf_timer_cc_channel_t)cc_channel));
+    return nrf_timer_cc_get(counter, (nrf_timer_cc_channel_t)cc_channel);
+}
+
+
+void capture_backend_irq_enable(uint8_t lane, bool enable)
+{
+    gpio_pin_interrupt_configure_dt(g_sensors[lane].spec, enable ? GPIO_INT_EDGE_RISING : GPIO_INT_DISABLE);
+}
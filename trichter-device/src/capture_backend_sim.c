@@ -0,0 +1,305 @@
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+
+#include "capture_backend.h"
+#include "pulse_injector.h"
+#include "runtime.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(capture_sim, CONFIG_TRICHTER_RUNTIME_LOG_LEVEL);
+
+/*
+Simulated capture hardware for native_sim. The timebase is derived from the cycle counter and runs
+speedup times faster than TIMER_FREQUENCY_HZ. Pulses come from k_timer expiry functions, so the
+capture path sees them in interrupt context like the sensor ISR on the board.
+While a pulse is delivered the whole backend reads the cycle the pulse was due at, not the one the
+host got around to deliver it: captures are exactly the recorded ticks and replays are reproducible
+however coarse CONFIG_SYS_CLOCK_TICKS_PER_SEC is. Pulses that fall due together are delivered back
+to back from one expiry.
+*/
+struct sim_lane {
+    struct k_timer timer;
+    struct k_sem done;
+    const uint32_t *ticks;      //NULL: no train playing
+    uint16_t count;
+    uint16_t next;
+    uint64_t start_cycles;      //cycle the first pulse of the train was due at
+    uint32_t capture;
+    uint32_t counter;           //every injected pulse, also while the interrupt is disabled
+    uint32_t counter_cc[2];
+    bool irq_enabled;
+};
+
+static struct {
+    const struct capture_backend_cb *cb;
+    uint16_t speedup;
+    bool running;
+    uint32_t offset;            //timebase at start_cycles, or the frozen value while stopped
+    uint64_t start_cycles;
+    bool in_pulse;              //a pulse is being delivered, time stands at pulse_cycles
+    uint64_t pulse_cycles;
+    struct k_timer compare_timer;
+    bool compare_armed;
+    uint32_t compare_tick;
+    struct sim_lane lanes[CAPTURE_LANES];
+} g_sim = {
+    .speedup = 1,
+};
+
+static struct k_spinlock g_sim_lock;
+
+
+static uint64_t sim_cycles(void)
+{
+    return g_sim.in_pulse ? g_sim.pulse_cycles : k_cycle_get_64();
+}
+
+
+static uint64_t sim_cycles_for_ticks(uint32_t ticks)
+{
+    return ((uint64_t)ticks * sys_clock_hw_cycles_per_sec()) / ((uint64_t)TIMER_FREQUENCY_HZ * g_sim.speedup);
+}
+
+
+static uint32_t sim_timebase_at(uint64_t cycles)
+{
+    if (!g_sim.running || cycles < g_sim.start_cycles) {
+        return g_sim.offset;
+    }
+    return g_sim.offset + (uint32_t)(((cycles - g_sim.start_cycles) * TIMER_FREQUENCY_HZ * g_sim.speedup) /
+                                     sys_clock_hw_cycles_per_sec());
+}
+
+
+/*Arms the k_timer for the compare tick, a compare in the past fires right away*/
+static void sim_compare_schedule(void)
+{
+    const int32_t remaining = (int32_t)(g_sim.compare_tick - sim_timebase_at(sim_cycles()));
+
+    if (!g_sim.compare_armed || !g_sim.running) {
+        k_timer_stop(&g_sim.compare_timer); //a stopped timebase never reaches it
+        return;
+    }
+    k_timer_start(&g_sim.compare_timer, (remaining > 0) ? K_CYC(sim_cycles_for_ticks(remaining)) : K_NO_WAIT, K_NO_WAIT);
+}
+
+
+static void sim_compare_expired(struct k_timer *timer)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_sim_lock);
+    const bool fire = g_sim.compare_armed && g_sim.running &&
+                      (int32_t)(sim_timebase_at(k_cycle_get_64()) - g_sim.compare_tick) >= 0;
+
+    if (fire) {
+        g_sim.compare_armed = false;
+    } else {
+        sim_compare_schedule(); //host timer fired early
+    }
+    k_spin_unlock(&g_sim_lock, key);
+    if (fire) {
+        g_sim.cb->compare();
+    }
+}
+
+
+static void sim_pulse_expired(struct k_timer *timer)
+{
+    struct sim_lane *lane = CONTAINER_OF(timer, struct sim_lane, timer);
+    const uint8_t id = lane - g_sim.lanes;
+    const uint64_t now = k_cycle_get_64();
+
+    while (lane->ticks != NULL) {
+        const uint64_t due = lane->start_cycles + sim_cycles_for_ticks(lane->ticks[lane->next] - lane->ticks[0]);
+        if (due > now) {
+            k_timer_start(&lane->timer, K_CYC(due - now), K_NO_WAIT);
+            return;
+        }
+
+        k_spinlock_key_t key = k_spin_lock(&g_sim_lock);
+        g_sim.in_pulse = true;
+        g_sim.pulse_cycles = due;
+        lane->capture = sim_timebase_at(due); //what PPI would have latched
+        lane->counter++;
+        const bool deliver = lane->irq_enabled;
+        k_spin_unlock(&g_sim_lock, key);
+
+        if (deliver) {
+            g_sim.cb->pulse(id);
+        }
+        g_sim.in_pulse = false;
+
+        if (++lane->next >= lane->count) {
+            lane->ticks = NULL;
+            k_sem_give(&lane->done);
+        }
+    }
+}
+
+
+int capture_backend_init(const struct capture_backend_cb *cb)
+{
+    g_sim.cb = cb;
+    k_timer_init(&g_sim.compare_timer, sim_compare_expired, NULL);
+    for (uint8_t i = 0; i < CAPTURE_LANES; i++) {
+        k_timer_init(&g_sim.lanes[i].timer, sim_pulse_expired, NULL);
+        k_sem_init(&g_sim.lanes[i].done, 0, 1);
+        g_sim.lanes[i].irq_enabled = true;
+    }
+    capture_backend_clear();
+    return 0;
+}
+
+
+void capture_backend_start(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_sim_lock);
+    if (!g_sim.running) {
+        g_sim.start_cycles = sim_cycles();
+        g_sim.running = true;
+        sim_compare_schedule();
+    }
+    k_spin_unlock(&g_sim_lock, key);
+}
+
+
+void capture_backend_stop(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_sim_lock);
+    g_sim.offset = sim_timebase_at(sim_cycles());
+    g_sim.running = false;
+    sim_compare_schedule();
+    k_spin_unlock(&g_sim_lock, key);
+}
+
+
+void capture_backend_clear(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_sim_lock);
+    g_sim.offset = 0;
+    g_sim.start_cycles = sim_cycles();
+    g_sim.compare_armed = false;
+    for (uint8_t i = 0; i < CAPTURE_LANES; i++) {
+        g_sim.lanes[i].capture = 0;
+    }
+    sim_compare_schedule();
+    k_spin_unlock(&g_sim_lock, key);
+}
+
+
+uint32_t capture_backend_now(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_sim_lock);
+    const uint32_t now = sim_timebase_at(sim_cycles());
+    k_spin_unlock(&g_sim_lock, key);
+    return now;
+}
+
+
+uint32_t capture_backend_read(uint8_t lane)
+{
+    return g_sim.lanes[lane].capture;
+}
+
+
+void capture_backend_compare_set(uint32_t tick)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_sim_lock);
+    g_sim.compare_tick = tick;
+    g_sim.compare_armed = true;
+    sim_compare_schedule();
+    k_spin_unlock(&g_sim_lock, key);
+}
+
+
+void capture_backend_compare_disable(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_sim_lock);
+    g_sim.compare_armed = false;
+    sim_compare_schedule();
+    k_spin_unlock(&g_sim_lock, key);
+}
+
+
+bool capture_backend_counter_present(uint8_t lane)
+{
+    return true;
+}
+
+
+uint32_t capture_backend_counter(uint8_t lane, uint8_t cc_channel)
+{
+    struct sim_lane *sim = &g_sim.lanes[lane];
+
+    sim->counter_cc[cc_channel] = sim->counter;
+    return sim->counter_cc[cc_channel];
+}
+
+
+void capture_backend_irq_enable(uint8_t lane, bool enable)
+{
+    g_sim.lanes[lane].irq_enabled = enable;
+}
+
+
+/*Only while no train is playing, the running timebase continues from where it is*/
+void pulse_injector_set_speedup(uint16_t speedup)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_sim_lock);
+    const uint64_t now = sim_cycles();
+
+    g_sim.offset = sim_timebase_at(now);
+    g_sim.start_cycles = now;
+    g_sim.speedup = MAX(speedup, 1);
+    sim_compare_schedule();
+    k_spin_unlock(&g_sim_lock, key);
+}
+
+
+int pulse_injector_play(uint8_t lane, const uint32_t *ticks, uint16_t count)
+{
+    struct sim_lane *sim;
+
+    if (lane >= CAPTURE_LANES || ticks == NULL || count == 0) {
+        return -EINVAL;
+    }
+    sim = &g_sim.lanes[lane];
+    if (sim->ticks != NULL) {
+        return -EBUSY;
+    }
+    k_sem_reset(&sim->done);
+    sim->count = count;
+    sim->next = 0;
+    sim->start_cycles = k_cycle_get_64();
+    sim->ticks = ticks;
+    k_timer_start(&sim->timer, K_NO_WAIT, K_NO_WAIT);
+    LOG_DBG("Lane %d: playing %d pulses at %dx", lane, count, g_sim.speedup);
+    return 0;
+}
+
+
+int pulse_injector_wait(uint8_t lane, k_timeout_t timeout)
+{
+    if (!pulse_injector_busy(lane)) {
+        return 0;
+    }
+    return k_sem_take(&g_sim.lanes[lane].done, timeout);
+}
+
+
+bool pulse_injector_busy(uint8_t lane)
+{
+    return g_sim.lanes[lane].ticks != NULL;
+}
+
+
+void pulse_injector_stop(uint8_t lane)
+{
+    struct sim_lane *sim = &g_sim.lanes[lane];
+
+    k_timer_stop(&sim->timer);
+    if (sim->ticks != NULL) {
+        sim->ticks = NULL;
+        k_sem_give(&sim->done);
+    }
+}
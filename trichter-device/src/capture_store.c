@@ -0,0 +1,268 @@
+#include <stdint.h>
+#include <errno.h>
+#include "capture_store.h"
+
+#define VARINT_MAX_BYTES    5
+
+
+static inline uint32_t zigzag_encode(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static bool varint_read(const uint8_t *data, uint16_t len, uint16_t *offset, uint32_t *value)
+{
+    uint8_t shift = 0;
+    uint8_t byte;
+
+    *value = 0;
+    do
+    {
+        if (*offset >= len)
+        {
+            return false; //truncated entry
+        }
+        byte = data[(*offset)++];
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < (7 * VARINT_MAX_BYTES));
+    return true;
+}
+
+
+void capture_store_reset(struct capture_store *store)
+{
+    store->base = 0;
+    store->last = 0;
+    store->last_delta = 0;
+    store->count = 0;
+    store->used = 0;
+}
+
+
+int capture_store_append(struct capture_store *store, uint32_t tick)
+{
+    if (store->count >= CAPTURE_STORE_MAX_TICKS)
+    {
+        return -ENOMEM;
+    }
+    if (store->count == 0)
+    {
+        store->base = tick;
+        store->last = tick;
+        store->last_delta = 0;
+        store->count = 1;
+        return 0;
+    }
+
+    const uint32_t delta = tick - store->last;
+    uint32_t value = zigzag_encode((int32_t)(delta - store->last_delta));
+    uint8_t encoded[VARINT_MAX_BYTES];
+    uint8_t len = 0;
+
+    do
+    {
+        encoded[len] = value & 0x7F;
+        value >>= 7;
+        if (value != 0)
+        {
+            encoded[len] |= 0x80;
+        }
+        len++;
+    } while (value != 0);
+
+    if (store->used + len > CAPTURE_STORE_BYTES)
+    {
+        return -ENOMEM;
+    }
+    if ((store->count % CAPTURE_STORE_CHECKPOINT_INTERVAL) == 0)
+    {
+        struct capture_checkpoint *cp = &store->checkpoints[store->count / CAPTURE_STORE_CHECKPOINT_INTERVAL];
+        cp->offset = store->used;
+        cp->tick = store->last;
+        cp->delta = store->last_delta;
+    }
+    for (uint8_t i = 0; i < len; i++)
+    {
+        store->data[store->used++] = encoded[i];
+    }
+    store->last = tick;
+    store->last_delta = delta;
+    store->count++;
+    return 0;
+}
+
+
+uint16_t capture_store_count(const struct capture_store *store)
+{
+    return store->count;
+}
+
+
+uint32_t capture_store_last(const struct capture_store *store)
+{
+    return store->last;
+}
+
+
+void capture_store_iter_init(struct capture_store_iter *it, const struct capture_store *store, uint16_t start_idx)
+{
+    uint32_t skip;
+
+    it->store = store;
+    if (start_idx >= CAPTURE_STORE_CHECKPOINT_INTERVAL && start_idx < store->count)
+    {
+        const struct capture_checkpoint *cp = &store->checkpoints[start_idx / CAPTURE_STORE_CHECKPOINT_INTERVAL];
+        it->idx = (start_idx / CAPTURE_STORE_CHECKPOINT_INTERVAL) * CAPTURE_STORE_CHECKPOINT_INTERVAL;
+        it->offset = cp->offset;
+        it->tick = cp->tick;
+        it->delta = cp->delta;
+    } else {
+        it->idx = 0;
+        it->offset = 0;
+        it->tick = store->base;
+        it->delta = 0;
+    }
+
+    skip = start_idx - it->idx;
+    while (skip-- > 0)
+    {
+        uint32_t unused;
+        if (!capture_store_iter_next(it, &unused))
+        {
+            break;
+        }
+    }
+}
+
+
+bool capture_store_iter_next(struct capture_store_iter *it, uint32_t *tick)
+{
+    const struct capture_store *store = it->store;
+
+    if (it->idx >= store->count)
+    {
+        return false;
+    }
+    if (it->idx > 0)
+    {
+        uint32_t value;
+
+        if (!varint_read(store->data, store->used, &it->offset, &value))
+        {
+            return false; //must not happen for a consistent store
+        }
+        it->delta += (uint32_t)zigzag_decode(value);
+        it->tick += it->delta;
+    }
+    *tick = it->tick;
+    it->idx++;
+    return true;
+}
+
+
+uint16_t capture_store_read(const struct capture_store *store, uint16_t start_idx, uint32_t *ticks, uint16_t max_ticks)
+{
+    struct capture_store_iter it;
+    uint16_t num = 0;
+
+    capture_store_iter_init(&it, store, start_idx);
+    while (num < max_ticks && capture_store_iter_next(&it, &ticks[num]))
+    {
+        num++;
+    }
+    return num;
+}
+
+
+uint16_t capture_store_encoded_size(const struct capture_store *store)
+{
+    return (store->count == 0) ? 0 : CAPTURE_STORE_ENCODED_BASE_BYTES + store->used;
+}
+
+
+uint16_t capture_store_encoded_read(const struct capture_store *store, uint16_t offset, uint8_t *buf, uint16_t len)
+{
+    const uint16_t size = capture_store_encoded_size(store);
+    uint16_t num = 0;
+
+    for (; num < len && offset < size; num++, offset++)
+    {
+        if (offset < CAPTURE_STORE_ENCODED_BASE_BYTES)
+        {
+            buf[num] = (uint8_t)(store->base >> (8 * offset));
+        } else {
+            buf[num] = store->data[offset - CAPTURE_STORE_ENCODED_BASE_BYTES];
+        }
+    }
+    return num;
+}
+
+
+uint16_t capture_store_decode(const uint8_t *encoded, uint16_t len, uint32_t *ticks, uint16_t max_ticks)
+{
+    uint16_t offset = CAPTURE_STORE_ENCODED_BASE_BYTES;
+    uint16_t num = 0;
+    uint32_t tick;
+    uint32_t delta = 0;
+    uint32_t value;
+
+    if (len < CAPTURE_STORE_ENCODED_BASE_BYTES || max_ticks == 0)
+    {
+        return 0;
+    }
+    tick = encoded[0] | (encoded[1] << 8) | (encoded[2] << 16) | ((uint32_t)encoded[3] << 24);
+    ticks[num++] = tick;
+    while (num < max_ticks && varint_read(encoded, len, &offset, &value))
+    {
+        delta += (uint32_t)zigzag_decode(value);
+        tick += delta;
+        ticks[num++] = tick;
+    }
+    return num;
+}
+
+
+int capture_store_restore(struct capture_store *store, uint32_t base, uint16_t count, uint16_t used)
+{
+    uint16_t offset = 0;
+    uint32_t value;
+
+    if (count > CAPTURE_STORE_MAX_TICKS || used > CAPTURE_STORE_BYTES || (count == 0 && used != 0))
+    {
+        return -EINVAL;
+    }
+    store->base = base;
+    store->last = base;
+    store->last_delta = 0;
+    store->count = 0;
+    store->used = 0;
+    for (uint16_t idx = 1; idx < count; idx++)
+    {
+        if ((idx % CAPTURE_STORE_CHECKPOINT_INTERVAL) == 0)
+        {
+            struct capture_checkpoint *cp = &store->checkpoints[idx / CAPTURE_STORE_CHECKPOINT_INTERVAL];
+            cp->offset = offset;
+            cp->tick = store->last;
+            cp->delta = store->last_delta;
+        }
+        if (!varint_read(store->data, used, &offset, &value))
+        {
+            return -EINVAL;
+        }
+        store->last_delta += (uint32_t)zigzag_decode(value);
+        store->last += store->last_delta;
+    }
+    if (offset != used)
+    {
+        return -EINVAL;
+    }
+    store->count = count;
+    store->used = used;
+    return 0;
+}
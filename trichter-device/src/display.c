@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include "display.h"
+#include "tm1637.h"
+
+static void display_flush_handler(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(display_flush_work, display_flush_handler);
+
+static struct k_spinlock g_display_lock;
+static struct tm1637_frame g_framebuffer;
+static struct tm1637_frame g_sent;
+static bool g_sent_valid = false;
+static int64_t g_last_flush = 0;
+
+
+static void display_flush_handler(struct k_work *work)
+{
+    struct tm1637_frame frame;
+
+    k_spinlock_key_t key = k_spin_lock(&g_display_lock);
+    frame = g_framebuffer;
+    k_spin_unlock(&g_display_lock, key);
+
+    if (g_sent_valid && memcmp(&frame, &g_sent, sizeof(frame)) == 0)
+    {
+        return; //changed back before the refresh slot came up
+    }
+    g_sent = frame;
+    g_sent_valid = true;
+
+    key = k_spin_lock(&g_display_lock);
+    g_last_flush = k_uptime_get();
+    k_spin_unlock(&g_display_lock, key);
+    tm1637_submit(&frame, NULL, NULL);
+}
+
+
+static void display_post(const struct tm1637_frame *frame)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_display_lock);
+    if (memcmp(frame, &g_framebuffer, sizeof(*frame)) == 0)
+    {
+        k_spin_unlock(&g_display_lock, key);
+        return;
+    }
+    g_framebuffer = *frame;
+    const int64_t next_slot = g_last_flush + DISPLAY_REFRESH_INTERVAL_MS;
+    k_spin_unlock(&g_display_lock, key);
+
+    //does nothing if a flush is already scheduled, it will pick up the new content
+    const int64_t delay = next_slot - k_uptime_get();
+    k_work_schedule(&display_flush_work, (delay > 0) ? K_MSEC(delay) : K_NO_WAIT);
+}
+
+
+void display_digits(const uint8_t digits[], uint8_t num_digits, uint8_t brightness, uint8_t dot_at)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_digits(&frame, digits, num_digits, brightness, dot_at);
+    display_post(&frame);
+}
+
+
+void display_ready(uint8_t brightness)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_ready(&frame, brightness);
+    display_post(&frame);
+}
+
+
+void display_error_message(uint8_t brightness)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_error_message(&frame, brightness);
+    display_post(&frame);
+}
+
+
+void display_bier(uint8_t brightness)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_bier(&frame, brightness);
+    display_post(&frame);
+}
+
+
+void display_cal(uint8_t brightness)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_cal(&frame, brightness);
+    display_post(&frame);
+}
+
+
+void display_off(void)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_off(&frame);
+    display_post(&frame);
+}
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include "end_of_run.h"
+
+
+void end_of_run_init(struct end_of_run *eor, uint32_t min_ticks, uint32_t max_ticks, uint8_t multiple)
+{
+    eor->min_ticks = min_ticks;
+    eor->max_ticks = max_ticks;
+    eor->multiple = multiple;
+    end_of_run_reset(eor);
+}
+
+
+void end_of_run_reset(struct end_of_run *eor)
+{
+    eor->last = 0;
+    eor->srtt = 0;
+    eor->rttvar = 0;
+    eor->pulses = 0;
+    eor->timeout = eor->max_ticks;
+}
+
+
+/*
+Feeds the tick of a new pulse and returns the timeout to arm relative to it.
+Cheap enough for the sensor ISR: a handful of adds and shifts, one multiply.
+*/
+uint32_t end_of_run_update(struct end_of_run *eor, uint32_t tick)
+{
+    const uint32_t interval = tick - eor->last;
+
+    eor->last = tick;
+    if (eor->pulses < UINT16_MAX)
+    {
+        eor->pulses++;
+    }
+    if (eor->pulses == 1)
+    {
+        return eor->timeout; //first pulse of the run, no interval yet
+    }
+    if (interval >= eor->max_ticks)
+    {
+        return eor->timeout; //a gap this long would have ended the run, do not let it skew the estimate
+    }
+    if (eor->srtt == 0)
+    {
+        eor->srtt = interval << 3;
+        eor->rttvar = interval << 1;
+    } else {
+        const int32_t err = (int32_t)interval - (int32_t)(eor->srtt >> 3);
+        const uint32_t abs_err = (err < 0) ? (uint32_t)-err : (uint32_t)err;
+
+        eor->srtt = (uint32_t)((int32_t)eor->srtt + err);
+        eor->rttvar = eor->rttvar + abs_err - (eor->rttvar >> 2);
+    }
+    if (eor->pulses <= END_OF_RUN_MIN_SAMPLES)
+    {
+        return eor->timeout;
+    }
+
+    uint32_t timeout = eor->multiple * (eor->srtt >> 3) + eor->rttvar;
+    if (timeout < eor->min_ticks)
+    {
+        timeout = eor->min_ticks;
+    } else if (timeout > eor->max_ticks) {
+        timeout = eor->max_ticks;
+    }
+    eor->timeout = timeout;
+    return timeout;
+}
+
+
+uint32_t end_of_run_timeout(const struct end_of_run *eor)
+{
+    return eor->timeout;
+}
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <string.h>
+#include "flow_stats.h"
+
+#define FLOW_STATS_CALIBRATION_ML   500 //calibration counts the pulses of this volume
+#define FLOW_STATS_MS_PER_S         1000
+
+
+void flow_stats_reset(struct flow_stats *fs, uint16_t calibration, uint32_t ticks_per_s)
+{
+    memset(fs, 0, sizeof(*fs));
+    fs->calibration = calibration;
+    fs->ticks_per_ms = ticks_per_s / FLOW_STATS_MS_PER_S;
+}
+
+
+/*Rounded to whole ms half up, as the app does with round(tick * tick duration / 1000)*/
+static uint32_t tick_to_ms(const struct flow_stats *fs, uint32_t tick)
+{
+    return (tick + fs->ticks_per_ms / 2) / fs->ticks_per_ms;
+}
+
+
+static uint16_t recent_at(const struct flow_stats *fs, uint32_t index)
+{
+    return fs->recent[index % FLOW_STATS_WINDOW];
+}
+
+
+/*
+Feeds the tick of a new pulse. Every raw flow completes the window of the centre
+FLOW_STATS_HALF_WINDOW intervals before it, which is then smoothed and compared against the peak.
+*/
+void flow_stats_update(struct flow_stats *fs, uint32_t tick)
+{
+    const uint32_t ms = tick_to_ms(fs, tick);
+
+    fs->pulses++;
+    if (fs->pulses == 1)
+    {
+        fs->first = tick;
+        fs->last = tick;
+        fs->last_ms = ms;
+        return;
+    }
+    const uint32_t interval_ms = ms - fs->last_ms;
+    fs->last = tick;
+    fs->last_ms = ms;
+    if (interval_ms == 0 || fs->calibration == 0)
+    {
+        return;
+    }
+
+    const uint32_t flow = (FLOW_STATS_CALIBRATION_ML * FLOW_STATS_MS_PER_S) / (fs->calibration * interval_ms);
+    const uint32_t n = fs->intervals++;
+    if (n >= FLOW_STATS_WINDOW)
+    {
+        fs->recent_sum -= recent_at(fs, n);
+    }
+    fs->recent[n % FLOW_STATS_WINDOW] = (flow > FLOW_STATS_MAX_ML_PER_S) ? FLOW_STATS_MAX_ML_PER_S : flow;
+    fs->recent_sum += recent_at(fs, n);
+
+    if (n >= FLOW_STATS_HALF_WINDOW)
+    {
+        const uint32_t count = (n >= FLOW_STATS_WINDOW - 1) ? FLOW_STATS_WINDOW : n + 1;
+        const uint16_t smoothed = fs->recent_sum / count;
+        if (smoothed > fs->peak)
+        {
+            fs->peak = smoothed;
+        }
+    }
+}
+
+
+/*Flow over the newest intervals, the trailing half of the smoothing window. For the display.*/
+uint16_t flow_stats_current(const struct flow_stats *fs)
+{
+    const uint32_t count = (fs->intervals > FLOW_STATS_HALF_WINDOW + 1) ? FLOW_STATS_HALF_WINDOW + 1 : fs->intervals;
+    uint32_t sum = 0;
+
+    for (uint32_t i = fs->intervals - count; i < fs->intervals; i++)
+    {
+        sum += recent_at(fs, i);
+    }
+    return (count > 0) ? sum / count : 0;
+}
+
+
+uint16_t flow_stats_volume_ml(const struct flow_stats *fs)
+{
+    if (fs->calibration == 0)
+    {
+        return 0;
+    }
+    const uint32_t volume = (fs->pulses * FLOW_STATS_CALIBRATION_ML) / fs->calibration;
+    return (volume > UINT16_MAX) ? UINT16_MAX : volume;
+}
+
+
+/*
+Resolves the centres whose window reaches past the last interval (at most FLOW_STATS_HALF_WINDOW of
+them, clipped at the end of the run) and fills in the summary. Does not modify the running state.
+*/
+void flow_stats_summary(const struct flow_stats *fs, uint32_t ticks_per_ms, struct flow_summary *summary)
+{
+    const uint32_t n = fs->intervals;
+    uint16_t peak = fs->peak;
+
+    for (uint32_t centre = (n > FLOW_STATS_HALF_WINDOW) ? n - FLOW_STATS_HALF_WINDOW : 0; centre < n; centre++)
+    {
+        const uint32_t from = (centre > FLOW_STATS_HALF_WINDOW) ? centre - FLOW_STATS_HALF_WINDOW : 0;
+        uint32_t sum = 0;
+        for (uint32_t i = from; i < n; i++)
+        {
+            sum += recent_at(fs, i);
+        }
+        const uint16_t smoothed = sum / (n - from);
+        if (smoothed > peak)
+        {
+            peak = smoothed;
+        }
+    }
+
+    summary->pulses = (fs->pulses > UINT16_MAX) ? UINT16_MAX : fs->pulses;
+    summary->volume_ml = flow_stats_volume_ml(fs);
+    summary->duration_ms = (fs->pulses > 0) ? (fs->last - fs->first) / ticks_per_ms : 0;
+    const uint32_t avg = (summary->duration_ms > 0) ? ((uint32_t)summary->volume_ml * 1000) / summary->duration_ms : 0;
+    summary->avg_ml_per_s = (avg > UINT16_MAX) ? UINT16_MAX : avg;
+    summary->peak_ml_per_s = (fs->pulses >= FLOW_STATS_MIN_PULSES) ? peak : 0;
+}
@@ -2,6 +2,10 @@
 #include <zephyr/kernel.h>
 #include "state_machine.h"
 #include "fsm_core.h"
+#include <zephyr/logging/log.h>
+#include "log_hot.h"
+
+LOG_MODULE_REGISTER(fsm_core, CONFIG_TRICHTER_FSM_LOG_LEVEL);
 
 
 #define STATE_MACHINE_THREAD_PRIO			3
@@ -14,6 +18,8 @@ StateMachine_t g_stateMachine;
 K_THREAD_STACK_DEFINE(state_machine_stack, STATE_MACHINE_THREAD_STACK_SIZE);
 static struct k_thread state_machine_thread_data;
 
+K_MSGQ_DEFINE(fsm_request_queue, sizeof(uint8_t), FSM_REQUEST_QUEUE_DEPTH, 1);
+
 extern uint8_t IdleEntry(void);
 extern uint8_t IdleRun(void);
 extern uint8_t IdleExit(void);
@@ -47,7 +53,7 @@ const State_t STATES[NUM_STATES + 1] = {
         .onEntry = ReadyEntry,
         .runLoop = ReadyRun,
         .onExit = ReadyExit,
-        .allowedTransitions = {STATE_RUNNING, STATE_IDLE, STATE_CALIBRATING, STATE_MAX, STATE_MAX}
+        .allowedTransitions = {STATE_RUNNING, STATE_IDLE, STATE_CALIBRATING, STATE_ERROR, STATE_MAX}
     },
     [STATE_RUNNING] = {
         .id = STATE_RUNNING,
@@ -61,7 +67,7 @@ const State_t STATES[NUM_STATES + 1] = {
         .onEntry = SendingEntry,
         .runLoop = SendingRun,
         .onExit = SendingExit,
-        .allowedTransitions = {STATE_ERROR, STATE_READY, STATE_MAX, STATE_MAX, STATE_MAX}
+        .allowedTransitions = {STATE_ERROR, STATE_READY, STATE_RUNNING, STATE_MAX, STATE_MAX}
     },
     [STATE_CALIBRATING] = {
         .id = STATE_CALIBRATING,
@@ -80,67 +86,207 @@ const State_t STATES[NUM_STATES + 1] = {
 };
 
 
+static void fsm_post_event(StateMachine_t *sm, uint8_t event);
+static void fsm_reschedule(StateMachine_t *sm);
+
+
+#ifdef CONFIG_TRICHTER_FSM_TIMING
+/*Logs a transition or runLoop that took longer than any before it, cycles from k_cycle_get_32()*/
+static void fsm_timing_record(const StateMachine_t *sm, uint32_t *max_cycles, uint32_t start, const char *what)
+{
+    const uint32_t cycles = k_cycle_get_32() - start;
+
+    if (cycles > *max_cycles)
+    {
+        *max_cycles = cycles;
+        LOG_INF("%s: slowest %s so far, %d us in state %d", sm->name, what, k_cyc_to_us_floor32(cycles), sm->current->id);
+    }
+}
+#endif
+
+
 static uint8_t fsm_transition_internal(StateMachine_t *sm, StateID_t targetState)
 {
     uint8_t ret = ERR_NONE;
     k_mutex_lock(&sm->lock, K_FOREVER);
-    printk("%s: Requested transition from %d to %d\n", sm->name, sm->current->id, targetState);
+    LOG_HOT_DBG("%s: Requested transition from %d to %d", sm->name, sm->current->id, targetState);
+    const State_t *previous = sm->current;
+    const int64_t timeout_at = sm->timeoutAt;
+    sm->timeoutAt = 0; //state timeouts belong to the state that armed them, onEntry may arm a new one
+#ifdef CONFIG_TRICHTER_FSM_TIMING
+    const uint32_t start = k_cycle_get_32();
     ret = state_machine_transition(sm, targetState);
+    fsm_timing_record(sm, &sm->maxTransitionCycles, start, "transition");
+#else
+    ret = state_machine_transition(sm, targetState);
+#endif
+    if (sm->current == previous)
+    {
+        sm->timeoutAt = timeout_at;
+    }
     k_mutex_unlock(&sm->lock);
 
     if (ret != ERR_NONE && ret != ERR_TRANSITION_FORBIDDEN) //on invalid transitions, simply do not do anything
     {
         k_mutex_lock(&sm->lock, K_FOREVER);
-        ret = state_machine_transition(sm, STATE_ERROR);
-        sm->requestStateDeferred = STATE_MAX; //Clear any pending deferred requests
+        ret = state_machine_transition(sm, sm->errorState);
+        sm->timeoutAt = 0;
+        k_msgq_purge(sm->requests); //Clear any pending deferred requests
         k_mutex_unlock(&sm->lock);
     }
+    fsm_reschedule(sm);
     return ret;
 }
 
+
+/*
+Multi-producer entry point, callable from ISRs, work items and other threads.
+Requests are handled in order; a request identical to the newest still pending one is coalesced.
+*/
+static uint8_t fsm_post(StateMachine_t *sm, uint8_t event)
+{
+    uint8_t ret = ERR_NONE;
+    unsigned int key = irq_lock();
+    if (event == sm->lastRequest && k_msgq_num_used_get(sm->requests) > 0)
+    {
+        ret = ERR_NONE;
+    } else if (k_msgq_put(sm->requests, &event, K_NO_WAIT) != 0)
+    {
+        ret = ERR_API;
+    } else {
+        sm->lastRequest = event;
+    }
+    irq_unlock(key);
+    return ret;
+}
+
+
+static void fsm_post_event(StateMachine_t *sm, uint8_t event)
+{
+    if (sm->requests != NULL)
+    {
+        fsm_post(sm, event);
+    }
+}
+
+
+/*
+Lets the engine pick up a new period or state timeout. The engine computes its next wake up after
+every event anyway, so only changes made from other threads need one.
+*/
+static void fsm_reschedule(StateMachine_t *sm)
+{
+    if (k_current_get() != sm->engine)
+    {
+        fsm_post_event(sm, FSM_EVENT_RESCHEDULE);
+    }
+}
+
+
 static uint8_t fsm_transition_deferred_internal(StateMachine_t *sm, StateID_t state)
 {
-    if (sm->current->id == STATE_ERROR)
+    if (sm->current->id == sm->errorState)
     {
         return ERR_TRANSITION_FORBIDDEN;
     };
-    sm->requestStateDeferred = state;
-    return ERR_NONE;
+    uint8_t ret = fsm_post(sm, state);
+    if (ret != ERR_NONE)
+    {
+        LOG_ERR("%s: request queue full, dropped request for %d", sm->name, state);
+    }
+    return ret;
 }
 
 
-void fsm_main(void *p1, void *p2, void *p3)
+static k_timeout_t fsm_next_timeout(const StateMachine_t *sm, int64_t next_run)
 {
-    uint8_t ret = ERR_NONE;
-    while (g_fsm_run)
+    int64_t due = INT64_MAX;
+    if (sm->period_ms != FSM_PERIOD_NONE)
     {
-        k_mutex_lock(&g_stateMachine.lock, K_FOREVER);
-        ret = g_stateMachine.current->runLoop();
-        k_mutex_unlock(&g_stateMachine.lock);
+        due = next_run;
+    }
+    if (sm->timeoutAt != 0 && sm->timeoutAt < due)
+    {
+        due = sm->timeoutAt;
+    }
+    if (due == INT64_MAX)
+    {
+        return K_FOREVER;
+    }
+    int64_t remaining = due - k_uptime_get();
+    return (remaining > 0) ? K_MSEC(remaining) : K_NO_WAIT;
+}
+
+
+/*
+Event driven engine: the thread sleeps until a request is posted, the runLoop period of the current
+state elapses or the state timeout is due. States with period FSM_PERIOD_NONE never poll.
+*/
+void fsm_engine_run(StateMachine_t *sm, uint8_t *run)
+{
+    uint8_t ret = ERR_NONE;
+    uint8_t event;
+    const State_t *scheduled_state = sm->current;
+    int64_t next_run = k_uptime_get() + sm->period_ms;
 
-        if (ret != ERR_NONE)
+    sm->engine = k_current_get();
+    while (*run)
+    {
+        if (k_msgq_get(sm->requests, &event, fsm_next_timeout(sm, next_run)) == 0)
+        {
+            if (event != FSM_EVENT_RESCHEDULE)
+            {
+                fsm_transition_internal(sm, (StateID_t)event);
+            }
+        } else if (sm->timeoutAt != 0 && k_uptime_get() >= sm->timeoutAt)
         {
-            fsm_transition(STATE_ERROR);
-            g_fsm_run = 0;
-        } else if (g_stateMachine.requestStateDeferred != STATE_MAX)
+            sm->timeoutAt = 0;
+            fsm_transition_internal(sm, sm->timeoutTarget);
+        } else {
+            k_mutex_lock(&sm->lock, K_FOREVER);
+#ifdef CONFIG_TRICHTER_FSM_TIMING
+            const uint32_t start = k_cycle_get_32();
+            ret = sm->current->runLoop();
+            fsm_timing_record(sm, &sm->maxRunCycles, start, "runLoop");
+#else
+            ret = sm->current->runLoop();
+#endif
+            k_mutex_unlock(&sm->lock);
+
+            if (ret != ERR_NONE)
+            {
+                fsm_transition_internal(sm, sm->errorState);
+                *run = 0;
+            }
+            next_run = k_uptime_get() + sm->period_ms;
+        }
+
+        if (sm->current != scheduled_state)
         {
-            fsm_transition(g_stateMachine.requestStateDeferred);
-            unsigned int key = irq_lock(); //Do not allow interrupts to request deferred
-            g_stateMachine.requestStateDeferred = STATE_MAX;
-            irq_unlock(key);
+            scheduled_state = sm->current;
+            next_run = k_uptime_get() + sm->period_ms;
         }
-        k_msleep(g_stateMachine.period_ms);
     }
 }
 
 
+void fsm_main(void *p1, void *p2, void *p3)
+{
+    fsm_engine_run(&g_stateMachine, &g_fsm_run);
+}
+
+
 void fsm_start()
 {
     k_mutex_init(&g_stateMachine.lock);
     g_stateMachine.current = &STATES[STATE_IDLE];
     g_stateMachine.error = ERR_NONE;
     g_stateMachine.period_ms = FSM_PERIOD_FAST_MS;
-    g_stateMachine.requestStateDeferred = STATE_MAX;
+    g_stateMachine.errorState = STATE_ERROR;
+    g_stateMachine.requests = &fsm_request_queue;
+    g_stateMachine.lastRequest = FSM_EVENT_RESCHEDULE;
+    g_stateMachine.timeoutAt = 0;
+    g_stateMachine.timeoutTarget = STATE_MAX;
     g_stateMachine.name = "Main FSM";
     g_stateMachine.states = STATES;
     g_stateMachine.num_states = NUM_STATES;
@@ -150,6 +296,18 @@ void fsm_start()
 }
 
 
+/*
+Requests a transition to target once the current state has been active for timeout_ms.
+Cancelled automatically when the state is left earlier. Meant to be called from onEntry.
+*/
+void fsm_state_timeout(StateMachine_t *sm, uint32_t timeout_ms, StateID_t target)
+{
+    sm->timeoutTarget = target;
+    sm->timeoutAt = k_uptime_get() + timeout_ms;
+    fsm_reschedule(sm);
+}
+
+
 uint8_t fsm_transition(StateID_t targetState)
 {
     return fsm_transition_internal(&g_stateMachine, targetState);
@@ -1,13 +1,14 @@
-#include <hal/nrf_gpio.h>
 #include "zephyr/drivers/gpio.h"
-#include <hal/nrf_timer.h>
 #include "zephyr/kernel.h"
-#include <helpers/nrfx_gppi.h>
 #include "runtime.h"
 #include "fsm_core.h"
 #include "devicetree_devices.h"
 #include "zephyr/kernel.h"
 #include "zephyr/sys/clock.h"
+#include <zephyr/logging/log.h>
+#include "log_hot.h"
+
+LOG_MODULE_REGISTER(inputs, CONFIG_TRICHTER_RUNTIME_LOG_LEVEL);
 
 #define LONG_CLICK_TIME_MS          4000
 #define DOUBLE_CLICK_TIMEOUT_MS     350
@@ -28,19 +29,16 @@ K_WORK_DELAYABLE_DEFINE(debounce_work, debounce_work_handler);
 K_WORK_DELAYABLE_DEFINE(long_click_work, long_click_work_handler);
 K_WORK_DELAYABLE_DEFINE(double_click_debounce_work, double_click_debounce_handler);
 
-static nrfx_gppi_handle_t ppi_channel;
-static uint8_t gpiote_in_channel;
-
 /*
 static void ready_button_pressed_handler()
 {
-	printk("Button pressed at %lldms\n", k_uptime_get());
+	LOG_INF("Button pressed at %lldms", k_uptime_get());
 	if ((k_uptime_get() - g_ready_button.last_timestamp_ready_button) <= DEBOUNCE_CLICK_MS) return;
 
 	g_ready_button.num_clicks++;
 	if (g_ready_button.num_clicks == 1)
 	{
-		printk("Go to READY\n");
+		LOG_INF("Go to READY");
     	fsm_transition_deferred(STATE_READY);
 		if (!k_work_is_pending(&double_click_timer_work))
 		{
@@ -48,7 +46,7 @@ static void ready_button_pressed_handler()
 		}
 	} else if (g_ready_button.num_clicks == 2)
 	{
-		printk("Button pressed again. Start advertising\n");
+		LOG_INF("Button pressed again. Start advertising");
     	g_advertise_in_ready = true;
 		g_ready_button.num_clicks = 0;
 		k_timer_stop(&click_timer);
@@ -117,23 +115,23 @@ static void ready_button_cooldown_expired(struct k_work *work)
 
 uint8_t setup_isr_for_gpio_in(const struct gpio_dt_spec *input, struct gpio_callback *cb , gpio_callback_handler_t handler, unsigned long flags)
 {
-	nrfx_err_t err;
+	int err;
 
 	err = gpio_pin_configure_dt(input, GPIO_INPUT);
 	if (err) {
-		printk("ERROR: GPIO input could not be set");
+		LOG_ERR("GPIO input could not be set");
 		return err;
 	}
 	err = gpio_pin_interrupt_configure(input->port, input->pin, flags);
 	if (err) {
-		printk("ERROR: GPIO interrupt flags could not be set");
+		LOG_ERR("GPIO interrupt flags could not be set");
 		return err;
 	}
 	gpio_init_callback(cb, handler, BIT(input->pin));
 	
 	err = gpio_add_callback(input->port, cb);
     if (err) {
-        printk("ERROR: Add interrupt failed\n");
+        LOG_ERR("Add interrupt failed");
         gpio_pin_interrupt_configure(input->port, input->pin, GPIO_INT_DISABLE);
         return err;
     }
@@ -141,65 +139,11 @@ uint8_t setup_isr_for_gpio_in(const struct gpio_dt_spec *input, struct gpio_call
 }
 
 
-static void setup_ppi_for_sensor(const struct gpio_dt_spec *sensor)
-{
-    nrfx_err_t err;
-    static nrfx_gpiote_t gpiote = NRFX_GPIOTE_INSTANCE(NRF_GPIOTE);
-
-	if (false == nrfx_gpiote_init_check(&gpiote))
-	{
-		err = nrfx_gpiote_init(&gpiote, 0);
-		if (err != 0) {
-			printk("GPIOTE init failed: %08x\n", err);
-			return;
-		}
-	}
-    // Allocate GPIOTE channel
-    err = nrfx_gpiote_channel_alloc(&gpiote, &gpiote_in_channel);
-    if (err != 0) {
-        printk("GPIOTE channel alloc failed: %08x\n", err);
-        return;
-    }
-
-    // Configure input pin
-    nrfx_gpiote_trigger_config_t trigger_config = {
-        .trigger = NRFX_GPIOTE_TRIGGER_LOTOHI,
-        .p_in_channel = &gpiote_in_channel,
-    };
-    
-    nrfx_gpiote_input_pin_config_t input_config = {
-        .p_pull_config = NULL,  // Use existing pull config
-        .p_trigger_config = &trigger_config,
-        .p_handler_config = NULL 
-    };
-
-    err = nrfx_gpiote_input_configure(&gpiote, sensor->pin, &input_config);
-    if (err != 0) {
-        printk("GPIOTE input config failed: %08x\n", err);
-        return;
-    }
-	nrfx_gpiote_trigger_enable(&gpiote, sensor->pin, false);
-	
-    uint32_t eep = nrf_gpiote_event_address_get(NRF_GPIOTE, nrfx_gpiote_in_event_get(&gpiote, sensor->pin));
-    uint32_t tep = nrf_timer_task_address_get(NRF_TIMER2, NRF_TIMER_TASK_CAPTURE1);
-
-	printk("EVENT addr IN : %08x; OUT : %08x\n", eep, tep);
-
-    err = nrfx_gppi_conn_alloc(eep, tep, &ppi_channel);
-    if (err != 0) {
-        printk("GPPI conn alloc failed: 0x%08x\n", err);
-        return;
-    }
-
-    // Enable the connection (replaces nrfx_gppi_channels_enable(BIT(channel)))
-    nrfx_gppi_conn_enable(ppi_channel);
-}
-
 #ifndef CONFIG_BUTTONLESS
 void ready_button_isr(const struct device *dev, struct gpio_callback *cb,
 		    uint32_t pins)
 {
-	printk("Button pressed at %d, level %d...\n", k_cycle_get_32(), gpio_pin_get_dt(&button_ready));
+	LOG_HOT_DBG("Button pressed at %d, level %d...", k_cycle_get_32(), gpio_pin_get_dt(&button_ready));
     k_work_reschedule(&debounce_work, READY_DEBOUNCE_PERIOD_MS);
 }
 #endif
@@ -212,14 +156,12 @@ uint8_t init_gpio_inputs()
     #ifndef CONFIG_BUTTONLESS
     ret = setup_isr_for_gpio_in(&button_ready, &button_cb_data_1, ready_button_isr, GPIO_INT_EDGE_BOTH);
     #endif
-	ret |= setup_isr_for_gpio_in(&button_test_sensor, &button_cb_data_2, sensor_triggered_isr, GPIO_INT_EDGE_RISING); //sensor triggered ISR in runtime.h
-	setup_ppi_for_sensor(&button_test_sensor);
 
 	if (ret != 0)
 	{
-		printk("Error %d: failed to configure GPIO inputs\n", ret);
+		LOG_ERR("Error %d: failed to configure GPIO inputs", ret);
 	} else {
-		printk("Set up All GPIO Inputs successfully");
+		LOG_DBG("Set up All GPIO Inputs successfully");
 	}
 	return ret;
 }
@@ -231,7 +173,7 @@ void init_gpio_outputs()
     int ret = 0;
 	if (led.port && !gpio_is_ready_dt(&led))
     {
-		printk("Error %d: LED device %s is not ready; ignoring it\n", ret, led.port->name);
+		LOG_ERR("Error %d: LED device %s is not ready; ignoring it", ret, led.port->name);
 		led.port = NULL;
 	}
 	if (led.port)
@@ -239,10 +181,10 @@ void init_gpio_outputs()
 		ret = gpio_pin_configure_dt(&led, GPIO_OUTPUT);
 		if (ret != 0)
         {
-			printk("Error %d: failed to configure LED device %s pin %d\n", ret, led.port->name, led.pin);
+			LOG_ERR("Error %d: failed to configure LED device %s pin %d", ret, led.port->name, led.pin);
 			led.port = NULL;
 		} else {
-			printk("Set up LED at %s pin %d\n", led.port->name, led.pin);
+			LOG_DBG("Set up LED at %s pin %d", led.port->name, led.pin);
             gpio_pin_set_dt(&led, 1);
 		}
 	}
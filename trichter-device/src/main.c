@@ -23,6 +23,7 @@
 #include "fsm_core.h"
 #include "bluetooth.h"
 #include "memory.h"
+#include "session_log.h"
 
 // void print_thread_priorities(void)
 // {
@@ -49,9 +50,11 @@
 int main(void)
 {
 	init_seven_seg();
+	capture_lanes_init();
 	init_gpio_inputs();
 	init_gpio_outputs();
     init_memory_nv();
+    session_log_init();
 	init_ble(TIMER_TICK_DURATION_US);
     /*register callbacks and handlers*/
     ble_register_state_input_handler(ble_remote_state_dispatch);
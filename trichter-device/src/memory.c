@@ -2,6 +2,9 @@
 #include <zephyr/storage/flash_map.h>
 #include <zephyr/fs/nvs.h>
 #include "memory.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(memory, CONFIG_TRICHTER_MEMORY_LOG_LEVEL);
 
 
 static struct nvs_fs fs;
@@ -21,22 +24,22 @@ int initialize_and_mount_fs(struct nvs_fs *filesys, const struct device *device,
 
     filesys->flash_device = device;
     if (!device_is_ready(filesys->flash_device)) {
-        printk("Flash device %s is not ready\n", filesys->flash_device->name);
+        LOG_ERR("Flash device %s is not ready", filesys->flash_device->name);
         return 1;
 	}
 	filesys->offset = offset;
-	printk("%s: Offset = 0x%08x, partition size = %d\n", filesys->flash_device->name, offset, partition_size);
+	LOG_INF("%s: Offset = 0x%08x, partition size = %d", filesys->flash_device->name, offset, partition_size);
 	err = flash_get_page_info_by_offs(filesys->flash_device, filesys->offset, &info);
 	if (err) {
-		printk("Unable to get page info, rc=%d\n", err);
+		LOG_ERR("Unable to get page info, rc=%d", err);
 		return 1;
 	}
 	filesys->sector_size = info.size;
 	filesys->sector_count =  (uint16_t)(partition_size / filesys->sector_size);
-	printk("Flash device %s is ready and will be mounted now with sector_size = %d and sector_count = %d\n", filesys->flash_device->name, filesys->sector_size, filesys->sector_count);
+	LOG_INF("Flash device %s is ready and will be mounted now with sector_size = %d and sector_count = %d", filesys->flash_device->name, filesys->sector_size, filesys->sector_count);
 	err = nvs_mount(filesys);
 	if (err) {
-		printk("Flash Init failed, rc=%d\n", err);
+		LOG_ERR("Flash Init failed, rc=%d", err);
 		return 1;
 	}
 	return 0;
@@ -55,9 +58,9 @@ int init_memory_nv()
     err = nvs_read(&fs, CALIBRATION_VALUE_ID, &global_calibration_value, sizeof(global_calibration_value));
 	if (err > 0)
     { 
-		printk("Found NV Data with Id: %d, Value: %d\n", CALIBRATION_VALUE_ID, global_calibration_value);
+		LOG_INF("Found NV Data with Id: %d, Value: %d", CALIBRATION_VALUE_ID, global_calibration_value);
 	} else {/* item was not found, add it */
-		printk("No value found for NV ID %d\n, defaulting to 300", CALIBRATION_VALUE_ID);
+		LOG_WRN("No value found for NV ID %d, defaulting to 300", CALIBRATION_VALUE_ID);
         global_calibration_value = 300;
         return 0;
 	}
@@ -77,4 +80,16 @@ int read_counter_from_rom(uint16_t *counter_value)
 	err = nvs_read(&fs, CALIBRATION_VALUE_ID, &global_calibration_value, sizeof(global_calibration_value));
 	*counter_value = (uint16_t)global_calibration_value;
 	return err;
-}
\ No newline at end of file
+}
+
+
+int memory_read_value(uint16_t id, void *data, size_t len)
+{
+	return nvs_read(&fs, id, data, len);
+}
+
+
+int memory_write_value(uint16_t id, const void *data, size_t len)
+{
+	return nvs_write(&fs, id, data, len);
+}
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <zephyr/sys/barrier.h>
+#include "pulse_ring.h"
+
+
+bool pulse_ring_push(struct pulse_ring *ring, uint32_t value)
+{
+    const uint32_t head = ring->head;
+
+    if ((head - ring->tail) >= PULSE_RING_SIZE)
+    {
+        ring->dropped++;
+        return false;
+    }
+    ring->buf[head & PULSE_RING_MASK] = value;
+    barrier_dmem_fence_full(); //value must be visible before the consumer sees the new head
+    ring->head = head + 1;
+    return true;
+}
+
+
+uint32_t pulse_ring_produced(const struct pulse_ring *ring)
+{
+    return ring->head;
+}
+
+
+bool pulse_ring_pop(struct pulse_ring *ring, uint32_t *value)
+{
+    const uint32_t tail = ring->tail;
+
+    if (tail == ring->head)
+    {
+        return false;
+    }
+    barrier_dmem_fence_full(); //do not read the slot before head was observed
+    *value = ring->buf[tail & PULSE_RING_MASK];
+    barrier_dmem_fence_full(); //slot must be read before the producer may reuse it
+    ring->tail = tail + 1;
+    return true;
+}
+
+
+/*
+Discards everything before sequence number seq. Used by the consumer to drop stale pulses of a
+previous run without having to touch producer state.
+*/
+void pulse_ring_skip_to(struct pulse_ring *ring, uint32_t seq)
+{
+    const uint32_t head = ring->head;
+
+    if ((int32_t)(seq - head) > 0)
+    {
+        seq = head;
+    }
+    if ((int32_t)(seq - ring->tail) > 0)
+    {
+        barrier_dmem_fence_full();
+        ring->tail = seq;
+    }
+}
+
+
+uint32_t pulse_ring_available(const struct pulse_ring *ring)
+{
+    return ring->head - ring->tail;
+}
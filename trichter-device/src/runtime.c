@@ -1,18 +1,11 @@
 
 #include <stdint.h>
-#include <hal/nrf_gpio.h>
-#include <hal/nrf_gpiote.h>
-#include <gpiote_nrfx.h>
-#include <hal/nrf_timer.h>
-#include <zephyr/drivers/counter.h>
-#include <nrfx_gpiote.h>
+#include <string.h>
 #include <zephyr/irq.h>
-#include <helpers/nrfx_gppi.h>
 #include "runtime.h"
-#include "drivers/nrfx_errors.h"
-#include "mdk/nrf52.h"
 #include "state_machine.h"
 #include "tm1637.h"
+#include "display.h"
 #include "devicetree_devices.h"
 #include "fsm_core.h"
 #include "bluetooth.h"
@@ -20,96 +13,546 @@
 #include "zephyr/drivers/gpio.h"
 #include "zephyr/kernel.h"
 #include "bluetooth_advertising.h"
+#include "ble_link.h"
+#include "pulse_ring.h"
+#include "capture_store.h"
+#include "session.h"
+#include "session_pool.h"
+#include "end_of_run.h"
+#include "flow_stats.h"
+#include "capture_backend.h"
+#include <zephyr/logging/log.h>
+#include "log_hot.h"
+
+LOG_MODULE_REGISTER(runtime, CONFIG_TRICHTER_RUNTIME_LOG_LEVEL);
 
-#define TICKS_PER_LTR 300
-static volatile uint32_t g_timestamps[TICKS_PER_LTR];
-static volatile uint16_t g_timestamp_idx_to_write = 0;
+/*
+One sensor input. The sensor ISR of a lane only pushes into the lane's ring, the FSM thread is the
+single consumer and drains it into the lane's session, so nobody has to lock interrupts to read the
+timestamps. All lanes capture on the same timebase of the capture backend, which is what makes a race fair.
+*/
+struct capture_lane {
+	uint8_t id;
+	struct pulse_ring ring;
+	volatile bool running;				//from the first pulse until the race is over or the burst was rejected
+	volatile bool timed_out;			//end of run reached, later pulses wait for the next race
+	volatile uint32_t runs;				//bumped by every started or rejected run, the consumer restarts the session
+	volatile uint32_t run_start_seq;	//ring sequence number of the first pulse of the current run
+	volatile uint32_t run_hw_base;		//pulses seen right before the current run, see lane_pulses_seen()
+	struct end_of_run end_of_run;		//fed by the capture path, see end_of_run_arm()
+	uint32_t deadline;					//last capture + end of run timeout
+	struct k_work_delayable qualification_work;
+	uint32_t session_run;				//run the session currently belongs to
+	struct session *session;			//capture slot, handed to the BLE sender when the race is done
+	uint32_t session_overflow;
+	struct flow_stats flow_stats;		//analytics of the current run, updated with every drained pulse
+	bool finished;						//took part in the race that just ended, set by RunningExit
+};
+
+static struct capture_lane g_lanes[CAPTURE_LANES];
+static volatile bool g_timebase_running = false;	//the timebase runs from the first pulse of any lane until the race is over
+static uint16_t g_live_next = 0;				//first pulse of lane 0 not handed to the live stream yet
+static int64_t g_live_batch_at = 0;				//uptime of the last live batch
+
+BUILD_ASSERT(CAPTURE_LANES <= CAPTURE_BACKEND_MAX_LANES, "one capture register per lane");
+BUILD_ASSERT(SESSION_POOL_SLOTS > CAPTURE_LANES, "every lane captures into its own slot while another one is sent");
 
 #define TIMER_VALUE_MAX 				0xFFFFFFFF
 
+#if defined(CONFIG_TRICHTER_HW_END_OF_RUN) && !defined(CONFIG_TRICHTER_CAPTURE_ISR_LIGHT)
+#define RUN_PERIOD_MS					FSM_PERIOD_DISPLAY_MS //only the display needs the FSM during a run
+#else
+#define RUN_PERIOD_MS					FSM_PERIOD_FAST_MS
+#endif
+
 #define ADV_BLINK_TIME_MS				1500
 //#define PRINT_TIMESTAMPS_IN_CONSOLE
 #define READY_MODE_TIMEOUT_SEC			900 //15min timeout
+#define SENDING_TIMEOUT_SEC				30
+#define SENDING_NO_RESULT_MS			3000 //error shown before READY when no lane has a session to report
 
 static uint64_t last_timestamp_blink = 0;
-static uint8_t is_running = false;
 static uint8_t party_mode = false;
 static bool g_valid_calibration = false;
 #define SENSOR_QUALIFICATION_BURST_WINDOW_MS	K_MSEC(150)
 #define MIN_TIMESTAMPS_IN_BURST_WINDOW			3
 
-static bool start_sent = false;
+static void sensor_qualification_handler(struct k_work *work);
 
-static K_TIMER_DEFINE(fsm_timer, NULL, NULL);
+static CalibrationAttempt g_calib_attempt_notifier;
 
-static void sensor_qualification_handler(struct k_work *work);
-K_WORK_DELAYABLE_DEFINE(sensor_qualification_work, sensor_qualification_handler);
 
+static void timebase_stop()
+{
+	capture_backend_stop();
+	g_timebase_running = false; //the next first pulse resets and restarts it
+}
 
-void timer_reset();
 
-static CalibrationAttempt g_calib_attempt_notifier;
+/*
+Moves the compare channel to the earliest deadline of all lanes still running, so the compare event
+fires exactly when the next lane is done, without the FSM having to poll for it.
+*/
+static void end_of_run_schedule()
+{
+	#ifdef CONFIG_TRICHTER_HW_END_OF_RUN
+	const struct capture_lane *next = NULL;
+	unsigned int key = irq_lock(); //armed from the sensor ISR, the compare ISR and the FSM thread
+
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
+	{
+		const struct capture_lane *lane = &g_lanes[i];
+		if (lane->running && !lane->timed_out &&
+			(next == NULL || (int32_t)(lane->deadline - next->deadline) < 0))
+		{
+			next = lane;
+		}
+	}
+	if (next != NULL)
+	{
+		capture_backend_compare_set(next->deadline);
+	} else {
+		capture_backend_compare_disable();
+	}
+	irq_unlock(key);
+	#endif
+}
+
+
+/*Every captured pulse updates the interval estimate of its lane and moves the lane's deadline*/
+static void end_of_run_arm(struct capture_lane *lane, uint32_t last_capture)
+{
+	lane->deadline = last_capture + end_of_run_update(&lane->end_of_run, last_capture);
+	end_of_run_schedule();
+}
+
+
+static void end_of_run_disarm(void)
+{
+	#ifdef CONFIG_TRICHTER_HW_END_OF_RUN
+	capture_backend_compare_disable();
+	#endif
+}
+
+
+/*Marks every running lane whose deadline passed at now as done*/
+static void lanes_expire(uint32_t now)
+{
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
+	{
+		struct capture_lane *lane = &g_lanes[i];
+		if (lane->running && !lane->timed_out && (int32_t)(now - lane->deadline) >= 0)
+		{
+			lane->timed_out = true;
+		}
+	}
+}
+
+
+static bool race_running()
+{
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
+	{
+		if (g_lanes[i].running)
+		{
+			return true;
+		}
+	}
+	return false;
+}
 
 
-void sensor_triggered_isr(const struct device *dev, struct gpio_callback *cb, unsigned int pins)
+/*The race is over once every lane that started reached its end of run*/
+static void race_check_over()
 {
-	if (!is_running)
+	if (!race_running())
+	{
+		return;
+	}
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
 	{
-		timer_reset();
-		nrf_timer_task_trigger(NRF_TIMER2, NRF_TIMER_TASK_START); //starts timer in free running mode
-		k_work_schedule(&sensor_qualification_work, SENSOR_QUALIFICATION_BURST_WINDOW_MS);
-		is_running = true;
+		if (g_lanes[i].running && !g_lanes[i].timed_out)
+		{
+			return;
+		}
 	}
-	if (g_timestamp_idx_to_write < TICKS_PER_LTR && is_running)
+	if (g_stateMachine.current->id == STATE_CALIBRATING)
 	{
-		g_timestamps[g_timestamp_idx_to_write] = nrf_timer_cc_get(NRF_TIMER2, 1); //Read value on channel 1
-		printk("Sensor pressed at %d\n", g_timestamps[g_timestamp_idx_to_write]);
-		g_timestamp_idx_to_write++;
+		fsm_transition_deferred(STATE_READY);
+	} else {
+		fsm_transition_deferred(STATE_SENDING);
 	}
 }
 
 
+/*Compare of the capture backend, fires at the earliest deadline*/
+static void end_of_run_isr(void)
+{
+	lanes_expire(capture_backend_now()); //also catches a second lane whose deadline passed already
+	end_of_run_schedule();
+	race_check_over();
+}
 
-void reset_sensor_run_state()
+
+/*Pulses the lane has seen: the hardware counter where there is one, otherwise what reached the ring*/
+static uint32_t lane_pulses_seen(const struct capture_lane *lane, uint8_t cc_channel)
+{
+	if (capture_backend_counter_present(lane->id))
+	{
+		return capture_backend_counter(lane->id, cc_channel);
+	}
+	return pulse_ring_produced(&lane->ring) + lane->ring.dropped;
+}
+
+
+static void sensor_triggered_isr(uint8_t lane_id)
 {
-    is_running = false;
-    k_work_cancel_delayable(&sensor_qualification_work);
-    g_valid_calibration = false;
+	struct capture_lane *lane = &g_lanes[lane_id];
+	uint32_t capture;
+
+	if (lane->timed_out)
+	{
+		return; //this lane is done, the race goes on on the other one
+	}
+	if (lane_id != 0 && g_stateMachine.current->id == STATE_CALIBRATING)
+	{
+		return; //calibration only counts lane 0
+	}
+	if (!g_timebase_running)
+	{
+		capture_backend_clear();
+		capture_backend_start();
+		g_timebase_running = true;
+		capture = 0; //the race starts with this pulse, the capture still holds a value of the stopped timebase
+	} else {
+		capture = capture_backend_read(lane_id);
+	}
+	if (!lane->running)
+	{
+		end_of_run_reset(&lane->end_of_run);
+		lane->run_start_seq = pulse_ring_produced(&lane->ring);
+		lane->run_hw_base = lane_pulses_seen(lane, CAPTURE_COUNTER_CC_ISR) -
+			(capture_backend_counter_present(lane_id) ? 1 : 0); //the counter already counted this pulse
+		lane->runs++;
+		k_work_schedule(&lane->qualification_work, SENSOR_QUALIFICATION_BURST_WINDOW_MS);
+		lane->running = true;
+		#ifdef CONFIG_TRICHTER_CAPTURE_ISR_LIGHT
+		capture_backend_irq_enable(lane_id, false); //FSM samples the counter from now on
+		#endif
+	}
+	pulse_ring_push(&lane->ring, capture);
+	end_of_run_arm(lane, capture);
 }
 
 
+static uint32_t lane_hw_pulse_count(const struct capture_lane *lane, uint8_t cc_channel)
+{
+	return lane_pulses_seen(lane, cc_channel) - lane->run_hw_base;
+}
+
+
+static uint32_t lane_pulse_count(const struct capture_lane *lane)
+{
+	#ifdef CONFIG_TRICHTER_CAPTURE_ISR_LIGHT
+	return lane_hw_pulse_count(lane, CAPTURE_COUNTER_CC_ISR);
+	#else
+	return pulse_ring_produced(&lane->ring) - lane->run_start_seq;
+	#endif
+}
+
+
+#ifdef CONFIG_TRICHTER_CAPTURE_ISR_LIGHT
 /*
-This is hit 150ms after the very first interrupt, if this is not a detected burst, return like nothing happened
+Without per-pulse interrupts only the first pulse has an exact timestamp. Every FSM tick samples the
+pulse counter and the timebase and spreads the new pulses evenly between the last stored tick and now.
+The session is flagged as interpolated, and the end of run estimator sees the mean interval of the
+sample instead of the sample spacing.
 */
-static void sensor_qualification_handler(struct k_work *work)
+static void session_sample_counter(struct capture_lane *lane)
 {
-	printk("Handler executing with timestamps received = %d", g_timestamp_idx_to_write);
-	if (g_timestamp_idx_to_write >= MIN_TIMESTAMPS_IN_BURST_WINDOW)
+	struct session *session = lane->session;
+
+	const uint32_t now = capture_backend_now();
+	const uint32_t hw_pulses = lane_hw_pulse_count(lane, CAPTURE_COUNTER_CC_FSM);
+	const uint32_t known = capture_store_count(&session->store) + lane->session_overflow;
+
+	if (capture_store_count(&session->store) == 0 || hw_pulses <= known)
 	{
-		if (g_stateMachine.current->id != STATE_CALIBRATING)
+		return;
+	}
+	const uint32_t new_pulses = hw_pulses - known;
+	const uint32_t last = capture_store_last(&session->store);
+	uint32_t tick = last;
+	session->header.flags |= SESSION_FLAG_INTERPOLATED;
+	for (uint32_t i = 1; i <= new_pulses; i++)
+	{
+		tick = last + (uint32_t)(((uint64_t)(now - last) * i) / new_pulses);
+		if (capture_store_append(&session->store, tick) != 0)
+		{
+			lane->session_overflow++;
+		}
+		flow_stats_update(&lane->flow_stats, tick);
+		if (i < new_pulses)
 		{
-			fsm_transition_deferred(STATE_RUNNING);
-		} else {
-			g_valid_calibration = true;
+			end_of_run_update(&lane->end_of_run, tick);
 		}
+	}
+	end_of_run_arm(lane, tick); //the last interpolated tick, the deadline counts from there
+}
+#endif
+
+
+/*
+Empties the capture slot of a lane for a new run. After a hand-off to the sender a fresh slot is taken
+from the pool, so the previous session can still be sent while the next run is captured.
+*/
+static void session_restart(struct capture_lane *lane)
+{
+	if (lane->session == NULL)
+	{
+		lane->session = session_pool_acquire();
 	} else {
-		unsigned int key = irq_lock();
-		reset_sensor_run_state();
-		irq_unlock(key);
-		timer_reset();
+		const uint16_t seq = lane->session->header.seq;
+		capture_store_reset(&lane->session->store);
+		memset(&lane->session->header, 0, sizeof(lane->session->header));
+		lane->session->header.seq = seq;
 	}
+	if (lane->session != NULL)
+	{
+		lane->session->header.lane = lane->id;
+	}
+	lane->session_overflow = 0;
+	if (lane->id == 0)
+	{
+		g_live_next = 0;
+	}
+	flow_stats_reset(&lane->flow_stats, global_calibration_value, TIMER_FREQUENCY_HZ);
 }
 
 
-void input_request_state_ready()
+/*
+Streaming consumer, only to be called from the FSM thread. Moves everything the ISR captured into the
+session of the lane. A new run (runs moved) restarts the session and drops stale pulses.
+*/
+static void session_drain(struct capture_lane *lane)
+{
+	uint32_t tick;
+	const uint32_t run = lane->runs;
+
+	if (run != lane->session_run)
+	{
+		lane->session_run = run;
+		session_restart(lane);
+		pulse_ring_skip_to(&lane->ring, lane->run_start_seq);
+	}
+	if (lane->session == NULL)
+	{
+		pulse_ring_skip_to(&lane->ring, pulse_ring_produced(&lane->ring)); //run already handed off, drop late pulses
+		return;
+	}
+	while (pulse_ring_pop(&lane->ring, &tick))
+	{
+		if (capture_store_append(&lane->session->store, tick) != 0)
+		{
+			lane->session_overflow++;
+		}
+		flow_stats_update(&lane->flow_stats, tick);
+	}
+	#ifdef CONFIG_TRICHTER_CAPTURE_ISR_LIGHT
+	if (lane->running)
+	{
+		session_sample_counter(lane);
+	}
+	#endif
+}
+
+
+/*Drops whatever the rings still hold from before, e.g. pulses that arrived while the result was shown*/
+static void rings_flush()
+{
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
+	{
+		pulse_ring_skip_to(&g_lanes[i].ring, pulse_ring_produced(&g_lanes[i].ring));
+	}
+}
+
+
+/*Both sensors at peak flow fill their rings at the same time, every FSM tick empties all of them*/
+static void session_drain_all()
+{
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
+	{
+		session_drain(&g_lanes[i]);
+	}
+}
+
+
+/*
+Hands the pulses of lane 0 captured since the last call to the BLE live stream, once a full batch is
+there or the oldest one waited BLE_LIVE_BATCH_MS. If the stream queue is full, they are retried next
+time. Live packets carry no session seq, so further lanes are only sent once the race is over.
+*/
+static void session_stream_live()
+{
+	const struct session *session = g_lanes[0].session;
+	uint32_t ticks[BLE_LIVE_BATCH_PULSES];
+	uint16_t num;
+
+	if (session == NULL || !ble_live_active())
+	{
+		return;
+	}
+	const uint16_t count = capture_store_count(&session->store);
+	if (count <= g_live_next)
+	{
+		g_live_batch_at = k_uptime_get();
+		return;
+	}
+	if (count - g_live_next < BLE_LIVE_BATCH_PULSES && k_uptime_get() - g_live_batch_at < BLE_LIVE_BATCH_MS)
+	{
+		return;
+	}
+	while ((num = capture_store_read(&session->store, g_live_next, ticks, BLE_LIVE_BATCH_PULSES)) > 0)
+	{
+		if (!ble_live_submit(session->header.seq, g_live_next, ticks, num))
+		{
+			break;
+		}
+		g_live_next += num;
+	}
+	g_live_batch_at = k_uptime_get();
+}
+
+
+static void session_discard(struct capture_lane *lane)
+{
+	lane->session_run = lane->runs;
+	session_restart(lane);
+	pulse_ring_skip_to(&lane->ring, pulse_ring_produced(&lane->ring));
+}
+
+
+/*
+Compares the hardware pulse count of the finished run with what actually ended up in the session.
+Must be called before the lane is stopped.
+*/
+static void session_finalize(struct capture_lane *lane)
+{
+	session_drain(lane);
+	if (lane->session == NULL)
+	{
+		return;
+	}
+	struct session_header *header = &lane->session->header;
+	const uint32_t hw_pulses = lane_hw_pulse_count(lane, CAPTURE_COUNTER_CC_FSM);
+	const uint32_t stored = capture_store_count(&lane->session->store);
+
+	header->missed_pulses = (hw_pulses > stored) ? MIN(hw_pulses - stored, UINT16_MAX) : 0;
+	header->end_of_run_ms = end_of_run_timeout(&lane->end_of_run) / TIMER_TICKS_PER_MS;
+	if (header->missed_pulses > 0)
+	{
+		LOG_WRN("Lane %d: missed %d of %d pulses (%d did not fit into the session)",
+			lane->id, header->missed_pulses, hw_pulses, lane->session_overflow);
+	}
+}
+
+
+/*Queues the finished run for the BLE sender, the next run gets a new slot*/
+static void session_handoff(struct capture_lane *lane)
+{
+	if (lane->session == NULL)
+	{
+		return;
+	}
+	session_pool_commit(lane->session);
+	LOG_DBG("Session %d of lane %d queued, %d waiting", lane->session->header.seq, lane->id, session_pool_num_queued());
+	lane->session = NULL;
+	ble_sender_kick();
+}
+
+
+static void lane_stop(struct capture_lane *lane)
+{
+	lane->running = false;
+	lane->timed_out = false;
+	k_work_cancel_delayable(&lane->qualification_work);
+	#ifdef CONFIG_TRICHTER_CAPTURE_ISR_LIGHT
+	capture_backend_irq_enable(lane->id, true);
+	#endif
+}
+
+
+static void lanes_stop()
+{
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
+	{
+		lane_stop(&g_lanes[i]);
+	}
+}
+
+
+void reset_sensor_run_state()
+{
+	lanes_stop();
+	g_timebase_running = false;
+	g_valid_calibration = false;
+}
+
+
+/*Forgets the pulses of a run that did not start, the lane waits for the next first pulse*/
+static void lane_discard_burst(struct capture_lane *lane)
 {
-	if (!ble_is_sending())
+	unsigned int key = irq_lock();
+	lane_stop(lane);
+	lane->run_start_seq = pulse_ring_produced(&lane->ring);
+	lane->runs++; //consumer drops the rejected burst
+	const bool idle = !race_running();
+	if (idle)
+	{
+		timebase_stop();
+		capture_backend_clear();
+	}
+	irq_unlock(key);
+	end_of_run_schedule();
+	if (!idle)
+	{
+		race_check_over(); //the other lanes may only have waited for this one
+	}
+}
+
+
+/*
+This is hit 150ms after the very first interrupt of a lane, if this is not a detected burst, return
+like nothing happened. Lanes qualify independently, the first one starts the race.
+*/
+static void sensor_qualification_handler(struct k_work *work)
+{
+	struct capture_lane *lane = CONTAINER_OF(k_work_delayable_from_work(work), struct capture_lane, qualification_work);
+	const uint32_t pulses = lane_pulse_count(lane);
+	const StateID_t state = g_stateMachine.current->id;
+
+	LOG_DBG("Lane %d handler executing with timestamps received = %d", lane->id, pulses);
+	if (pulses < MIN_TIMESTAMPS_IN_BURST_WINDOW)
+	{
+		lane_discard_burst(lane);
+	} else if (state == STATE_SENDING && !IS_ENABLED(CONFIG_TRICHTER_AUTO_REARM))
 	{
-		fsm_transition(STATE_READY);
+		lane_discard_burst(lane); //result is shown until READY, like a forbidden transition
+	} else if (state == STATE_CALIBRATING)
+	{
+		g_valid_calibration = true;
+	} else if (state != STATE_RUNNING) {
+		fsm_transition_deferred(STATE_RUNNING);
 	}
 }
 
 
+void input_request_state_ready()
+{
+	fsm_transition(STATE_READY); //sending runs in the background and is not affected
+}
+
+
 void input_request_pairing_mode()
 {
 	ble_delete_active_connection();
@@ -127,43 +570,30 @@ void init_seven_seg()
 {
     if (tm1637_init() != TM1637_OK)
     {
-        printk("Set up TM1637 failed\n");
+        LOG_ERR("Set up TM1637 failed");
     }
 }
 
 
-void timer_reset()
+/*Before the sensor interrupts are enabled*/
+void capture_lanes_init()
 {
-	for (uint16_t i = 0; i < TICKS_PER_LTR; ++i)
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
 	{
-		g_timestamps[i] = 0;
+		struct capture_lane *lane = &g_lanes[i];
+		lane->id = i;
+		end_of_run_init(&lane->end_of_run, END_OF_RUN_MIN_TICKS, END_OF_RUN_MAX_TICKS, CONFIG_TRICHTER_END_OF_RUN_MULTIPLE);
+		k_work_init_delayable(&lane->qualification_work, sensor_qualification_handler);
 	}
-	g_timestamp_idx_to_write = 0;
-	nrf_timer_task_trigger(NRF_TIMER2, NRF_TIMER_TASK_CLEAR);
-
-    for (uint8_t i = 0; i < NRF_TIMER_CC_CHANNEL_COUNT(2); i++) {
-        nrf_timer_cc_set(NRF_TIMER2, (nrf_timer_cc_channel_t)i, 0);
-    }
-    
-
-    for (uint8_t i = 0; i < NRF_TIMER_CC_CHANNEL_COUNT(2); i++) {
-        nrf_timer_event_clear(NRF_TIMER2, nrf_timer_compare_event_get(i));
-    }
-    
 
-    nrf_timer_int_disable(NRF_TIMER2, NRF_TIMER_INT_COMPARE0_MASK |
-                                  NRF_TIMER_INT_COMPARE1_MASK |
-                                  NRF_TIMER_INT_COMPARE2_MASK |
-                                  NRF_TIMER_INT_COMPARE3_MASK |
-                                  NRF_TIMER_INT_COMPARE4_MASK |
-                                  NRF_TIMER_INT_COMPARE5_MASK);
-
-	nrf_timer_prescaler_set(NRF_TIMER2, NRF_TIMER_FREQ_125kHz);
-	nrf_timer_mode_set(NRF_TIMER2, NRF_TIMER_MODE_TIMER);
-    nrf_timer_bit_width_set(NRF_TIMER2, NRF_TIMER_BIT_WIDTH_32);
-	nrf_timer_shorts_disable(NRF_TIMER2, NRF_TIMER_SHORT_COMPARE1_CLEAR_MASK | NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK);
-
-	printk("Successfully reset timer\n");
+	static const struct capture_backend_cb callbacks = {
+		.pulse = sensor_triggered_isr,
+		.compare = end_of_run_isr,
+	};
+	if (capture_backend_init(&callbacks) != 0)
+	{
+		LOG_ERR("Capture backend init failed");
+	}
 }
 
 
@@ -176,7 +606,7 @@ void on_trichter_startup()
 
 void ble_remote_state_dispatch(RemoteState state)
 {
-	printk("Received to dispatch: %d\n", state);
+	LOG_DBG("Received to dispatch: %d", state);
 	if (state >= REMOTE_STATE_CMD_MAX) return;
 	switch (state)
 	{
@@ -197,11 +627,12 @@ void ble_remote_state_dispatch(RemoteState state)
 
 uint8_t IdleEntry(void)
 {
-	tm1637_display_off();
+	display_off();
 	#ifndef CONFIG_BUTTONLESS
 		gpio_pin_set_dt(&led, 1);
 	#endif
-	g_stateMachine.period_ms = FSM_PERIOD_SLOW_MS;
+	ble_link_profile_idle();
+	g_stateMachine.period_ms = FSM_PERIOD_NONE;
 	return ERR_NONE;
 };
 
@@ -219,12 +650,14 @@ uint8_t ReadyEntry(void)
 {
 	if (party_mode)
 	{
-		tm1637_display_bier(5);
+		display_bier(5);
 	} else {
-		tm1637_display_ready(2);
+		display_ready(2);
 	}
-	k_timer_start(&fsm_timer, K_SECONDS(READY_MODE_TIMEOUT_SEC), K_NO_WAIT);
+	fsm_state_timeout(&g_stateMachine, READY_MODE_TIMEOUT_SEC * MSEC_PER_SEC, STATE_IDLE);
 	reset_sensor_run_state();
+	rings_flush();
+	ble_link_profile_idle();
 
 	#ifndef CONFIG_BUTTONLESS
 	if (!is_ble_connected())
@@ -240,6 +673,7 @@ uint8_t ReadyEntry(void)
 
 uint8_t ReadyRun(void)
 {
+	session_drain_all(); //keep the rings empty while waiting for the burst qualification
 	#ifndef CONFIG_BUTTONLESS
 	if (!is_ble_connected() && !bluetooth_advertising_is_active())
 	{
@@ -257,18 +691,12 @@ uint8_t ReadyRun(void)
 		gpio_pin_set_dt(&led, 1); // solid LED when connected
 	}
 	#endif
-
-	if (k_timer_status_get(&fsm_timer) > 0)
-	{
-		fsm_transition(STATE_IDLE);
-	}
 	return ERR_NONE;
 };
 
 
 uint8_t ReadyExit(void)
 {
-	k_timer_stop(&fsm_timer); //TODO assign fsm_timer to state machine and stop it on each transition request
 	#ifndef CONFIG_BUTTONLESS
 	bluetooth_advertising_stop();
 	#endif
@@ -279,7 +707,11 @@ uint8_t ReadyExit(void)
 uint8_t RunningEntry(void)
 {
 	bluetooth_advertising_stop();
-	g_stateMachine.period_ms = FSM_PERIOD_FAST_MS;
+	g_stateMachine.period_ms = RUN_PERIOD_MS;
+	if (ble_live_active())
+	{
+		ble_link_profile_transfer(); //live batches go out during the run
+	}
 	return ERR_NONE;
 };
 
@@ -287,35 +719,35 @@ uint8_t RunningEntry(void)
 uint8_t RunningRun(void)
 {
 	uint32_t current_timestamp = TIMER_VALUE_MAX;
-	uint32_t last_saved_timestamp = 0;
-	
 
-	nrf_timer_task_trigger(NRF_TIMER2, NRF_TIMER_TASK_CAPTURE0); //sensor data on channel 1, task on channel 0
-	current_timestamp = nrf_timer_cc_get(NRF_TIMER2, 0); //Capture is done via PPI
-	unsigned int key = irq_lock();
-	last_saved_timestamp = g_timestamps[g_timestamp_idx_to_write - 1];
-	irq_unlock(key);
+	current_timestamp = capture_backend_now(); //sensor captures are latched by the backend
+	session_drain_all();
+	session_stream_live();
 	//printk("Got timerValue %d\n" , current_timestamp);
 
-	uint64_t uS = current_timestamp * TIMER_TICK_DURATION_US; //timetamp to microseconds (1 step = 8uS)
 	uint8_t digits[4];
+	#ifdef CONFIG_TRICHTER_DISPLAY_FLOW
+	const uint16_t flow = flow_stats_current(&g_lanes[0].flow_stats); //mL/s
+	digits[0] = (uint8_t)((flow / 1000) % 10);
+	digits[1] = (uint8_t)((flow / 100) % 10);
+	digits[2] = (uint8_t)((flow / 10) % 10);
+	digits[3] = (uint8_t)(flow % 10);
+
+	display_digits(digits, 4, TM1637_BRIGHTNESS_HIGH, 5); //dot at 5 = no dot
+	#else
+	uint64_t uS = current_timestamp * TIMER_TICK_DURATION_US; //timetamp to microseconds (1 step = 8uS)
 	digits[0] = (uint8_t)(uS / 10000000) % 10; //10sec
 	digits[1] = (uint8_t)(uS / 1000000) % 10; //1sec
 	digits[2] = (uint8_t)(uS / 100000) % 10; //100ms
 	digits[3] = (uint8_t)(uS / 10000) % 10; //10ms
 
-	tm1637_display_digits(digits, 4, TM1637_BRIGHTNESS_HIGH, 1);
+	display_digits(digits, 4, TM1637_BRIGHTNESS_HIGH, 1);
+	#endif
 
-	if (g_timestamp_idx_to_write > 0)
-	{
-		uint32_t diff = current_timestamp - last_saved_timestamp;
-		//printk("Diffed to %d\n", diff);
-		
-		if (diff  >= TIMER_TIMEOUT_TIMESTAMP_DIFF)
-		{
-			fsm_transition(STATE_SENDING);
-		}
-	}
+	#ifndef CONFIG_TRICHTER_HW_END_OF_RUN
+	lanes_expire(current_timestamp);
+	race_check_over();
+	#endif
 	
 	return ERR_NONE;
 };
@@ -323,51 +755,65 @@ uint8_t RunningRun(void)
 
 uint8_t RunningExit(void)
 {
-	nrf_timer_task_trigger(NRF_TIMER2, NRF_TIMER_TASK_STOP);
-	is_running = false;
-	printk("Called RunningExit\n");
+	end_of_run_disarm();
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
+	{
+		if (g_lanes[i].running)
+		{
+			session_finalize(&g_lanes[i]);
+			g_lanes[i].finished = true;
+		}
+	}
+	timebase_stop();
+	lanes_stop();
+	LOG_DBG("Called RunningExit");
 	return ERR_NONE;
 };
 
 uint8_t CalibEntry(void)
 {
-	tm1637_display_cal(5);
-	timer_reset();
+	display_cal(5);
+	timebase_stop();
+	capture_backend_clear();
+	session_discard(&g_lanes[0]);
 	g_calib_attempt_notifier(false);
-	g_stateMachine.period_ms = FSM_PERIOD_FAST_MS;
+	g_stateMachine.period_ms = RUN_PERIOD_MS;
 	g_valid_calibration = false;
+	g_lanes[0].timed_out = false;
 	return ERR_NONE;
 };
 
 
 uint8_t CalibRun(void)
 {
-	uint32_t current_timestamp = TIMER_VALUE_MAX;
-	uint32_t last_saved_timestamp = 0;
-	
-	nrf_timer_task_trigger(NRF_TIMER2, NRF_TIMER_TASK_CAPTURE0); //sensor data on channel 1, task on channel 0
-	current_timestamp = nrf_timer_cc_get(NRF_TIMER2, 0); //Capture is done via PPI
-	if (g_timestamp_idx_to_write >= MIN_TIMESTAMPS_IN_BURST_WINDOW)
-	{
-		unsigned int key = irq_lock();
-		last_saved_timestamp = g_timestamps[g_timestamp_idx_to_write - 1];
-		irq_unlock(key);
+	struct capture_lane *lane = &g_lanes[0]; //the calibration funnel
 
+	session_drain(lane);
+	if (lane->session == NULL)
+	{
+		return ERR_NONE;
+	}
+	const uint16_t count = capture_store_count(&lane->session->store);
+	if (count >= MIN_TIMESTAMPS_IN_BURST_WINDOW)
+	{
 		uint8_t digits[4];
-		digits[3] = (uint8_t)g_timestamp_idx_to_write % 10; //1
-		digits[2] = (uint8_t)(g_timestamp_idx_to_write / 10) % 10; //10
-		digits[1] = (uint8_t)(g_timestamp_idx_to_write / 100) % 10; //100
-		digits[0] = (uint8_t)(g_timestamp_idx_to_write / 1000) % 10; //1000
-
-		tm1637_display_digits(digits, 4, TM1637_BRIGHTNESS_MID, 5); //dot at 5 = no dot
-		uint32_t diff = current_timestamp - last_saved_timestamp;
-		printk("Diffed to %d\n", diff);
-		
-		if (diff  >= TIMER_TIMEOUT_TIMESTAMP_DIFF)
+		digits[3] = (uint8_t)(count % 10); //1
+		digits[2] = (uint8_t)((count / 10) % 10); //10
+		digits[1] = (uint8_t)((count / 100) % 10); //100
+		digits[0] = (uint8_t)((count / 1000) % 10); //1000
+
+		display_digits(digits, 4, TM1637_BRIGHTNESS_MID, 5); //dot at 5 = no dot
+		#ifndef CONFIG_TRICHTER_HW_END_OF_RUN
+		uint32_t current_timestamp = capture_backend_now();
+		LOG_HOT_DBG("Diffed to %d", current_timestamp - capture_store_last(&lane->session->store));
+
+		lanes_expire(current_timestamp);
+		if (lane->timed_out)
 		{
-			global_calibration_value = g_timestamp_idx_to_write;
+			global_calibration_value = count;
 			fsm_transition(STATE_READY);
 		}
+		#endif
 	}
 	return ERR_NONE;
 };
@@ -375,8 +821,18 @@ uint8_t CalibRun(void)
 
 uint8_t CalibExit(void)
 {
-	is_running = false;
-	nrf_timer_task_trigger(NRF_TIMER2, NRF_TIMER_TASK_STOP);
+	struct capture_lane *lane = &g_lanes[0];
+
+	end_of_run_disarm();
+	session_finalize(lane);
+	#ifdef CONFIG_TRICHTER_HW_END_OF_RUN
+	if (lane->timed_out && lane->session != NULL)
+	{
+		global_calibration_value = capture_store_count(&lane->session->store);
+	}
+	#endif
+	timebase_stop();
+	lanes_stop();
 	bool valid_calib_attempt = g_valid_calibration && global_calibration_value <= 400 && global_calibration_value >= 100;
 	g_calib_attempt_notifier(valid_calib_attempt);
 	if (valid_calib_attempt)
@@ -388,15 +844,17 @@ uint8_t CalibExit(void)
 
 
 #ifdef PRINT_TIMESTAMPS_IN_CONSOLE
-void print_all_timestamps()
+void print_all_timestamps(const struct session *session)
 {
 
 	printk("================ALL TIMESTAMPS==================\n");
 	printk("[");
-	for (int i = 0; i < g_timestamp_idx_to_write; i++)
+	struct capture_store_iter it;
+	uint32_t tick;
+	capture_store_iter_init(&it, &session->store, 0);
+	while (capture_store_iter_next(&it, &tick))
 	{
-		uint8_t *b = (uint8_t *)&g_timestamps[i];
-		printk("%d, ", g_timestamps[i]);
+		printk("%d, ", tick);
 		k_msleep(8);
 	}
 	printk("]");
@@ -404,82 +862,142 @@ void print_all_timestamps()
 #endif
 
 
+static bool lane_finished(const struct capture_lane *lane)
+{
+	return lane->finished && lane->session != NULL && capture_store_count(&lane->session->store) > 0;
+}
+
+
+/*
+Combined result of the race: the lanes that finished are ranked by their last pulse on the common
+timebase, the earliest one wins. Places stay 0 if only one lane ran. Returns the winner.
+*/
+static struct capture_lane *race_rank(uint8_t *num_finished)
+{
+	struct capture_lane *winner = NULL;
+
+	*num_finished = 0;
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
+	{
+		struct capture_lane *lane = &g_lanes[i];
+		if (!lane_finished(lane))
+		{
+			continue;
+		}
+		const uint32_t last = capture_store_last(&lane->session->store);
+		uint8_t place = 1;
+		for (uint8_t j = 0; j < CAPTURE_LANES; j++)
+		{
+			const struct capture_lane *other = &g_lanes[j];
+			if (j != i && lane_finished(other) &&
+				(capture_store_last(&other->session->store) < last ||
+				(capture_store_last(&other->session->store) == last && j < i)))
+			{
+				place++;
+			}
+		}
+		lane->session->header.place = place;
+		if (place == 1)
+		{
+			winner = lane;
+		}
+		(*num_finished)++;
+	}
+	if (*num_finished == 1)
+	{
+		winner->session->header.place = 0;
+	}
+	return winner;
+}
+
+
+static void race_report(struct capture_lane *lane)
+{
+	struct flow_summary summary;
+
+	flow_stats_summary(&lane->flow_stats, TIMER_TICKS_PER_MS, &summary);
+	LOG_INF("Run %d (lane %d, place %d): %d mL in %d ms, avg %d mL/s, peak %d mL/s", lane->session->header.seq,
+		lane->id, lane->session->header.place, summary.volume_ml, summary.duration_ms, summary.avg_ml_per_s,
+		summary.peak_ml_per_s);
+	ble_flow_result_notifier(&lane->session->header, &summary); //the result goes out before the session
+}
+
+
 uint8_t SendingEntry(void)
 {
-	uint32_t highest_stamp = g_timestamps[g_timestamp_idx_to_write - 1];
-	printk("Highest timestamp at %d\n", highest_stamp);
+	uint8_t num_finished;
+	struct capture_lane *winner = race_rank(&num_finished);
+
+	if (winner == NULL)
+	{
+		/*
+		No lane got a session slot (all of them queued or pinned) or stored a pulse. Nothing to show or
+		send, but ERROR would be a dead end: show it briefly and wait for the next run.
+		*/
+		LOG_WRN("Run ended without a session to report");
+		lanes_stop();
+		for (uint8_t i = 0; i < CAPTURE_LANES; i++)
+		{
+			g_lanes[i].finished = false;
+		}
+		display_error_message(5);
+		fsm_state_timeout(&g_stateMachine, SENDING_NO_RESULT_MS, STATE_READY);
+		g_stateMachine.period_ms = FSM_PERIOD_NONE;
+		return ERR_NONE;
+	}
+	uint32_t highest_stamp = capture_store_last(&winner->session->store);
+	LOG_DBG("Highest timestamp at %d", highest_stamp);
 	uint32_t ms = (highest_stamp * TIMER_TICK_DURATION_US) / 1000;
 	uint8_t digits[4];
 	digits[0] = (ms / 10000) % 10; // 10 s
 	digits[1] = (ms / 1000)  % 10; // 1 s
 	digits[2] = (ms / 100)   % 10; // 100 ms
 	digits[3] = (ms / 10)    % 10; // 10 ms
-	printk("Highest timestamp in digits: %d %d. %d %d\n", digits[0], digits[1], digits[2], digits[3]);
+	LOG_DBG("Highest timestamp in digits: %d %d. %d %d", digits[0], digits[1], digits[2], digits[3]);
 
-	tm1637_display_digits(digits, 4, 7, 1);
-	//start a 10s timer
-	k_timer_start(&fsm_timer, K_SECONDS(30), K_NO_WAIT);
+	display_digits(digits, 4, 7, 1);
+	fsm_state_timeout(&g_stateMachine, SENDING_TIMEOUT_SEC * MSEC_PER_SEC, STATE_READY);
 
 	#ifdef PRINT_TIMESTAMPS_IN_CONSOLE
-	print_all_timestamps();
+	print_all_timestamps(winner->session);
 	#endif
-	return ERR_NONE;
-};
-
-
-uint8_t SendingRun(void)
-{
-	if (is_ble_connected())
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
 	{
-		//call bluetooth function that takes an array of uint32 and chunks it according to the current MTU and sends it
-		if (!start_sent)
+		if (lane_finished(&g_lanes[i]) && &g_lanes[i] != winner)
 		{
-			int ret = 0;
-			ret = ble_prepare_send(g_timestamps, g_timestamp_idx_to_write);
-			if (ret == 0)
-			{
-				ret = ble_send_start();
-				if (ret != 0)
-				{
-					printk("BLE start error\n");
-					start_sent = 0;
-					return ERR_API;
-				} else {
-					start_sent = true;
-				}
-			}
-		} else {
-			if (ble_is_sending())
-			{
-				int err = ble_send_chunk();
-				if (err)
-				{
-					if (err != 0)
-					{
-						printk("BLE send chunk error\n");
-						start_sent = false;
-						return ERR_API;
-					}
-				}
-			}
+			race_report(&g_lanes[i]);
+			LOG_INF("Lane %d wins by %d ms over lane %d", winner->id,
+				(capture_store_last(&g_lanes[i].session->store) - highest_stamp) / TIMER_TICKS_PER_MS, i);
 		}
-	};
-	if (k_timer_status_get(&fsm_timer) > 0)
+	}
+	race_report(winner); //last, so the readable and advertised result is the winner's
+
+	ble_link_profile_transfer(); //before the handoff, the sender starts right away
+	for (uint8_t i = 0; i < CAPTURE_LANES; i++)
 	{
-		fsm_transition(STATE_READY);
+		if (lane_finished(&g_lanes[i]))
+		{
+			session_handoff(&g_lanes[i]);
+		}
+		g_lanes[i].finished = false;
 	}
+	g_stateMachine.period_ms = FSM_PERIOD_NONE;
 	return ERR_NONE;
-}
+};
+
+
+uint8_t SendingRun(void) {return ERR_NONE;};
+
 
 uint8_t SendingExit(void)
 {
-	start_sent = false;
-	k_timer_stop(&fsm_timer);
+	g_stateMachine.period_ms = FSM_PERIOD_FAST_MS;
 	return ERR_NONE;
 };
 
 uint8_t ErrorEntry(void){
-	tm1637_display_error_message(5);
+	display_error_message(5);
+	g_stateMachine.period_ms = FSM_PERIOD_NONE;
 	return ERR_NONE;
 };
 uint8_t ErrorRun(void){return ERR_NONE;};
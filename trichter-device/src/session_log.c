@@ -0,0 +1,366 @@
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/fs/fcb.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/crc.h>
+#include "session_log.h"
+#include "session_pool.h"
+#include "memory.h"
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(session_log, CONFIG_TRICHTER_MEMORY_LOG_LEVEL);
+
+
+#define SESSION_LOG_PARTITION       session_log_partition
+#define SESSION_LOG_AREA_ID         FIXED_PARTITION_ID(SESSION_LOG_PARTITION)
+#define SESSION_LOG_MAX_SECTORS     8
+#define SESSION_LOG_MAGIC           0x5345534C //"SESL"
+#define SESSION_LOG_VERSION         1
+
+/*Flash entry: this header, then used bytes of varint data padded to the flash write block*/
+struct session_log_entry {
+    uint32_t crc;               //crc32 over the rest of the header and the data
+    uint16_t seq;
+    uint16_t count;
+    uint16_t used;
+    uint16_t calibration;
+    uint16_t missed_pulses;
+    uint16_t end_of_run_ms;
+    uint32_t base;
+};
+
+struct session_log_ack_record {
+    uint16_t seq;               //every session up to and including seq is acknowledged
+    uint16_t valid;
+};
+
+static struct {
+    struct fcb fcb;
+    struct flash_sector sectors[SESSION_LOG_MAX_SECTORS];
+    bool ready;
+    struct session_log_ack_record ack;
+    struct session_log_info info;
+} g_log;
+
+K_MUTEX_DEFINE(session_log_lock);
+
+static void ack_work_handler(struct k_work *work);
+K_WORK_DEFINE(ack_work, ack_work_handler);
+
+
+static bool is_pending(uint16_t seq)
+{
+    return !g_log.ack.valid || (int16_t)(seq - g_log.ack.seq) > 0;
+}
+
+
+static int read_entry(const struct fcb_entry *loc, struct session_log_entry *entry)
+{
+    if (loc->fe_data_len < sizeof(*entry))
+    {
+        return -EINVAL;
+    }
+    return flash_area_read(g_log.fcb.fap, FCB_ENTRY_FA_DATA_OFF(*loc), entry, sizeof(*entry));
+}
+
+
+struct scan_state {
+    bool any;
+    uint16_t pending;
+    uint16_t first_pending_seq;
+    uint16_t last_seq;
+};
+
+static int scan_cb(struct fcb_entry_ctx *ctx, void *arg)
+{
+    struct scan_state *scan = arg;
+    struct session_log_entry entry;
+
+    if (read_entry(&ctx->loc, &entry) != 0)
+    {
+        return 0;
+    }
+    if (is_pending(entry.seq))
+    {
+        if (scan->pending == 0)
+        {
+            scan->first_pending_seq = entry.seq;
+        }
+        scan->pending++;
+    }
+    scan->last_seq = entry.seq;
+    scan->any = true;
+    return 0;
+}
+
+/*Recounts pending sessions, call with the lock held. Returns false for an empty log.*/
+static bool update_info(void)
+{
+    struct scan_state scan = {0};
+
+    fcb_walk(&g_log.fcb, NULL, scan_cb, &scan);
+    g_log.info.pending = scan.pending;
+    g_log.info.first_pending_seq = scan.first_pending_seq;
+    g_log.info.last_seq = scan.any ? scan.last_seq : 0;
+    return scan.any;
+}
+
+
+int session_log_init(void)
+{
+    uint32_t sector_cnt = SESSION_LOG_MAX_SECTORS;
+    int err;
+
+    err = flash_area_get_sectors(SESSION_LOG_AREA_ID, &sector_cnt, g_log.sectors);
+    if (err)
+    {
+        LOG_ERR("Session log partition not usable (%d)", err);
+        return err;
+    }
+    g_log.fcb.f_magic = SESSION_LOG_MAGIC;
+    g_log.fcb.f_version = SESSION_LOG_VERSION;
+    g_log.fcb.f_sector_cnt = sector_cnt;
+    g_log.fcb.f_scratch_cnt = 0;
+    g_log.fcb.f_sectors = g_log.sectors;
+    err = fcb_init(SESSION_LOG_AREA_ID, &g_log.fcb);
+    if (err)
+    {
+        LOG_ERR("Session log init failed (%d)", err);
+        return err;
+    }
+    if (memory_read_value(SESSION_LOG_ACK_ID, &g_log.ack, sizeof(g_log.ack)) != sizeof(g_log.ack))
+    {
+        g_log.ack.valid = false;
+    }
+
+    k_mutex_lock(&session_log_lock, K_FOREVER);
+    if (update_info())
+    {
+        session_pool_set_next_seq(g_log.info.last_seq + 1); //sequence numbers stay unique across reboots
+    }
+    g_log.ready = true;
+    k_mutex_unlock(&session_log_lock);
+    LOG_INF("Session log: %d sectors, %d sessions pending", sector_cnt, g_log.info.pending);
+    return 0;
+}
+
+
+static int count_pending_cb(struct fcb_entry_ctx *ctx, void *arg)
+{
+    struct session_log_entry entry;
+
+    if (read_entry(&ctx->loc, &entry) == 0 && is_pending(entry.seq))
+    {
+        (*(uint16_t *)arg)++;
+    }
+    return 0;
+}
+
+/*
+Erases the oldest sector. Only done when an append does not fit, so every sector is erased once per
+trip around the ring, no matter how often sessions get acknowledged.
+*/
+static int rotate(void)
+{
+    uint16_t lost = 0;
+
+    fcb_walk(&g_log.fcb, g_log.fcb.f_oldest, count_pending_cb, &lost);
+    if (lost > 0)
+    {
+        LOG_WRN("Session log full, erasing %d pending sessions", lost);
+        g_log.info.dropped += lost;
+    }
+    return fcb_rotate(&g_log.fcb);
+}
+
+
+int session_log_append(const struct session *session)
+{
+    const struct capture_store *store = &session->store;
+    const uint16_t data_len = ROUND_UP(store->used, sizeof(uint32_t)); //data[] is sized in whole words
+    struct session_log_entry entry = {
+        .seq = session->header.seq,
+        .count = store->count,
+        .used = store->used,
+        .missed_pulses = session->header.missed_pulses,
+        .end_of_run_ms = session->header.end_of_run_ms,
+        .base = store->base,
+    };
+    struct fcb_entry loc;
+    int err;
+
+    if (!g_log.ready)
+    {
+        return -ENODEV;
+    }
+    read_counter_from_rom(&entry.calibration);
+    entry.crc = crc32_ieee_update(0, (const uint8_t *)&entry + sizeof(entry.crc), sizeof(entry) - sizeof(entry.crc));
+    entry.crc = crc32_ieee_update(entry.crc, store->data, store->used);
+
+    k_mutex_lock(&session_log_lock, K_FOREVER);
+    err = fcb_append(&g_log.fcb, sizeof(entry) + data_len, &loc);
+    if (err == -ENOSPC)
+    {
+        err = rotate();
+        if (err == 0)
+        {
+            err = fcb_append(&g_log.fcb, sizeof(entry) + data_len, &loc);
+        }
+    }
+    if (err == 0)
+    {
+        err = flash_area_write(g_log.fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), &entry, sizeof(entry));
+    }
+    if (err == 0)
+    {
+        err = flash_area_write(g_log.fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc) + sizeof(entry), store->data, data_len);
+    }
+    if (err == 0)
+    {
+        err = fcb_append_finish(&g_log.fcb, &loc);
+    }
+    update_info();
+    k_mutex_unlock(&session_log_lock);
+
+    if (err)
+    {
+        LOG_ERR("Storing session %d failed (%d)", session->header.seq, err);
+    } else {
+        LOG_INF("Session %d stored, %d pending", session->header.seq, g_log.info.pending);
+    }
+    return err;
+}
+
+
+struct find_state {
+    struct fcb_entry loc;
+    struct session_log_entry entry;
+    bool found;
+};
+
+static int find_first_pending_cb(struct fcb_entry_ctx *ctx, void *arg)
+{
+    struct find_state *find = arg;
+
+    if (read_entry(&ctx->loc, &find->entry) == 0 && is_pending(find->entry.seq))
+    {
+        find->loc = ctx->loc;
+        find->found = true;
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+Loads the oldest pending session into a free pool slot and queues it for sending.
+Returns false if nothing is pending or no slot is free.
+*/
+bool session_log_queue_next(void)
+{
+    struct find_state find = {0};
+    struct session *session = NULL;
+    uint32_t crc;
+    int err;
+
+    if (!g_log.ready)
+    {
+        return false;
+    }
+    k_mutex_lock(&session_log_lock, K_FOREVER);
+    while (g_log.info.pending > 0 && session == NULL)
+    {
+        fcb_walk(&g_log.fcb, NULL, find_first_pending_cb, &find);
+        if (!find.found)
+        {
+            break;
+        }
+        session = session_pool_acquire_restore(find.entry.seq);
+        if (session == NULL)
+        {
+            break;
+        }
+
+        err = -EINVAL;
+        if (find.entry.used <= CAPTURE_STORE_BYTES)
+        {
+            err = flash_area_read(g_log.fcb.fap, FCB_ENTRY_FA_DATA_OFF(find.loc) + sizeof(find.entry),
+                                  session->store.data, find.entry.used);
+        }
+        if (err == 0)
+        {
+            crc = crc32_ieee_update(0, (const uint8_t *)&find.entry + sizeof(find.entry.crc),
+                                    sizeof(find.entry) - sizeof(find.entry.crc));
+            crc = crc32_ieee_update(crc, session->store.data, find.entry.used);
+            err = (crc == find.entry.crc) ? 0 : -EBADMSG;
+        }
+        if (err == 0)
+        {
+            err = capture_store_restore(&session->store, find.entry.base, find.entry.count, find.entry.used);
+        }
+        if (err != 0)
+        {
+            LOG_ERR("Session %d in the log is corrupt (%d), skipping it", find.entry.seq, err);
+            session_pool_release(session);
+            session = NULL;
+            g_log.ack.seq = find.entry.seq; //skip it, there is nothing to deliver
+            g_log.ack.valid = true;
+            memory_write_value(SESSION_LOG_ACK_ID, &g_log.ack, sizeof(g_log.ack));
+            update_info();
+            find.found = false;
+            continue;
+        }
+        session->header.missed_pulses = find.entry.missed_pulses;
+        session->header.end_of_run_ms = find.entry.end_of_run_ms;
+        if (IS_ENABLED(CONFIG_TRICHTER_CAPTURE_ISR_LIGHT) && find.entry.count > 1)
+        {
+            session->header.flags = SESSION_FLAG_INTERPOLATED; //not in the entry, a build captures only one way
+        }
+        session_pool_commit(session);
+        LOG_DBG("Restored session %d from the log", find.entry.seq);
+    }
+    k_mutex_unlock(&session_log_lock);
+    return session != NULL;
+}
+
+
+static void ack_work_handler(struct k_work *work)
+{
+    struct session_log_ack_record ack;
+
+    k_mutex_lock(&session_log_lock, K_FOREVER);
+    ack = g_log.ack;
+    k_mutex_unlock(&session_log_lock);
+    memory_write_value(SESSION_LOG_ACK_ID, &ack, sizeof(ack));
+}
+
+
+/*
+Every session up to and including seq was received. Takes effect right away so the session is not
+restored again; the NVS write is done on the system workqueue.
+*/
+void session_log_ack(uint16_t seq)
+{
+    if (!g_log.ready)
+    {
+        return;
+    }
+    k_mutex_lock(&session_log_lock, K_FOREVER);
+    if (!g_log.ack.valid || (int16_t)(seq - g_log.ack.seq) > 0)
+    {
+        g_log.ack.seq = seq;
+        g_log.ack.valid = true;
+        update_info();
+        k_work_submit(&ack_work);
+    }
+    k_mutex_unlock(&session_log_lock);
+}
+
+
+void session_log_get_info(struct session_log_info *info)
+{
+    k_mutex_lock(&session_log_lock, K_FOREVER);
+    *info = g_log.info;
+    k_mutex_unlock(&session_log_lock);
+}
@@ -0,0 +1,256 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include "session_pool.h"
+
+enum slot_state {
+    SLOT_FREE,
+    SLOT_CAPTURING,
+    SLOT_QUEUED,
+    SLOT_SENDING,
+};
+
+struct session_slot {
+    struct session session;
+    enum slot_state state;
+    bool complete;          //committed once, contents stay valid until the slot is acquired again
+    uint8_t readers;        //pinned for random access reads, never acquired while > 0
+};
+
+BUILD_ASSERT(SESSION_POOL_SLOTS >= 2, "one slot captures while another one is sent");
+
+static struct session_slot g_slots[SESSION_POOL_SLOTS];
+static struct k_spinlock g_pool_lock;
+static uint16_t g_next_seq = 0;
+static uint32_t g_dropped = 0;  //queued sessions overwritten before they could be sent
+
+
+static struct session_slot *slot_of(struct session *session)
+{
+    return CONTAINER_OF(session, struct session_slot, session);
+}
+
+
+/*Oldest queued slot, sequence numbers wrap so compare by distance*/
+static struct session_slot *oldest_queued(void)
+{
+    struct session_slot *oldest = NULL;
+
+    for (uint8_t i = 0; i < SESSION_POOL_SLOTS; i++)
+    {
+        struct session_slot *slot = &g_slots[i];
+        if (slot->state != SLOT_QUEUED)
+        {
+            continue;
+        }
+        if (oldest == NULL || (int16_t)(slot->session.header.seq - oldest->session.header.seq) < 0)
+        {
+            oldest = slot;
+        }
+    }
+    return oldest;
+}
+
+
+/*
+Free slot to capture into: never used ones first, then the one holding the oldest sent session,
+so recently sent sessions stay readable as long as possible.
+*/
+static struct session_slot *oldest_free(void)
+{
+    struct session_slot *oldest = NULL;
+
+    for (uint8_t i = 0; i < SESSION_POOL_SLOTS; i++)
+    {
+        struct session_slot *slot = &g_slots[i];
+        if (slot->state != SLOT_FREE || slot->readers > 0)
+        {
+            continue;
+        }
+        if (!slot->complete)
+        {
+            return slot;
+        }
+        if (oldest == NULL || (int16_t)(slot->session.header.seq - oldest->session.header.seq) < 0)
+        {
+            oldest = slot;
+        }
+    }
+    return oldest;
+}
+
+
+struct session *session_pool_acquire(void)
+{
+    struct session_slot *slot = NULL;
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+
+    slot = oldest_free();
+    if (slot == NULL)
+    {
+        slot = oldest_queued();
+        if (slot != NULL && slot->readers > 0)
+        {
+            slot = NULL; //being read right now, capturing fails instead of corrupting the read
+        }
+        if (slot != NULL)
+        {
+            g_dropped++;
+        }
+    }
+    if (slot != NULL)
+    {
+        slot->state = SLOT_CAPTURING;
+        slot->complete = false;
+        slot->session.persisted = false;
+        memset(&slot->session.header, 0, sizeof(slot->session.header));
+        slot->session.header.seq = g_next_seq++;
+        capture_store_reset(&slot->session.store);
+    }
+    k_spin_unlock(&g_pool_lock, key);
+    return (slot != NULL) ? &slot->session : NULL;
+}
+
+
+/*
+Free slot to load a session from the flash log into, keeping its sequence number.
+Never steals a queued session; commit once loaded.
+*/
+struct session *session_pool_acquire_restore(uint16_t seq)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+    struct session_slot *slot = oldest_free();
+    if (slot != NULL)
+    {
+        slot->state = SLOT_CAPTURING;
+        slot->complete = false;
+        slot->session.persisted = true;
+        memset(&slot->session.header, 0, sizeof(slot->session.header));
+        slot->session.header.seq = seq;
+        capture_store_reset(&slot->session.store);
+    }
+    k_spin_unlock(&g_pool_lock, key);
+    return (slot != NULL) ? &slot->session : NULL;
+}
+
+
+/*Continue the sequence after the sessions already in the flash log*/
+void session_pool_set_next_seq(uint16_t seq)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+    g_next_seq = seq;
+    k_spin_unlock(&g_pool_lock, key);
+}
+
+
+void session_pool_commit(struct session *session)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+    slot_of(session)->state = SLOT_QUEUED;
+    slot_of(session)->complete = true;
+    k_spin_unlock(&g_pool_lock, key);
+}
+
+
+void session_pool_release(struct session *session)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+    slot_of(session)->state = SLOT_FREE;
+    k_spin_unlock(&g_pool_lock, key);
+}
+
+
+struct session *session_pool_next_queued(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+    struct session_slot *slot = oldest_queued();
+    if (slot != NULL)
+    {
+        slot->state = SLOT_SENDING;
+    }
+    k_spin_unlock(&g_pool_lock, key);
+    return (slot != NULL) ? &slot->session : NULL;
+}
+
+
+/*Transmission failed, keep the session for the next attempt*/
+void session_pool_requeue(struct session *session)
+{
+    session_pool_commit(session);
+}
+
+
+uint16_t session_pool_num_queued(void)
+{
+    uint16_t num = 0;
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+    for (uint8_t i = 0; i < SESSION_POOL_SLOTS; i++)
+    {
+        if (g_slots[i].state == SLOT_QUEUED)
+        {
+            num++;
+        }
+    }
+    k_spin_unlock(&g_pool_lock, key);
+    return num;
+}
+
+
+uint32_t session_pool_num_dropped(void)
+{
+    return g_dropped;
+}
+
+
+bool session_pool_latest_seq(uint16_t *seq)
+{
+    struct session_slot *latest = NULL;
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+    for (uint8_t i = 0; i < SESSION_POOL_SLOTS; i++)
+    {
+        struct session_slot *slot = &g_slots[i];
+        if (slot->complete &&
+            (latest == NULL || (int16_t)(slot->session.header.seq - latest->session.header.seq) > 0))
+        {
+            latest = slot;
+        }
+    }
+    if (latest != NULL)
+    {
+        *seq = latest->session.header.seq;
+    }
+    k_spin_unlock(&g_pool_lock, key);
+    return latest != NULL;
+}
+
+
+const struct session *session_pool_pin(uint16_t seq)
+{
+    struct session_slot *found = NULL;
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+    for (uint8_t i = 0; i < SESSION_POOL_SLOTS; i++)
+    {
+        if (g_slots[i].complete && g_slots[i].session.header.seq == seq)
+        {
+            found = &g_slots[i];
+            found->readers++;
+            break;
+        }
+    }
+    k_spin_unlock(&g_pool_lock, key);
+    return (found != NULL) ? &found->session : NULL;
+}
+
+
+void session_pool_unpin(const struct session *session)
+{
+    k_spinlock_key_t key = k_spin_lock(&g_pool_lock);
+    struct session_slot *slot = slot_of((struct session *)session);
+    if (slot->readers > 0)
+    {
+        slot->readers--;
+    }
+    k_spin_unlock(&g_pool_lock, key);
+}
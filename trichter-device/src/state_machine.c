@@ -1,6 +1,10 @@
 
 #include <stdint.h>
 #include "state_machine.h"
+#include <zephyr/logging/log.h>
+#include "log_hot.h"
+
+LOG_MODULE_REGISTER(state_machine, CONFIG_TRICHTER_FSM_LOG_LEVEL);
 
 static StateNotifier g_state_notifier;
 
@@ -27,15 +31,16 @@ static uint8_t is_transition_allowed(const State_t *currState, StateID_t targetS
 uint8_t state_machine_transition(StateMachine_t *stateMachine, StateID_t targetState)
 {
     //Error Checks
-    if (!stateMachine || !stateMachine->current || targetState > stateMachine->num_states)
+    //allowedTransitions is padded with the MAX id, it must never pass as a target
+    if (!stateMachine || !stateMachine->current || targetState >= stateMachine->num_states)
     {
-        printk("Invalid State request\n");
+        LOG_ERR("Invalid State request");
         return ERR_INVALID_PARAM;
         
     }
     if (!stateMachine->current->onEntry || !stateMachine->current->onExit)
     {
-        printk("Invalid function definitions\n");
+        LOG_ERR("Invalid function definitions");
         return ERR_INVALID_PARAM;
     }
 
@@ -43,21 +48,21 @@ uint8_t state_machine_transition(StateMachine_t *stateMachine, StateID_t targetS
     uint8_t ret = ERR_NONE;
     if (0 == is_transition_allowed(stateMachine->current, targetState))
     {
-        printk("State transition not allowed\n");
+        LOG_ERR("State transition not allowed");
         ret = ERR_TRANSITION_FORBIDDEN;
     } else {
-        ret = stateMachine->current->onExit(); 
-        printk("OnExit returned %d", ret);
+        ret = stateMachine->current->onExit();
+        LOG_HOT_DBG("OnExit returned %d", ret);
         if (ret != ERR_NONE && ret != ERR_NO_IMPL)
         {
             return ret;
         }
         if (ret == ERR_NO_IMPL)
         {
-            printk("WARNING: OnExit of current state has no implementation\n");
+            LOG_WRN("OnExit of current state has no implementation");
         }
         State_t *next = &stateMachine->states[targetState];
-        printk("Going to target state %d\n", next->id);
+        LOG_HOT_DBG("Going to target state %d", next->id);
         stateMachine->current = next;
         ret = next->onEntry();
 
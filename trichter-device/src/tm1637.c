@@ -1,10 +1,33 @@
 /* SPDX-License-Identifier: Apache-2.0 */
-/* tm1637.c - minimal TM1637 bitbang for Zephyr (nRF52832) */
+/* tm1637.c - minimal TM1637 driver for Zephyr (nRF52832), bits are clocked out from a TIMER4 interrupt */
 
 #include "tm1637.h"
-#include <zephyr/sys/printk.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <zephyr/irq.h>
+#include <zephyr/logging/log.h>
+#ifdef CONFIG_TRICHTER_DISPLAY_TM1637
+#include <hal/nrf_timer.h>
+#endif
+
+LOG_MODULE_REGISTER(tm1637, CONFIG_TRICHTER_DISPLAY_LOG_LEVEL);
+
+/* Segment map (0–9) */
+static const uint8_t digit_to_segment[] = {
+    0x3f, /* 0 */
+    0x06, /* 1 */
+    0x5b, /* 2 */
+    0x4f, /* 3 */
+    0x66, /* 4 */
+    0x6d, /* 5 */
+    0x7d, /* 6 */
+    0x07, /* 7 */
+    0x7f, /* 8 */
+    0x6f, /* 9 */
+};
 
+#ifdef CONFIG_TRICHTER_DISPLAY_TM1637
 /* --- Devicetree handle --- */
 #define TM1637_NODE DT_NODELABEL(tm1637)
 #if !DT_NODE_HAS_STATUS_OKAY(TM1637_NODE)
@@ -20,118 +43,301 @@ static const struct gpio_dt_spec dio =
 /* Timing: microseconds pause */
 #define T_US 40
 
-/* Segment map (0–9) */
-static const uint8_t digit_to_segment[] = {
-    0x3f, /* 0 */
-    0x06, /* 1 */
-    0x5b, /* 2 */
-    0x4f, /* 3 */
-    0x66, /* 4 */
-    0x6d, /* 5 */
-    0x7d, /* 6 */
-    0x07, /* 7 */
-    0x7f, /* 8 */
-    0x6f, /* 9 */
+/*
+ * Non-blocking bit engine.
+ * A display update is compiled into a list of pin phases (one per T_US) and clocked out by the
+ * TIMER4 compare interrupt, one phase per interrupt. Callers only build the frame and return.
+ * While a frame is on the wire, one further frame can be pending; a newer submit replaces it,
+ * since only the latest display content matters.
+ */
+#define TM1637_TIMER            NRF_TIMER4
+#define TM1637_TIMER_IRQ_PRIO   5
+
+#define PHASE_CLK               BIT(0)
+#define PHASE_DIO               BIT(1)
+#define PHASE_DIO_RELEASE       BIT(2) /* DIO as input, TM1637 drives the ACK */
+#define PHASE_SAMPLE_ACK        BIT(3)
+
+#define PHASES_START            2
+#define PHASES_STOP             4
+#define PHASES_BYTE             (8 * 2 + 2)
+#define PHASES_MAX              (3 * (PHASES_START + PHASES_STOP) + (TM1637_FRAME_MAX_SEGMENTS + 3) * PHASES_BYTE)
+
+struct tm1637_request {
+    struct tm1637_frame frame;
+    tm1637_complete_cb cb;
+    void *user_data;
 };
 
+static uint8_t phases[PHASES_MAX];
+static uint16_t phase_count;
+static volatile uint16_t phase_idx;
+static bool dio_released;
+static uint8_t nacks;
+
+static struct tm1637_request active;
+static struct tm1637_request pending;
+static volatile bool active_valid;
+static bool pending_valid;
+
 /* --- GPIO helpers --- */
 static void dio_output(void) { gpio_pin_configure_dt(&dio, GPIO_OUTPUT); }
 static void dio_input(void)  { gpio_pin_configure_dt(&dio, GPIO_INPUT); }
 void clk_high(void)   { gpio_pin_set_dt(&clk, 1); }
 void clk_low(void)    { gpio_pin_set_dt(&clk, 0); }
 static void dio_high(void)   { gpio_pin_set_dt(&dio, 1); }
-static void dio_low(void)    { gpio_pin_set_dt(&dio, 0); }
 static int  dio_read(void)   { return gpio_pin_get_dt(&dio); }
 
-/* --- Protocol primitives --- */
+/* --- Protocol primitives, appended as phases --- */
+static void phase_add(uint8_t phase)
+{
+    if (phase_count < PHASES_MAX) {
+        phases[phase_count++] = phase;
+    }
+}
+
 static void tm1637_start(void)
 {
-    dio_output();
-    dio_high();
-    clk_high();
-    k_busy_wait(T_US);
-    dio_low();
-    k_busy_wait(T_US);
+    phase_add(PHASE_CLK | PHASE_DIO);
+    phase_add(PHASE_CLK);
 }
 
 static void tm1637_stop(void)
 {
-    dio_output();
-    clk_low();
-    k_busy_wait(T_US);
-    dio_low();
-    k_busy_wait(T_US);
-    clk_high();
-    k_busy_wait(T_US);
-    dio_high();
-    k_busy_wait(T_US);
+    phase_add(0);
+    phase_add(0);
+    phase_add(PHASE_CLK);
+    phase_add(PHASE_CLK | PHASE_DIO);
 }
 
-static bool tm1637_write_byte(uint8_t b)
+static void tm1637_write_byte(uint8_t b)
 {
     for (int i = 0; i < 8; i++) {
-        clk_low();
-        if (b & 0x01) dio_high(); else dio_low();
-        k_busy_wait(T_US);
-        clk_high();
-        k_busy_wait(T_US);
+        const uint8_t bit = (b & 0x01) ? PHASE_DIO : 0;
+        phase_add(bit);
+        phase_add(bit | PHASE_CLK);
         b >>= 1;
     }
 
     /* ACK cycle */
-    clk_low();
-    dio_input();
-    k_busy_wait(T_US);
-    clk_high();
-    k_busy_wait(T_US);
-    int ack = dio_read();
-    clk_low();
-    dio_output();
-    return (ack == 0);
+    phase_add(PHASE_DIO_RELEASE);
+    phase_add(PHASE_DIO_RELEASE | PHASE_CLK | PHASE_SAMPLE_ACK);
+}
+
+static void tm1637_compile(const struct tm1637_frame *frame)
+{
+    phase_count = 0;
+
+    /* command1: auto increment */
+    tm1637_start();
+    tm1637_write_byte(TM1637_CMD_AUTO_ADDR_INCR);
+    tm1637_stop();
+
+    /* command2: set starting address (0xC0), no address if there is no data */
+    tm1637_start();
+    if (frame->num_segments > 0) {
+        tm1637_write_byte(TM1637_CMD_SET_START_ADDR);
+        for (uint8_t i = 0; i < frame->num_segments; i++) {
+            tm1637_write_byte(frame->segments[i]);
+        }
+    }
+    tm1637_stop();
+
+    /* command3: brightness or display off */
+    tm1637_start();
+    tm1637_write_byte(frame->control);
+    tm1637_stop();
+}
+
+static void tm1637_apply_phase(uint8_t phase)
+{
+    const int clk_level = (phase & PHASE_CLK) ? 1 : 0;
+
+    /* DIO may only change while CLK is low, except for the START/STOP edges where CLK stays high */
+    if (!clk_level) {
+        gpio_pin_set_dt(&clk, 0);
+    }
+    if (phase & PHASE_DIO_RELEASE) {
+        if (!dio_released) {
+            dio_input();
+            dio_released = true;
+        }
+    } else {
+        if (dio_released) {
+            dio_output();
+            dio_released = false;
+        }
+        gpio_pin_set_dt(&dio, (phase & PHASE_DIO) ? 1 : 0);
+    }
+    if (clk_level) {
+        gpio_pin_set_dt(&clk, 1);
+    }
+}
+
+/* Must be called with interrupts locked and the engine idle */
+static void tm1637_begin(const struct tm1637_request *request)
+{
+    active = *request;
+    active_valid = true;
+    tm1637_compile(&active.frame);
+    phase_idx = 0;
+    nacks = 0;
+    nrf_timer_task_trigger(TM1637_TIMER, NRF_TIMER_TASK_CLEAR);
+    nrf_timer_task_trigger(TM1637_TIMER, NRF_TIMER_TASK_START);
+}
+
+static void tm1637_timer_isr(const void *arg)
+{
+    ARG_UNUSED(arg);
+
+    if (!nrf_timer_event_check(TM1637_TIMER, NRF_TIMER_EVENT_COMPARE0)) {
+        return;
+    }
+    nrf_timer_event_clear(TM1637_TIMER, NRF_TIMER_EVENT_COMPARE0);
+
+    /* ACK is sampled one phase after CLK went high, before the next phase pulls CLK low */
+    if (phase_idx > 0 && (phases[phase_idx - 1] & PHASE_SAMPLE_ACK) && dio_read() != 0) {
+        nacks++;
+    }
+    if (phase_idx < phase_count) {
+        tm1637_apply_phase(phases[phase_idx++]);
+        return;
+    }
+
+    /* frame done */
+    nrf_timer_task_trigger(TM1637_TIMER, NRF_TIMER_TASK_STOP);
+    const struct tm1637_request done = active;
+    const int result = (nacks == 0) ? TM1637_OK : -EIO;
+
+    active_valid = false;
+    if (pending_valid) {
+        pending_valid = false;
+        tm1637_begin(&pending);
+    }
+    if (done.cb != NULL) {
+        done.cb(result, done.user_data);
+    }
+}
+
+static void tm1637_timer_init(void)
+{
+    nrf_timer_task_trigger(TM1637_TIMER, NRF_TIMER_TASK_STOP);
+    nrf_timer_mode_set(TM1637_TIMER, NRF_TIMER_MODE_TIMER);
+    nrf_timer_bit_width_set(TM1637_TIMER, NRF_TIMER_BIT_WIDTH_16);
+    nrf_timer_prescaler_set(TM1637_TIMER, NRF_TIMER_FREQ_1MHz);
+    nrf_timer_cc_set(TM1637_TIMER, NRF_TIMER_CC_CHANNEL0, T_US);
+    nrf_timer_shorts_enable(TM1637_TIMER, NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK);
+    nrf_timer_event_clear(TM1637_TIMER, NRF_TIMER_EVENT_COMPARE0);
+    nrf_timer_int_enable(TM1637_TIMER, NRF_TIMER_INT_COMPARE0_MASK);
+
+    IRQ_CONNECT(TIMER4_IRQn, TM1637_TIMER_IRQ_PRIO, tm1637_timer_isr, NULL, 0);
+    irq_enable(TIMER4_IRQn);
 }
 
 /* --- Public API --- */
 int tm1637_init(void)
 {
     if (!device_is_ready(clk.port) || !device_is_ready(dio.port)) {
-        printk("Error: GPIO devices not ready\n");
+        LOG_ERR("GPIO devices not ready");
         return TM1637_ERROR;
     }
     if (gpio_pin_configure_dt(&clk, GPIO_OUTPUT) != 0 ||
         gpio_pin_configure_dt(&dio, GPIO_OUTPUT) != 0) {
-        printk("Error: failed to configure CLK/DIO pins\n");
+        LOG_ERR("failed to configure CLK/DIO pins");
         return TM1637_ERROR;
     }
     clk_high();
     dio_high();
     k_busy_wait(T_US);
-    printk("Set up CLK at %s pin %d\n", clk.port->name, clk.pin);
-    printk("Set up DIO at %s pin %d\n", dio.port->name, dio.pin);
+    LOG_DBG("Set up CLK at %s pin %d", clk.port->name, clk.pin);
+    LOG_DBG("Set up DIO at %s pin %d", dio.port->name, dio.pin);
 
+    tm1637_timer_init();
     tm1637_display_off();
     return TM1637_OK;
 }
 
-void tm1637_display_off()
+
+int tm1637_submit(const struct tm1637_frame *frame, tm1637_complete_cb cb, void *user_data)
 {
-     /* command1: auto increment */
-    tm1637_start();
-    tm1637_write_byte(TM1637_CMD_AUTO_ADDR_INCR);
-    tm1637_stop();
+    struct tm1637_request request = {
+        .frame = *frame,
+        .cb = cb,
+        .user_data = user_data,
+    };
+    struct tm1637_request replaced = { .cb = NULL };
 
-    /* command2: necessary, but transmit no data in init */
-    tm1637_start();
-    tm1637_stop();
+    if (frame->num_segments > TM1637_FRAME_MAX_SEGMENTS) {
+        return -EINVAL;
+    }
 
-    /* command3: brightness */
-    tm1637_start();
-    tm1637_write_byte(TM1637_CMD_DISPLAY_OFF);
-    tm1637_stop();
+    unsigned int key = irq_lock();
+    if (!active_valid) {
+        tm1637_begin(&request);
+    } else {
+        if (pending_valid) {
+            replaced = pending;
+        }
+        pending = request;
+        pending_valid = true;
+    }
+    irq_unlock(key);
+
+    if (replaced.cb != NULL) {
+        replaced.cb(-ECANCELED, replaced.user_data);
+    }
+    return TM1637_OK;
 }
 
 
-void tm1637_display_digits(uint8_t digits[], uint8_t num_digits, uint8_t brightness, uint8_t dot_at)
+bool tm1637_busy(void)
+{
+    return active_valid;
+}
+
+#else
+/* --- No display (native_sim): frames are dropped, the callback still runs --- */
+void clk_high(void) { }
+void clk_low(void)  { }
+
+int tm1637_init(void)
+{
+    return TM1637_OK;
+}
+
+
+int tm1637_submit(const struct tm1637_frame *frame, tm1637_complete_cb cb, void *user_data)
+{
+    if (frame->num_segments > TM1637_FRAME_MAX_SEGMENTS) {
+        return -EINVAL;
+    }
+    if (cb != NULL) {
+        cb(TM1637_OK, user_data);
+    }
+    return TM1637_OK;
+}
+
+
+bool tm1637_busy(void)
+{
+    return false;
+}
+#endif //CONFIG_TRICHTER_DISPLAY_TM1637
+
+
+/* --- Frame builders, usable without sending (see display.c) --- */
+void tm1637_frame_off(struct tm1637_frame *frame)
 {
+    memset(frame, 0, sizeof(*frame));
+    frame->control = TM1637_CMD_DISPLAY_OFF;
+}
+
+
+void tm1637_frame_digits(struct tm1637_frame *frame, const uint8_t digits[], uint8_t num_digits, uint8_t brightness, uint8_t dot_at)
+{
+    memset(frame, 0, sizeof(*frame));
+    frame->num_segments = 4;
+
     if (brightness > 7)
     {
         brightness = 7;
@@ -140,14 +346,6 @@ void tm1637_display_digits(uint8_t digits[], uint8_t num_digits, uint8_t brightn
     {
         num_digits = 4;
     }
-    /* command1: auto increment */
-    tm1637_start();
-    tm1637_write_byte(TM1637_CMD_AUTO_ADDR_INCR);
-    tm1637_stop();
-
-    /* command2: set starting address (0xC0) */
-    tm1637_start();
-    tm1637_write_byte(TM1637_CMD_SET_START_ADDR);
     for (int i = 0; i < 4; i++) {
         uint8_t seg = digit_to_segment[digits[i] % 10];
         if (i == dot_at)
@@ -158,82 +356,62 @@ void tm1637_display_digits(uint8_t digits[], uint8_t num_digits, uint8_t brightn
         {
             seg = 0;
         }
-        tm1637_write_byte(seg);
+        frame->segments[i] = seg;
     }
-    tm1637_stop();
-
-    /* command3: brightness */
-    tm1637_start();
-    tm1637_write_byte(TM1637_CMD_SET_BRIGHT | (brightness & 0x07));
-    tm1637_stop();
+    frame->control = TM1637_CMD_SET_BRIGHT | (brightness & 0x07);
 }
 
 
-static void tm1637_display_letters(uint8_t *letters, uint8_t brightness)
+static void tm1637_frame_letters(struct tm1637_frame *frame, const uint8_t *letters, uint8_t brightness)
 {
+    memset(frame, 0, sizeof(*frame));
+    frame->num_segments = 5;
+
     if (brightness >= 7)
     {
         brightness = 7;
     }
-
-    /* command1: auto increment */
-    tm1637_start();
-    tm1637_write_byte(TM1637_CMD_AUTO_ADDR_INCR);
-    tm1637_stop();
-
-    /* command2: set starting address (0xC0) */
-    tm1637_start();
-    tm1637_write_byte(TM1637_CMD_SET_START_ADDR);
     for (uint8_t idx = 0; idx < 4; idx++)
     {
-        tm1637_write_byte(letters[idx]);
+        frame->segments[idx] = letters[idx];
     }
-    tm1637_write_byte(TM1637_BYTE_EMPTY_SEG);
-    tm1637_stop();
-
-    /* command3: brightness */
-    tm1637_start();
-    tm1637_write_byte(TM1637_CMD_SET_BRIGHT | (brightness & 0x07));
-    tm1637_stop();
-} 
+    frame->segments[4] = TM1637_BYTE_EMPTY_SEG;
+    frame->control = TM1637_CMD_SET_BRIGHT | (brightness & 0x07);
+}
 
 
-void tm1637_display_ready(uint8_t brightness)
+void tm1637_frame_ready(struct tm1637_frame *frame, uint8_t brightness)
 {
 
     uint8_t letter_r = 0b00110001;
     uint8_t letter_d = 0b01011110;
     uint8_t letter_y = 0b01101110;
-    uint8_t letters[] = {
+    uint8_t letters[4] = {
         letter_r,
         letter_d,
         letter_y
     };
 
-   tm1637_display_letters(letters, brightness);
+   tm1637_frame_letters(frame, letters, brightness);
 }
 
 
-void tm1637_display_error_message(uint8_t brightness)
+void tm1637_frame_error_message(struct tm1637_frame *frame, uint8_t brightness)
 {
     uint8_t letter_E = 0b01111001;
     uint8_t letter_r = 0b00110001;
 
-    uint8_t letters[] = {
+    uint8_t letters[4] = {
         letter_E,
         letter_r,
         letter_r
     };
-    tm1637_display_letters(letters, brightness);
+    tm1637_frame_letters(frame, letters, brightness);
 }
 
 
-void tm1637_display_bier(uint8_t brightness)
+void tm1637_frame_bier(struct tm1637_frame *frame, uint8_t brightness)
 {
-    if (brightness >= 7)
-    {
-        brightness = 7;
-    }
     uint8_t letter_b = 0b01111100;
     uint8_t letter_I = 0b00000110;
     uint8_t letter_E = 0b01111001;
@@ -245,24 +423,69 @@ void tm1637_display_bier(uint8_t brightness)
         letter_E,
         letter_r
     };
-    tm1637_display_letters(letters, brightness);
+    tm1637_frame_letters(frame, letters, brightness);
 }
 
 
-void tm1637_display_cal(uint8_t brightness)
+void tm1637_frame_cal(struct tm1637_frame *frame, uint8_t brightness)
 {
-    if (brightness >= 7)
-    {
-        brightness = 7;
-    }
     uint8_t letter_C = 0b00111001;
     uint8_t letter_A = 0b01110111;
     uint8_t letter_L = 0b10111000;
 
-    uint8_t letters[] = {
+    uint8_t letters[4] = {
         letter_C,
         letter_A,
         letter_L
     };
-    tm1637_display_letters(letters, brightness);
+    tm1637_frame_letters(frame, letters, brightness);
+}
+
+
+/* --- Immediate display helpers, every call goes on the wire --- */
+void tm1637_display_off()
+{
+    struct tm1637_frame frame;
+    tm1637_frame_off(&frame);
+    tm1637_submit(&frame, NULL, NULL);
+}
+
+
+void tm1637_display_digits(uint8_t digits[], uint8_t num_digits, uint8_t brightness, uint8_t dot_at)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_digits(&frame, digits, num_digits, brightness, dot_at);
+    tm1637_submit(&frame, NULL, NULL);
+}
+
+
+void tm1637_display_ready(uint8_t brightness)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_ready(&frame, brightness);
+    tm1637_submit(&frame, NULL, NULL);
+}
+
+
+void tm1637_display_error_message(uint8_t brightness)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_error_message(&frame, brightness);
+    tm1637_submit(&frame, NULL, NULL);
+}
+
+
+void tm1637_display_bier(uint8_t brightness)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_bier(&frame, brightness);
+    tm1637_submit(&frame, NULL, NULL);
+}
+
+
+void tm1637_display_cal(uint8_t brightness)
+{
+    struct tm1637_frame frame;
+    tm1637_frame_cal(&frame, brightness);
+    tm1637_submit(&frame, NULL, NULL);
 }
\ No newline at end of file
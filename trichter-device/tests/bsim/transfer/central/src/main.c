@@ -0,0 +1,475 @@
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "bstests.h"
+#include "babblekit/testcase.h"
+
+#include "bluetooth.h"
+#include "bluetooth_common.h"
+#include "session.h"
+#include "transfer_matrix.h"
+
+/*
+Plays the app against the DUT: applies PHY and connection interval of each row of the transfer
+matrix, writes READY, downloads the session over the windowed transfer like the app does and prints
+one result line per row. Connection parameter requests of the DUT are rejected so every row runs on
+the link the central set up. The ATT MTU is that of the build, see testcase.yaml.
+*/
+
+#define DUT_NAME                "BIERORGLER" //CONFIG_BT_DEVICE_NAME of the DUT
+#define CONN_TIMEOUT            400 //4 s supervision timeout
+#define LINK_SETUP_WAIT_MS      1500 //the DUT negotiates 2M, DLE and the MTU 1 s after connecting
+#define PROCEDURE_TIMEOUT_MS    5000
+#define SESSION_TIMEOUT_MS      60000 //recording at TRANSFER_SPEEDUP plus the end of run timeout
+#define END_TIMEOUT_MS          10000
+#define NACK_RANGES_PER_ROUND   8 //TRANSFER_NACK_QUEUE_DEPTH of the DUT
+
+#define PACKET_HEADER_SIZE      4 //u8 flag, u16 chunk index, u8 data size, packed
+#define MIN_CHUNK_SIZE          16 //ATT MTU 23
+#define MAX_PAYLOAD_SIZE        (TRANSFER_MAX_PULSES * sizeof(uint32_t))
+#define MAX_CHUNKS              DIV_ROUND_UP(MAX_PAYLOAD_SIZE, MIN_CHUNK_SIZE)
+
+/*Link info characteristic, see read_link_info()*/
+#define LINK_INFO_SIZE          15
+#define LINK_INFO_TX_PHY        0
+#define LINK_INFO_TX_DATA_LEN   2
+#define LINK_INFO_INTERVAL      6
+#define LINK_INFO_MTU           12
+
+static struct bt_conn *g_conn;
+static K_SEM_DEFINE(g_connected, 0, 1);
+static K_SEM_DEFINE(g_procedure, 0, 1);     //discovery, read, write, PHY and parameter update done
+static K_SEM_DEFINE(g_start, 0, 1);
+static K_SEM_DEFINE(g_end, 0, 1);
+static int g_procedure_err;
+
+static struct bt_uuid_128 g_transfer_uuid = BT_UUID_INIT_128(BT_UUID_TRANSFER_CHAR_VAL);
+static struct bt_uuid_128 g_remote_state_uuid = BT_UUID_INIT_128(BT_UUID_REMOTE_STATE_CHAR_VAL);
+static struct bt_uuid_128 g_link_info_uuid = BT_UUID_INIT_128(BT_UUID_LINK_INFO_CHAR_VAL);
+static uint16_t g_transfer_handle;
+static uint16_t g_remote_state_handle;
+static uint16_t g_link_info_handle;
+
+static uint8_t g_link_info[LINK_INFO_SIZE];
+
+/*Session being received, written from the notification callback*/
+static struct {
+    uint16_t count;
+    uint16_t seq;
+    uint16_t payload_size;
+    uint8_t encoding;
+    uint8_t chunk_size;
+    uint16_t num_chunks;
+    bool received[MAX_CHUNKS];
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    int64_t started_at;
+} g_rx;
+
+
+// =========================================================================
+//  CONNECTION
+// =========================================================================
+
+static bool ad_is_dut(struct bt_data *data, void *user_data)
+{
+    bool *found = user_data;
+
+    if (data->type == BT_DATA_NAME_COMPLETE) {
+        *found = (data->data_len == strlen(DUT_NAME)) && memcmp(data->data, DUT_NAME, data->data_len) == 0;
+        return false;
+    }
+    return true;
+}
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type, struct net_buf_simple *ad)
+{
+    struct transfer_row row;
+    bool found = false;
+
+    if (g_conn != NULL) {
+        return;
+    }
+    bt_data_parse(ad, ad_is_dut, &found);
+    if (!found) {
+        return;
+    }
+    TEST_ASSERT(bt_le_scan_stop() == 0, "scan stop failed");
+
+    transfer_row_get(0, &row);
+    const struct bt_le_conn_param param = BT_LE_CONN_PARAM_INIT(row.interval, row.interval, 0, CONN_TIMEOUT);
+    int err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, &param, &g_conn);
+    TEST_ASSERT(err == 0, "connection create failed (%d)", err);
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+    TEST_ASSERT(err == 0, "connection failed (0x%02x)", err);
+    k_sem_give(&g_connected);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+    TEST_FAIL("disconnected (0x%02x)", reason);
+}
+
+/*The central owns the link parameters of the benchmark*/
+static bool le_param_req(struct bt_conn *conn, struct bt_le_conn_param *param)
+{
+    return false;
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+    k_sem_give(&g_procedure);
+}
+
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+    k_sem_give(&g_procedure);
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+    .connected = connected,
+    .disconnected = disconnected,
+    .le_param_req = le_param_req,
+    .le_param_updated = le_param_updated,
+    .le_phy_updated = le_phy_updated,
+};
+
+
+/*Also the DUT's own PHY request completes a procedure, only count those started after this*/
+static void procedure_begin(void)
+{
+    g_procedure_err = 0;
+    k_sem_reset(&g_procedure);
+}
+
+static void procedure_wait(const char *what)
+{
+    TEST_ASSERT(k_sem_take(&g_procedure, K_MSEC(PROCEDURE_TIMEOUT_MS)) == 0, "%s timed out", what);
+    TEST_ASSERT(g_procedure_err == 0, "%s failed (%d)", what, g_procedure_err);
+}
+
+
+// =========================================================================
+//  GATT
+// =========================================================================
+
+static void mtu_exchanged(struct bt_conn *conn, uint8_t err, struct bt_gatt_exchange_params *params)
+{
+    g_procedure_err = err;
+    k_sem_give(&g_procedure);
+}
+
+static struct bt_gatt_exchange_params g_mtu_params = {
+    .func = mtu_exchanged
+};
+
+static uint8_t discovered(struct bt_conn *conn, const struct bt_gatt_attr *attr, struct bt_gatt_discover_params *params)
+{
+    if (attr == NULL) {
+        k_sem_give(&g_procedure);
+        return BT_GATT_ITER_STOP;
+    }
+    const struct bt_gatt_chrc *chrc = attr->user_data;
+
+    if (bt_uuid_cmp(chrc->uuid, &g_transfer_uuid.uuid) == 0) {
+        g_transfer_handle = chrc->value_handle;
+    } else if (bt_uuid_cmp(chrc->uuid, &g_remote_state_uuid.uuid) == 0) {
+        g_remote_state_handle = chrc->value_handle;
+    } else if (bt_uuid_cmp(chrc->uuid, &g_link_info_uuid.uuid) == 0) {
+        g_link_info_handle = chrc->value_handle;
+    }
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static struct bt_gatt_discover_params g_discover_params = {
+    .func = discovered,
+    .start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE,
+    .end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE,
+    .type = BT_GATT_DISCOVER_CHARACTERISTIC,
+};
+
+static uint8_t link_info_read(struct bt_conn *conn, uint8_t err, struct bt_gatt_read_params *params,
+                              const void *data, uint16_t length)
+{
+    g_procedure_err = (err != 0 || data == NULL || length != LINK_INFO_SIZE) ? -EIO : 0;
+    if (g_procedure_err == 0) {
+        memcpy(g_link_info, data, LINK_INFO_SIZE);
+    }
+    k_sem_give(&g_procedure);
+    return BT_GATT_ITER_STOP;
+}
+
+static void written(struct bt_conn *conn, uint8_t err, struct bt_gatt_write_params *params)
+{
+    g_procedure_err = err;
+    k_sem_give(&g_procedure);
+}
+
+static void write_wait(uint16_t handle, const uint8_t *data, uint16_t length)
+{
+    static struct bt_gatt_write_params params;
+
+    params = (struct bt_gatt_write_params){
+        .func = written,
+        .handle = handle,
+        .data = data,
+        .length = length,
+    };
+    procedure_begin();
+    TEST_ASSERT(bt_gatt_write(g_conn, &params) == 0, "write to 0x%04x not started", handle);
+    procedure_wait("write");
+}
+
+/*Same packets as the app's TrichterDataHandler gets*/
+static uint8_t transfer_notified(struct bt_conn *conn, struct bt_gatt_subscribe_params *params,
+                                 const void *data, uint16_t length)
+{
+    const uint8_t *packet = data;
+
+    if (data == NULL || length < PACKET_HEADER_SIZE) {
+        return BT_GATT_ITER_CONTINUE;
+    }
+    const uint16_t index = sys_get_le16(packet + 1);
+    const uint8_t size = packet[3];
+
+    switch (packet[0]) {
+    case TX_FLAG_START:
+        TEST_ASSERT(length >= PACKET_HEADER_SIZE + START_PAYLOAD_SIZE, "short START (%u)", length);
+        TEST_ASSERT(size >= MIN_CHUNK_SIZE, "chunk size %u", size);
+        g_rx.started_at = k_uptime_get();
+        g_rx.count = sys_get_le16(packet + PACKET_HEADER_SIZE);
+        g_rx.seq = sys_get_le16(packet + PACKET_HEADER_SIZE + 8);
+        g_rx.payload_size = sys_get_le16(packet + PACKET_HEADER_SIZE + 10);
+        g_rx.encoding = packet[PACKET_HEADER_SIZE + 12];
+        g_rx.chunk_size = size;
+        g_rx.num_chunks = DIV_ROUND_UP(g_rx.payload_size, size);
+        TEST_ASSERT(g_rx.payload_size <= MAX_PAYLOAD_SIZE, "payload of %u bytes", g_rx.payload_size);
+        memset(g_rx.received, 0, sizeof(g_rx.received));
+        k_sem_give(&g_start);
+        break;
+    case TX_FLAG_DATA:
+        if (index >= g_rx.num_chunks || length != PACKET_HEADER_SIZE + size ||
+            (uint32_t)index * g_rx.chunk_size + size > g_rx.payload_size) {
+            TEST_FAIL("bad chunk %u of %u bytes", index, size);
+        }
+        memcpy(&g_rx.payload[(uint32_t)index * g_rx.chunk_size], packet + PACKET_HEADER_SIZE, size);
+        g_rx.received[index] = true;
+        break;
+    case TX_FLAG_END:
+        k_sem_give(&g_end);
+        break;
+    default:
+        TEST_FAIL("unexpected packet 0x%02x", packet[0]);
+    }
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static void subscribed(struct bt_conn *conn, uint8_t err, struct bt_gatt_subscribe_params *params)
+{
+    g_procedure_err = err;
+    k_sem_give(&g_procedure);
+}
+
+static struct bt_gatt_discover_params g_ccc_discover_params;
+static struct bt_gatt_subscribe_params g_subscribe_params = {
+    .notify = transfer_notified,
+    .subscribe = subscribed,
+    .ccc_handle = BT_GATT_AUTO_DISCOVER_CCC_HANDLE,
+    .end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE,
+    .disc_params = &g_ccc_discover_params,
+    .value = BT_GATT_CCC_NOTIFY,
+};
+
+
+// =========================================================================
+//  BENCHMARK
+// =========================================================================
+
+static void link_apply(const struct transfer_row *row)
+{
+    const uint8_t phy = g_link_info[LINK_INFO_TX_PHY];
+    const uint16_t interval = sys_get_le16(&g_link_info[LINK_INFO_INTERVAL]);
+
+    if (phy != row->phy) {
+        const struct bt_conn_le_phy_param param = {
+            .options = BT_CONN_LE_PHY_OPT_NONE,
+            .pref_tx_phy = (row->phy == BT_GAP_LE_PHY_2M) ? BT_GAP_LE_PHY_2M : BT_GAP_LE_PHY_1M,
+            .pref_rx_phy = (row->phy == BT_GAP_LE_PHY_2M) ? BT_GAP_LE_PHY_2M : BT_GAP_LE_PHY_1M,
+        };
+        procedure_begin();
+        TEST_ASSERT(bt_conn_le_phy_update(g_conn, &param) == 0, "PHY update not started");
+        procedure_wait("PHY update");
+    }
+    if (interval != row->interval) {
+        const struct bt_le_conn_param param = BT_LE_CONN_PARAM_INIT(row->interval, row->interval, 0, CONN_TIMEOUT);
+        procedure_begin();
+        TEST_ASSERT(bt_conn_le_param_update(g_conn, &param) == 0, "parameter update not started");
+        procedure_wait("connection parameter update");
+    }
+}
+
+static void link_info_get(void)
+{
+    static struct bt_gatt_read_params params;
+
+    params = (struct bt_gatt_read_params){
+        .func = link_info_read,
+        .handle_count = 1,
+        .single = {.handle = g_link_info_handle, .offset = 0},
+    };
+    procedure_begin();
+    TEST_ASSERT(bt_gatt_read(g_conn, &params) == 0, "link info read not started");
+    procedure_wait("link info read");
+}
+
+static bool session_complete(void)
+{
+    for (uint16_t i = 0; i < g_rx.num_chunks; i++) {
+        if (!g_rx.received[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*NACKs the first missing ranges, as many as the DUT queues per round. Returns the chunks requested.*/
+static uint16_t session_nack(void)
+{
+    uint8_t nack[5] = {TRANSFER_OP_NACK};
+    uint16_t requested = 0;
+    uint8_t ranges = 0;
+
+    for (uint16_t i = 0; i < g_rx.num_chunks && ranges < NACK_RANGES_PER_ROUND; i++) {
+        if (g_rx.received[i]) {
+            continue;
+        }
+        uint16_t count = 1;
+        while (i + count < g_rx.num_chunks && !g_rx.received[i + count]) {
+            count++;
+        }
+        sys_put_le16(i, &nack[1]);
+        sys_put_le16(count, &nack[3]);
+        write_wait(g_transfer_handle, nack, sizeof(nack));
+        requested += count;
+        ranges++;
+        i += count;
+    }
+    return requested;
+}
+
+static void session_check(uint16_t row_index, const struct transfer_row *row)
+{
+    TEST_ASSERT(g_rx.count == row->pulses, "row %u: %u pulses instead of %u", row_index, g_rx.count, row->pulses);
+    TEST_ASSERT(g_rx.encoding == SESSION_ENCODING_RAW, "row %u: encoding %u", row_index, g_rx.encoding);
+    TEST_ASSERT(g_rx.payload_size == row->pulses * sizeof(uint32_t), "row %u: %u bytes", row_index, g_rx.payload_size);
+    for (uint16_t i = 0; i < g_rx.count; i++) {
+        const uint32_t tick = sys_get_le32(&g_rx.payload[i * sizeof(uint32_t)]);
+        const uint32_t expected = transfer_tick(i);
+        const uint32_t error = (tick > expected) ? tick - expected : expected - tick;
+
+        TEST_ASSERT(error <= TRANSFER_TICK_TOLERANCE, "row %u, pulse %u: tick %u instead of %u",
+                    row_index, i, tick, expected);
+    }
+}
+
+static void session_run(uint16_t row_index, const struct transfer_row *row)
+{
+    static const uint8_t ready = REMOTE_STATE_CMD_READY;
+    uint8_t ack[3] = {TRANSFER_OP_ACK};
+    uint16_t resent = 0;
+
+    link_apply(row);
+    link_info_get();
+    TEST_ASSERT(g_link_info[LINK_INFO_TX_PHY] == row->phy, "row %u: PHY %u", row_index, g_link_info[LINK_INFO_TX_PHY]);
+    TEST_ASSERT(sys_get_le16(&g_link_info[LINK_INFO_INTERVAL]) == row->interval, "row %u: interval %u",
+                row_index, sys_get_le16(&g_link_info[LINK_INFO_INTERVAL]));
+
+    k_sem_reset(&g_start);
+    k_sem_reset(&g_end);
+    write_wait(g_remote_state_handle, &ready, sizeof(ready));
+    TEST_ASSERT(k_sem_take(&g_start, K_MSEC(SESSION_TIMEOUT_MS)) == 0, "row %u: no START", row_index);
+
+    for (;;) {
+        TEST_ASSERT(k_sem_take(&g_end, K_MSEC(END_TIMEOUT_MS)) == 0, "row %u: no END", row_index);
+        if (session_complete()) {
+            break;
+        }
+        resent += session_nack();
+    }
+    const int64_t duration_ms = MAX(k_uptime_get() - g_rx.started_at, 1);
+    sys_put_le16(g_rx.seq, &ack[1]);
+    write_wait(g_transfer_handle, ack, sizeof(ack));
+    session_check(row_index, row);
+
+    printk("transfer: MTU %u, PHY %u, interval %u.%02u ms, DLE %u: %u pulses, %u B in %u ms, %u B/s, %u chunks resent\n",
+           sys_get_le16(&g_link_info[LINK_INFO_MTU]), row->phy, (row->interval * 125) / 100, (row->interval * 125) % 100,
+           sys_get_le16(&g_link_info[LINK_INFO_TX_DATA_LEN]), g_rx.count, g_rx.payload_size, (uint32_t)duration_ms,
+           (uint32_t)((g_rx.payload_size * 1000LL) / duration_ms), resent);
+}
+
+
+static void test_central_main(void)
+{
+    static const uint8_t ready = REMOTE_STATE_CMD_READY;
+    struct transfer_row row;
+
+    TEST_ASSERT(bt_enable(NULL) == 0, "Bluetooth init failed");
+    TEST_ASSERT(bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found) == 0, "scan start failed");
+    TEST_ASSERT(k_sem_take(&g_connected, K_SECONDS(10)) == 0, "DUT not found");
+
+    k_msleep(LINK_SETUP_WAIT_MS);
+    procedure_begin();
+    int err = bt_gatt_exchange_mtu(g_conn, &g_mtu_params);
+    if (err != -EALREADY) { //the DUT may have exchanged it already
+        TEST_ASSERT(err == 0, "MTU exchange not started (%d)", err);
+        procedure_wait("MTU exchange");
+    }
+    procedure_begin();
+    TEST_ASSERT(bt_gatt_discover(g_conn, &g_discover_params) == 0, "discovery not started");
+    procedure_wait("discovery");
+    TEST_ASSERT(g_transfer_handle && g_remote_state_handle && g_link_info_handle, "characteristics missing");
+    g_subscribe_params.value_handle = g_transfer_handle;
+    procedure_begin();
+    TEST_ASSERT(bt_gatt_subscribe(g_conn, &g_subscribe_params) == 0, "subscribe not started");
+    procedure_wait("subscribe");
+
+    link_info_get();
+    for (uint16_t i = 0; i < TRANSFER_ROWS; i++) {
+        transfer_row_get(i, &row);
+        session_run(i, &row);
+    }
+    write_wait(g_remote_state_handle, &ready, sizeof(ready)); //lets the DUT finish
+    TEST_PASS("%u rows", TRANSFER_ROWS);
+}
+
+
+static const struct bst_test_instance test_central[] = {
+    {
+        .test_id = "central",
+        .test_descr = "Downloads one session per row of the transfer matrix and reports time and goodput",
+        .test_main_f = test_central_main,
+    },
+    BSTEST_END_MARKER
+};
+
+
+struct bst_test_list *test_central_install(struct bst_test_list *tests)
+{
+    return bst_add_tests(tests, test_central);
+}
+
+
+bst_test_install_t test_installers[] = {test_central_install, NULL};
+
+
+int main(void)
+{
+    bst_main();
+    return 0;
+}
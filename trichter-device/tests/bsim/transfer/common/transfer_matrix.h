@@ -0,0 +1,48 @@
+#ifndef TRANSFER_MATRIX_H
+#define TRANSFER_MATRIX_H
+
+#include <stdint.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/bluetooth/gap.h>
+
+/*
+Link settings and session sizes of the transfer benchmark, one session per row with the session size
+changing fastest. The central applies PHY and connection interval of a row, then writes READY; the DUT
+records the session of that row and sends it. The ATT MTU is fixed per central build.
+*/
+
+#define TRANSFER_STEP_TICKS         1250 //10 ms between pulses, in recorded time
+#define TRANSFER_SPEEDUP            4
+#define TRANSFER_TICK_TOLERANCE     16 //the bsim cycle counter runs at 32768 Hz, 125 kHz * 4 / 32768 = 15.3 ticks per cycle
+#define TRANSFER_MAX_PULSES         1500
+
+static const uint8_t transfer_phys[] = {BT_GAP_LE_PHY_1M, BT_GAP_LE_PHY_2M};
+static const uint16_t transfer_intervals[] = {6, 24, 80}; //7.5, 30 and 100 ms
+static const uint16_t transfer_pulses[] = {50, 500, TRANSFER_MAX_PULSES};
+
+#define TRANSFER_ROWS   (ARRAY_SIZE(transfer_phys) * ARRAY_SIZE(transfer_intervals) * ARRAY_SIZE(transfer_pulses))
+
+struct transfer_row {
+    uint8_t phy;
+    uint16_t interval;          //1.25 ms units
+    uint16_t pulses;
+};
+
+
+static inline void transfer_row_get(uint16_t index, struct transfer_row *row)
+{
+    row->pulses = transfer_pulses[index % ARRAY_SIZE(transfer_pulses)];
+    index /= ARRAY_SIZE(transfer_pulses);
+    row->interval = transfer_intervals[index % ARRAY_SIZE(transfer_intervals)];
+    index /= ARRAY_SIZE(transfer_intervals);
+    row->phy = transfer_phys[index];
+}
+
+
+/*Tick of pulse i as played by the DUT, relative to the first one like the stored session*/
+static inline uint32_t transfer_tick(uint16_t i)
+{
+    return (uint32_t)i * TRANSFER_STEP_TICKS;
+}
+
+#endif //TRANSFER_MATRIX_H
@@ -0,0 +1,115 @@
+#include <zephyr/kernel.h>
+
+#include "bstests.h"
+#include "babblekit/testcase.h"
+
+#include "state_machine.h"
+#include "tm1637.h"
+#include "runtime.h"
+#include "fsm_core.h"
+#include "bluetooth.h"
+#include "memory.h"
+#include "session_log.h"
+#include "pulse_injector.h"
+#include "transfer_matrix.h"
+
+/*
+The unchanged application on the simulated nRF52, with the pulse injector in place of the sensor.
+Every READY the central writes starts the next row: the DUT records a session of row.pulses pulses
+and the runtime sends it to the central like any other. Link settings are entirely up to the central.
+*/
+
+#define READY_TIMEOUT_MS    40000 //a session the central did not ACK ends after the 30 s SENDING timeout
+
+static uint32_t g_ticks[TRANSFER_MAX_PULSES];
+static K_SEM_DEFINE(g_go, 0, 1);
+
+
+static void remote_state_handler(RemoteState state)
+{
+    if (state == REMOTE_STATE_CMD_READY)
+    {
+        k_sem_give(&g_go);
+    }
+    ble_remote_state_dispatch(state);
+}
+
+
+static bool wait_for_state(StateID_t id, uint32_t timeout_ms)
+{
+    for (uint32_t waited = 0; g_stateMachine.current->id != id; waited++)
+    {
+        if (waited >= timeout_ms)
+        {
+            return false;
+        }
+        k_msleep(1);
+    }
+    return true;
+}
+
+
+static void test_dut_main(void)
+{
+    struct transfer_row row;
+
+    for (uint16_t i = 0; i < TRANSFER_MAX_PULSES; i++)
+    {
+        g_ticks[i] = transfer_tick(i);
+    }
+
+    /*Same order as main()*/
+    init_seven_seg();
+    capture_lanes_init();
+    init_gpio_inputs();
+    init_gpio_outputs();
+    init_memory_nv();
+    session_log_init();
+    init_ble(TIMER_TICK_DURATION_US);
+    ble_register_state_input_handler(remote_state_handler);
+    calib_attempt_register_notifier(ble_calibration_attempt_notifier);
+    state_machine_register_notifier(ble_state_notifier);
+    bluetooth_advertising_fsm_start();
+    pulse_injector_set_speedup(TRANSFER_SPEEDUP);
+    fsm_start();
+    on_trichter_startup();
+
+    for (uint16_t i = 0; i < TRANSFER_ROWS; i++)
+    {
+        transfer_row_get(i, &row);
+        k_sem_take(&g_go, K_FOREVER);
+        TEST_ASSERT(wait_for_state(STATE_READY, READY_TIMEOUT_MS), "row %u: no READY", i);
+        TEST_ASSERT(pulse_injector_play(0, g_ticks, row.pulses) == 0, "row %u: injector busy", i);
+        TEST_ASSERT(pulse_injector_wait(0, K_MSEC(READY_TIMEOUT_MS)) == 0, "row %u: train did not end", i);
+    }
+
+    /*The central writes READY once more after checking the last session*/
+    k_sem_take(&g_go, K_FOREVER);
+    TEST_PASS("%u sessions sent", TRANSFER_ROWS);
+}
+
+
+static const struct bst_test_instance test_dut[] = {
+    {
+        .test_id = "dut",
+        .test_descr = "Records one session per row of the transfer matrix and sends it to the central",
+        .test_main_f = test_dut_main,
+    },
+    BSTEST_END_MARKER
+};
+
+
+struct bst_test_list *test_dut_install(struct bst_test_list *tests)
+{
+    return bst_add_tests(tests, test_dut);
+}
+
+
+bst_test_install_t test_installers[] = {test_dut_install, NULL};
+
+
+int main(void)
+{
+    bst_main();
+    return 0;
+}
@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: Apache-2.0
+#
+# Transfer benchmark: the DUT sends one session per row of common/transfer_matrix.h to the simulated
+# central, once per central build (ATT MTU 23, 79 and 247). Build first with
+#   west twister -p nrf52_bsim -T tests/bsim
+# Extra arguments go to the phy, e.g. -defmodem=BLE_simple -argsdefmodem -BER 1e-5 for bit errors.
+# Result lines of the central start with "transfer:", the DUT logs its own per session.
+
+source ${ZEPHYR_BASE}/tests/bsim/sh_common.source
+
+EXECUTE_TIMEOUT=1800
+cd ${BSIM_OUT_PATH}/bin
+
+for mtu in 23 79 247; do
+  simulation_id="trichter_transfer_mtu${mtu}"
+  verbosity_level=2
+
+  Execute ./bs_${BOARD_TS}_trichter_transfer_dut \
+    -v=${verbosity_level} -s=${simulation_id} -d=0 -testid=dut -RealEncryption=0
+  Execute ./bs_${BOARD_TS}_trichter_transfer_central_mtu${mtu} \
+    -v=${verbosity_level} -s=${simulation_id} -d=1 -testid=central -RealEncryption=0
+  Execute ./bs_2G4_phy_v1 -v=${verbosity_level} -s=${simulation_id} -D=2 -sim_length=1200e6 "$@"
+
+  wait_for_background_jobs
+done
@@ -0,0 +1,140 @@
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "runtime.h"
+#include "fsm_core.h"
+#include "memory.h"
+#include "session_log.h"
+#include "session_pool.h"
+#include "end_of_run.h"
+#include "capture_backend.h"
+#include "pulse_injector.h"
+#include "recorded_session.h"
+
+/*
+Replays a recorded run through the simulated capture backend into the unchanged runtime, from READY
+through the burst qualification and RUNNING to SENDING, and checks what the board would have sent.
+*/
+
+#define REPLAY_SPEEDUP              4 //125 kHz * 4 divides the 1 MHz cycle counter, every tick is whole cycles
+#define REPLAY_TIMEOUT_MS           10000
+#define END_OF_RUN_LATENCY_TICKS    (TIMER_TICKS_PER_MS * 20) //compare to FSM to RunningExit, in recorded time
+
+static uint32_t g_ticks[RECORDED_SESSION_PULSES];
+
+
+static bool wait_for_state(StateID_t id, uint32_t timeout_ms)
+{
+    for (uint32_t waited = 0; g_stateMachine.current->id != id; waited++)
+    {
+        if (waited >= timeout_ms)
+        {
+            return false;
+        }
+        k_msleep(1);
+    }
+    return true;
+}
+
+
+/*Timeout the runtime arms after the last pulse of the recording*/
+static uint32_t recorded_end_of_run(void)
+{
+    struct end_of_run eor;
+
+    end_of_run_init(&eor, END_OF_RUN_MIN_TICKS, END_OF_RUN_MAX_TICKS, CONFIG_TRICHTER_END_OF_RUN_MULTIPLE);
+    for (uint16_t i = 0; i < RECORDED_SESSION_PULSES; i++)
+    {
+        end_of_run_update(&eor, recorded_session_ticks[i] - recorded_session_ticks[0]);
+    }
+    return end_of_run_timeout(&eor);
+}
+
+
+/*Same order as main()*/
+static void *replay_setup(void)
+{
+    init_seven_seg();
+    capture_lanes_init();
+    init_gpio_inputs();
+    init_gpio_outputs();
+    init_memory_nv();
+    session_log_init();
+    init_ble(TIMER_TICK_DURATION_US);
+    pulse_injector_set_speedup(REPLAY_SPEEDUP);
+    fsm_start();
+    on_trichter_startup();
+    zassert_true(wait_for_state(STATE_READY, 1000), "no READY after startup");
+    return NULL;
+}
+
+
+static void replay_before(void *fixture)
+{
+    struct session *session;
+
+    while ((session = session_pool_next_queued()) != NULL)
+    {
+        session_pool_release(session);
+    }
+    if (g_stateMachine.current->id != STATE_READY)
+    {
+        input_request_state_ready();
+    }
+    zassert_true(wait_for_state(STATE_READY, 1000), "no READY before the replay");
+}
+
+
+ZTEST(capture_replay, test_recorded_run)
+{
+    const uint32_t timeout = recorded_end_of_run();
+
+    zassert_ok(pulse_injector_play(0, recorded_session_ticks, RECORDED_SESSION_PULSES));
+    zassert_ok(pulse_injector_wait(0, K_MSEC(REPLAY_TIMEOUT_MS)));
+    zassert_true(wait_for_state(STATE_SENDING, REPLAY_TIMEOUT_MS), "run did not end");
+    const uint32_t stopped_at = capture_backend_now(); //RunningExit froze the timebase
+
+    struct session *session = session_pool_next_queued();
+    zassert_not_null(session, "no session queued");
+    zassert_equal(capture_store_count(&session->store), RECORDED_SESSION_PULSES);
+    zassert_equal(capture_store_read(&session->store, 0, g_ticks, RECORDED_SESSION_PULSES), RECORDED_SESSION_PULSES);
+    for (uint16_t i = 0; i < RECORDED_SESSION_PULSES; i++)
+    {
+        zassert_equal(g_ticks[i], recorded_session_ticks[i] - recorded_session_ticks[0],
+                      "pulse %d: captured %u", i, g_ticks[i]);
+    }
+    zassert_equal(session->header.missed_pulses, 0);
+    zassert_equal(session->header.place, 0);
+    zassert_equal(session->header.end_of_run_ms, timeout / TIMER_TICKS_PER_MS);
+
+    const uint32_t silence = stopped_at - g_ticks[RECORDED_SESSION_PULSES - 1];
+    zassert_true(silence >= timeout, "run ended %u ticks after the last pulse, timeout %u", silence, timeout);
+    zassert_true(silence < timeout + END_OF_RUN_LATENCY_TICKS, "run ended %u ticks late", silence - timeout);
+    session_pool_release(session);
+}
+
+
+ZTEST(capture_replay, test_short_burst_is_discarded)
+{
+    static const uint32_t bounce[] = {0, 40}; //fewer than MIN_TIMESTAMPS_IN_BURST_WINDOW
+
+    zassert_ok(pulse_injector_play(0, bounce, ARRAY_SIZE(bounce)));
+    zassert_ok(pulse_injector_wait(0, K_MSEC(REPLAY_TIMEOUT_MS)));
+    k_msleep(300); //burst window and an FSM period
+    zassert_equal(g_stateMachine.current->id, STATE_READY);
+    zassert_equal(session_pool_num_queued(), 0);
+
+    /*The next real run starts from scratch*/
+    zassert_ok(pulse_injector_play(0, recorded_session_ticks, RECORDED_SESSION_PULSES));
+    zassert_ok(pulse_injector_wait(0, K_MSEC(REPLAY_TIMEOUT_MS)));
+    zassert_true(wait_for_state(STATE_SENDING, REPLAY_TIMEOUT_MS), "run did not end");
+    struct session *session = session_pool_next_queued();
+    zassert_not_null(session, "no session queued");
+    zassert_equal(capture_store_count(&session->store), RECORDED_SESSION_PULSES);
+    zassert_equal(capture_store_last(&session->store),
+                  recorded_session_ticks[RECORDED_SESSION_PULSES - 1] - recorded_session_ticks[0]);
+    session_pool_release(session);
+}
+
+
+ZTEST_SUITE(capture_replay, NULL, replay_setup, replay_before, NULL, NULL);
@@ -0,0 +1,291 @@
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "capture_store.h"
+#include "recorded_session.h"
+
+/*
+Round trips through the capture store as a session takes them on the board: append, read the encoded
+form in transport sized chunks, decode with the reference decoder and compare with what went in.
+*/
+
+#define CHUNK_BYTES     19 //odd on purpose, varints straddle the chunk boundaries
+
+static struct capture_store g_store;
+static struct capture_store g_restored;
+static uint32_t g_ticks[CAPTURE_STORE_MAX_TICKS + 1];
+static uint32_t g_decoded[CAPTURE_STORE_MAX_TICKS + 1];
+static uint8_t g_encoded[CAPTURE_STORE_ENCODED_BASE_BYTES + CAPTURE_STORE_BYTES + CHUNK_BYTES];
+
+
+static void store_fill(struct capture_store *store, const uint32_t *ticks, uint16_t count)
+{
+    capture_store_reset(store);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        zassert_ok(capture_store_append(store, ticks[i]), "append of tick %d failed", i);
+    }
+    zassert_equal(capture_store_count(store), count);
+}
+
+
+/*
+Ticks whose intervals change by the given steps, so the size of every varint is known. The store starts
+from an interval of 0, the first interval is the first step.
+*/
+static uint16_t ticks_from_steps(uint32_t base, const int32_t *steps, uint16_t num_steps)
+{
+    uint32_t delta = 0;
+
+    g_ticks[0] = base;
+    for (uint16_t i = 0; i < num_steps; i++)
+    {
+        delta += (uint32_t)steps[i];
+        g_ticks[i + 1] = g_ticks[i] + delta;
+    }
+    return num_steps + 1;
+}
+
+
+static uint16_t encoded_read_chunked(const struct capture_store *store)
+{
+    const uint16_t size = capture_store_encoded_size(store);
+    uint16_t offset = 0;
+
+    while (offset < size)
+    {
+        const uint16_t num = capture_store_encoded_read(store, offset, &g_encoded[offset], CHUNK_BYTES);
+        zassert_equal(num, MIN(CHUNK_BYTES, size - offset), "short read at %d", offset);
+        offset += num;
+    }
+    zassert_equal(capture_store_encoded_read(store, size, &g_encoded[size], CHUNK_BYTES), 0, "read past the end");
+    return size;
+}
+
+
+static void assert_round_trip(const struct capture_store *store, const uint32_t *ticks, uint16_t count)
+{
+    const uint16_t size = encoded_read_chunked(store);
+
+    zassert_equal(size, CAPTURE_STORE_ENCODED_BASE_BYTES + store->used);
+    zassert_equal(capture_store_decode(g_encoded, size, g_decoded, ARRAY_SIZE(g_decoded)), count);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        zassert_equal(g_decoded[i], ticks[i], "decoded tick %d: %u instead of %u", i, g_decoded[i], ticks[i]);
+    }
+    zassert_equal(capture_store_read(store, 0, g_decoded, ARRAY_SIZE(g_decoded)), count);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        zassert_equal(g_decoded[i], ticks[i], "read tick %d: %u instead of %u", i, g_decoded[i], ticks[i]);
+    }
+    zassert_equal(capture_store_last(store), ticks[count - 1]);
+}
+
+
+ZTEST(capture_store, test_recorded_session)
+{
+    store_fill(&g_store, recorded_session_ticks, RECORDED_SESSION_PULSES);
+    assert_round_trip(&g_store, recorded_session_ticks, RECORDED_SESSION_PULSES);
+    zassert_true(g_store.used < 2 * RECORDED_SESSION_PULSES, "%d bytes for a steady run", g_store.used);
+}
+
+
+ZTEST(capture_store, test_timer_wrap)
+{
+    uint16_t count = 0;
+
+    for (uint32_t tick = 0xFFFFF000; count < 40; tick += 997 + (count % 3))
+    {
+        g_ticks[count++] = tick; //wraps after about 4 pulses
+    }
+    store_fill(&g_store, g_ticks, count);
+    assert_round_trip(&g_store, g_ticks, count);
+    zassert_true(capture_store_last(&g_store) < g_ticks[0]);
+    zassert_equal(g_encoded[0] | (g_encoded[1] << 8) | (g_encoded[2] << 16) | ((uint32_t)g_encoded[3] << 24),
+                  0xFFFFF000, "base is u32 little endian");
+}
+
+
+ZTEST(capture_store, test_varint_sizes)
+{
+    /*zigzag(step) at the edges of 1, 2, 3, 4 and 5 byte varints*/
+    static const int32_t steps[] = {
+        0, 63, -64,             //zigzag 0, 126, 127: 1 byte
+        64, -65, 8191,          //128, 129, 16382: 2 bytes
+        8192, -1048576,         //16384, 2097151: 3 bytes
+        1048576, 134217727,     //2097152, 268435454: 4 bytes
+        134217728, INT32_MIN,   //268435456, 0xFFFFFFFF: 5 bytes
+        INT32_MAX, 1,
+    };
+    static const uint8_t sizes[] = {1, 1, 1, 2, 2, 2, 3, 3, 4, 4, 5, 5, 5, 1};
+    uint16_t used = 0;
+
+    BUILD_ASSERT(ARRAY_SIZE(steps) == ARRAY_SIZE(sizes));
+    const uint16_t count = ticks_from_steps(1000, steps, ARRAY_SIZE(steps));
+    store_fill(&g_store, g_ticks, count);
+    for (uint8_t i = 0; i < ARRAY_SIZE(sizes); i++)
+    {
+        used += sizes[i];
+    }
+    zassert_equal(g_store.used, used);
+    assert_round_trip(&g_store, g_ticks, count);
+}
+
+
+ZTEST(capture_store, test_long_gaps)
+{
+    /*Intervals of 64 ticks and more, as a pause in the flow or a slow start gives them*/
+    static const uint32_t intervals[] = {64, 65, 128, 1000, 8192, 125000, 64, 3750000, 1250, 1250, 1};
+    uint16_t count = 1;
+
+    g_ticks[0] = 0;
+    for (uint8_t i = 0; i < ARRAY_SIZE(intervals); i++, count++)
+    {
+        g_ticks[count] = g_ticks[count - 1] + intervals[i];
+    }
+    store_fill(&g_store, g_ticks, count);
+    zassert_true(g_store.used > count - 1, "multi byte entries expected");
+    assert_round_trip(&g_store, g_ticks, count);
+}
+
+
+ZTEST(capture_store, test_checkpoint_boundaries)
+{
+    const uint16_t count = 3 * CAPTURE_STORE_CHECKPOINT_INTERVAL + 5;
+    const uint16_t starts[] = {
+        0, 1, CAPTURE_STORE_CHECKPOINT_INTERVAL - 1, CAPTURE_STORE_CHECKPOINT_INTERVAL,
+        CAPTURE_STORE_CHECKPOINT_INTERVAL + 1, 2 * CAPTURE_STORE_CHECKPOINT_INTERVAL,
+        3 * CAPTURE_STORE_CHECKPOINT_INTERVAL, count - 1,
+    };
+    uint32_t tick;
+
+    g_ticks[0] = 0x10;
+    for (uint16_t i = 1; i < count; i++)
+    {
+        g_ticks[i] = g_ticks[i - 1] + 1000 + ((i * 7919) % 300) + ((i % 50) == 0 ? 20000 : 0);
+    }
+    store_fill(&g_store, g_ticks, count);
+    assert_round_trip(&g_store, g_ticks, count);
+
+    for (uint16_t k = 1; k <= 3; k++)
+    {
+        const struct capture_checkpoint *cp = &g_store.checkpoints[k];
+        const uint16_t idx = k * CAPTURE_STORE_CHECKPOINT_INTERVAL;
+        zassert_equal(cp->tick, g_ticks[idx - 1], "checkpoint %d tick", k);
+        zassert_equal(cp->delta, g_ticks[idx - 1] - g_ticks[idx - 2], "checkpoint %d delta", k);
+    }
+    for (uint8_t i = 0; i < ARRAY_SIZE(starts); i++)
+    {
+        const uint16_t start = starts[i];
+        zassert_equal(capture_store_read(&g_store, start, g_decoded, 3), MIN(3, count - start));
+        for (uint16_t j = 0; j < MIN(3, count - start); j++)
+        {
+            zassert_equal(g_decoded[j], g_ticks[start + j], "start %d, tick %d", start, start + j);
+        }
+    }
+    zassert_equal(capture_store_read(&g_store, count, g_decoded, 3), 0);
+
+    struct capture_store_iter it;
+    capture_store_iter_init(&it, &g_store, 2 * CAPTURE_STORE_CHECKPOINT_INTERVAL + 1);
+    for (uint16_t i = 2 * CAPTURE_STORE_CHECKPOINT_INTERVAL + 1; i < count; i++)
+    {
+        zassert_true(capture_store_iter_next(&it, &tick));
+        zassert_equal(tick, g_ticks[i], "iterator at %d", i);
+    }
+    zassert_false(capture_store_iter_next(&it, &tick));
+}
+
+
+ZTEST(capture_store, test_full_by_count)
+{
+    for (uint16_t i = 0; i <= CAPTURE_STORE_MAX_TICKS; i++)
+    {
+        g_ticks[i] = i * 1250;
+    }
+    store_fill(&g_store, g_ticks, CAPTURE_STORE_MAX_TICKS);
+    zassert_equal(capture_store_append(&g_store, g_ticks[CAPTURE_STORE_MAX_TICKS]), -ENOMEM);
+    zassert_equal(capture_store_count(&g_store), CAPTURE_STORE_MAX_TICKS);
+    zassert_equal(capture_store_last(&g_store), g_ticks[CAPTURE_STORE_MAX_TICKS - 1]);
+    assert_round_trip(&g_store, g_ticks, CAPTURE_STORE_MAX_TICKS);
+}
+
+
+ZTEST(capture_store, test_full_by_bytes)
+{
+    uint16_t count = 0;
+    uint32_t tick = 0;
+    int err = 0;
+
+    capture_store_reset(&g_store);
+    while (err == 0)
+    {
+        tick += (count % 2) ? 1 : 0x40000000; //from the third tick on every entry is a 5 byte varint
+        err = capture_store_append(&g_store, tick);
+        if (err == 0)
+        {
+            g_ticks[count++] = tick;
+        }
+    }
+    zassert_equal(err, -ENOMEM);
+    zassert_true(count < CAPTURE_STORE_MAX_TICKS, "bytes run out before the tick count");
+    zassert_true(g_store.used > CAPTURE_STORE_BYTES - 5, "%d bytes used", g_store.used);
+    zassert_equal(capture_store_count(&g_store), count, "rejected tick must not count");
+    zassert_equal(capture_store_last(&g_store), g_ticks[count - 1]);
+    assert_round_trip(&g_store, g_ticks, count);
+}
+
+
+ZTEST(capture_store, test_restore)
+{
+    const uint16_t count = RECORDED_SESSION_PULSES;
+
+    store_fill(&g_store, recorded_session_ticks, count);
+    const uint16_t used = g_store.used;
+
+    /*As session_log.c does: only base, count and the varint bytes survive*/
+    memset(&g_restored, 0xA5, sizeof(g_restored));
+    memcpy(g_restored.data, g_store.data, used);
+    zassert_equal(capture_store_restore(&g_restored, 0, count, used - 1), -EINVAL, "truncated");
+    zassert_equal(capture_store_restore(&g_restored, 0, count - 1, used), -EINVAL, "bytes left over");
+    zassert_equal(capture_store_restore(&g_restored, 0, CAPTURE_STORE_MAX_TICKS + 1, 0), -EINVAL);
+    zassert_equal(capture_store_restore(&g_restored, 0, 0, 1), -EINVAL);
+
+    zassert_ok(capture_store_restore(&g_restored, g_store.base, count, used));
+    zassert_equal(g_restored.last, g_store.last);
+    zassert_equal(g_restored.last_delta, g_store.last_delta);
+    zassert_mem_equal(&g_restored.checkpoints[1], &g_store.checkpoints[1],
+                      sizeof(struct capture_checkpoint) * ((count - 1) / CAPTURE_STORE_CHECKPOINT_INTERVAL));
+    assert_round_trip(&g_restored, recorded_session_ticks, count);
+
+    /*A restored store takes further ticks like the original*/
+    zassert_ok(capture_store_append(&g_store, g_store.last + 1300));
+    zassert_ok(capture_store_append(&g_restored, g_restored.last + 1300));
+    zassert_equal(g_restored.used, g_store.used);
+    zassert_mem_equal(g_restored.data, g_store.data, g_store.used);
+
+    zassert_ok(capture_store_restore(&g_restored, 0, 0, 0));
+    zassert_equal(capture_store_encoded_size(&g_restored), 0);
+}
+
+
+ZTEST(capture_store, test_decode_truncated)
+{
+    static const int32_t steps[] = {0, 64, 0}; //1, 2 and 1 byte
+    const uint16_t count = ticks_from_steps(5, steps, ARRAY_SIZE(steps));
+
+    store_fill(&g_store, g_ticks, count);
+    const uint16_t size = encoded_read_chunked(&g_store);
+    zassert_equal(size, CAPTURE_STORE_ENCODED_BASE_BYTES + 4);
+
+    zassert_equal(capture_store_decode(g_encoded, size, g_decoded, ARRAY_SIZE(g_decoded)), 4);
+    zassert_equal(capture_store_decode(g_encoded, size - 1, g_decoded, ARRAY_SIZE(g_decoded)), 3);
+    zassert_equal(capture_store_decode(g_encoded, size - 2, g_decoded, ARRAY_SIZE(g_decoded)), 2, "half a varint");
+    zassert_equal(capture_store_decode(g_encoded, CAPTURE_STORE_ENCODED_BASE_BYTES, g_decoded, 4), 1);
+    zassert_equal(capture_store_decode(g_encoded, CAPTURE_STORE_ENCODED_BASE_BYTES - 1, g_decoded, 4), 0);
+    zassert_equal(capture_store_decode(g_encoded, size, g_decoded, 2), 2, "stops at max_ticks");
+}
+
+
+ZTEST_SUITE(capture_store, NULL, NULL, NULL, NULL, NULL);
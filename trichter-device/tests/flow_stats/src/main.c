@@ -0,0 +1,91 @@
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "flow_stats.h"
+#include "recorded_session.h"
+
+/*
+Feeds recorded ticks into flow_stats pulse by pulse, as the runtime does during a run, and checks the
+summary against what the app computes from the same session after the download.
+*/
+
+#define TICKS_PER_S         125000 //TIMER_FREQUENCY_HZ
+#define TICKS_PER_MS        (TICKS_PER_S / 1000)
+
+/*
+SessionCalculatorService over recorded_session_ticks converted to ms like TrichterDataHandler,
+calibration RECORDED_SESSION_CALIBRATION, in mL/s and truncated. bierorgl_app/test/flow_parity_test.dart
+asserts the exact doubles.
+*/
+#define APP_PEAK_ML_PER_S   213 //calculatePeakFlow = 0.213420838 L/s
+#define APP_AVG_ML_PER_S    167 //calculateAverageFlow(2980 ms, 500 mL) = 0.167785235 L/s
+
+/*The device floors every raw flow and every average, the app keeps the fractions*/
+#define INTEGER_TOLERANCE   1
+
+static struct flow_stats g_stats;
+
+
+static void feed(const uint32_t *ticks, uint16_t count, uint16_t calibration, struct flow_summary *summary)
+{
+    flow_stats_reset(&g_stats, calibration, TICKS_PER_S);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        flow_stats_update(&g_stats, ticks[i]);
+    }
+    flow_stats_summary(&g_stats, TICKS_PER_MS, summary);
+}
+
+
+ZTEST(flow_stats, test_recorded_session_matches_app)
+{
+    struct flow_summary summary;
+
+    feed(recorded_session_ticks, RECORDED_SESSION_PULSES, RECORDED_SESSION_CALIBRATION, &summary);
+    zassert_equal(summary.pulses, RECORDED_SESSION_PULSES);
+    zassert_equal(summary.volume_ml, 500);
+    zassert_within(summary.peak_ml_per_s, APP_PEAK_ML_PER_S, INTEGER_TOLERANCE, "peak %u", summary.peak_ml_per_s);
+    zassert_within(summary.avg_ml_per_s, APP_AVG_ML_PER_S, INTEGER_TOLERANCE, "avg %u", summary.avg_ml_per_s);
+}
+
+
+ZTEST(flow_stats, test_summary_keeps_running_state)
+{
+    struct flow_summary first;
+    struct flow_summary second;
+
+    /*The runtime asks for a summary at the end of the run, the running peak must not move*/
+    feed(recorded_session_ticks, RECORDED_SESSION_PULSES, RECORDED_SESSION_CALIBRATION, &first);
+    const uint16_t running_peak = g_stats.peak;
+    flow_stats_summary(&g_stats, TICKS_PER_MS, &second);
+    zassert_equal(g_stats.peak, running_peak);
+    zassert_mem_equal(&first, &second, sizeof(first));
+}
+
+
+ZTEST(flow_stats, test_bounce_below_one_ms_is_skipped)
+{
+    /*10 ms steady with one 25 tick bounce, which the app sees as two pulses in the same ms*/
+    static const uint32_t ticks[] = {0, 1250, 2500, 3750, 3775, 5000, 6250, 7500, 8750, 10000};
+    struct flow_summary summary;
+
+    feed(ticks, ARRAY_SIZE(ticks), RECORDED_SESSION_CALIBRATION, &summary);
+    zassert_equal(g_stats.intervals, ARRAY_SIZE(ticks) - 2);
+    zassert_equal(summary.peak_ml_per_s, (500 * 1000) / (RECORDED_SESSION_CALIBRATION * 10));
+}
+
+
+ZTEST(flow_stats, test_ms_rounding)
+{
+    /*62 ticks are 0.496 ms and round down, 63 ticks are 0.504 ms and round up, same as Dart's round()*/
+    static const uint32_t ticks[] = {0, 62, 63, 1312, 2563, 3813};
+    struct flow_summary summary;
+
+    feed(ticks, ARRAY_SIZE(ticks), RECORDED_SESSION_CALIBRATION, &summary);
+    zassert_equal(g_stats.intervals, ARRAY_SIZE(ticks) - 2);
+    zassert_equal(g_stats.last_ms, 31);
+    zassert_equal(g_stats.recent[0], (500 * 1000) / (RECORDED_SESSION_CALIBRATION * 1));
+}
+
+
+ZTEST_SUITE(flow_stats, NULL, NULL, NULL, NULL, NULL);
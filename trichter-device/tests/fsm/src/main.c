@@ -0,0 +1,397 @@
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "state_machine.h"
+#include "fsm_core.h"
+
+/*
+The state table and engine of fsm_core.c on a test instance of the state machine. The state functions
+below stand in for runtime.c: they count their calls, log the order in which states are entered and
+return whatever the test armed for them.
+*/
+
+#define ENGINE_STACK_SIZE       2048
+#define ENGINE_PRIO             K_PRIO_PREEMPT(1)
+#define ENGINE_SETTLE_MS        50
+#define BENCH_TRANSITIONS       1000
+#define BENCH_PERIOD_MS         1
+#define BENCH_RUN_MS            100
+
+enum hook {
+    HOOK_ENTRY,
+    HOOK_RUN,
+    HOOK_EXIT,
+    HOOK_MAX
+};
+
+K_MSGQ_DEFINE(test_requests, sizeof(uint8_t), FSM_REQUEST_QUEUE_DEPTH, 1);
+K_THREAD_STACK_DEFINE(engine_stack, ENGINE_STACK_SIZE);
+static struct k_thread g_engine_thread;
+static uint8_t g_engine_run;
+
+static StateMachine_t g_sm;
+static uint32_t g_calls[NUM_STATES][HOOK_MAX];
+static uint8_t g_ret[NUM_STATES][HOOK_MAX];     //returned once, then back to ERR_NONE
+static StateID_t g_entered[16];
+static uint8_t g_num_entered;
+
+
+static uint8_t hook(StateID_t id, enum hook h)
+{
+    const uint8_t ret = g_ret[id][h];
+
+    g_calls[id][h]++;
+    g_ret[id][h] = ERR_NONE;
+    if (h == HOOK_ENTRY && g_num_entered < ARRAY_SIZE(g_entered))
+    {
+        g_entered[g_num_entered++] = id;
+    }
+    return ret;
+}
+
+#define STATE_HOOKS(name, id) \
+    uint8_t name##Entry(void) { return hook(id, HOOK_ENTRY); } \
+    uint8_t name##Run(void) { return hook(id, HOOK_RUN); } \
+    uint8_t name##Exit(void) { return hook(id, HOOK_EXIT); }
+
+STATE_HOOKS(Idle, STATE_IDLE)
+STATE_HOOKS(Ready, STATE_READY)
+STATE_HOOKS(Running, STATE_RUNNING)
+STATE_HOOKS(Sending, STATE_SENDING)
+STATE_HOOKS(Calib, STATE_CALIBRATING)
+STATE_HOOKS(Error, STATE_ERROR)
+
+
+static void hooks_reset(void)
+{
+    memset(g_calls, 0, sizeof(g_calls));
+    memset(g_ret, 0, sizeof(g_ret));
+    g_num_entered = 0;
+}
+
+
+/*Same settings as fsm_start(), without the thread and the notifier*/
+static void sm_init(StateID_t start)
+{
+    k_msgq_purge(&test_requests);
+    memset(&g_sm, 0, sizeof(g_sm));
+    k_mutex_init(&g_sm.lock);
+    g_sm.name = "Test FSM";
+    g_sm.current = &STATES[start];
+    g_sm.states = STATES;
+    g_sm.num_states = NUM_STATES;
+    g_sm.errorState = STATE_ERROR;
+    g_sm.requests = &test_requests;
+    g_sm.lastRequest = FSM_EVENT_RESCHEDULE;
+    g_sm.timeoutTarget = STATE_MAX;
+    g_sm.period_ms = FSM_PERIOD_NONE;
+    g_sm.notify = false;
+}
+
+
+/*Takes the pending requests out of the queue, oldest first*/
+static uint32_t drain(uint8_t *events, uint32_t max)
+{
+    uint32_t count = 0;
+
+    while (count < max && k_msgq_get(&test_requests, &events[count], K_NO_WAIT) == 0)
+    {
+        count++;
+    }
+    return count;
+}
+
+
+static bool is_allowed(StateID_t from, StateID_t to)
+{
+    for (int i = 0; i < MAX_TRANSITIONS; i++)
+    {
+        if (STATES[from].allowedTransitions[i] == to)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void engine_main(void *p1, void *p2, void *p3)
+{
+    fsm_engine_run(&g_sm, &g_engine_run);
+}
+
+
+static void engine_start(void)
+{
+    g_engine_run = 1;
+    k_thread_create(&g_engine_thread, engine_stack, K_THREAD_STACK_SIZEOF(engine_stack), engine_main,
+                    NULL, NULL, NULL, ENGINE_PRIO, 0, K_NO_WAIT);
+}
+
+
+static int engine_stop(void)
+{
+    const uint8_t wake = FSM_EVENT_RESCHEDULE;
+
+    g_engine_run = 0;
+    k_msgq_put(&test_requests, &wake, K_NO_WAIT);
+    return k_thread_join(&g_engine_thread, K_SECONDS(1));
+}
+
+
+static void fsm_before(void *fixture)
+{
+    hooks_reset();
+    sm_init(STATE_READY);
+}
+
+
+ZTEST(fsm, test_transition_table)
+{
+    for (StateID_t from = 0; from < NUM_STATES; from++)
+    {
+        for (StateID_t to = 0; to < NUM_STATES; to++)
+        {
+            hooks_reset();
+            g_sm.current = &STATES[from];
+            const uint8_t ret = state_machine_transition(&g_sm, to);
+            if (is_allowed(from, to))
+            {
+                zassert_equal(ret, ERR_NONE, "%d to %d", from, to);
+                zassert_equal(g_sm.current->id, to);
+                zassert_equal(g_calls[from][HOOK_EXIT], 1);
+                zassert_equal(g_calls[to][HOOK_ENTRY], 1);
+            } else {
+                zassert_equal(ret, ERR_TRANSITION_FORBIDDEN, "%d to %d", from, to);
+                zassert_equal(g_sm.current->id, from);
+                zassert_equal(g_calls[from][HOOK_EXIT], 0);
+                zassert_equal(g_num_entered, 0);
+            }
+        }
+    }
+}
+
+
+ZTEST(fsm, test_error_state_reachable_everywhere)
+{
+    /*Otherwise a failing state function leaves the FSM where it failed*/
+    for (StateID_t from = 0; from < NUM_STATES; from++)
+    {
+        zassert_true(is_allowed(from, STATE_ERROR), "no way from %d to the error state", from);
+    }
+}
+
+
+ZTEST(fsm, test_padding_id_is_rejected)
+{
+    /*Every allowedTransitions list ends in STATE_MAX, which must never pass as a target*/
+    for (StateID_t from = 0; from < NUM_STATES; from++)
+    {
+        hooks_reset();
+        g_sm.current = &STATES[from];
+        zassert_equal(state_machine_transition(&g_sm, STATE_MAX), ERR_INVALID_PARAM);
+        zassert_equal(g_sm.current->id, from);
+        zassert_equal(g_calls[from][HOOK_EXIT], 0);
+    }
+
+    /*Through the engine entry point it counts as a broken request and ends in the error state*/
+    hooks_reset();
+    g_sm.current = &STATES[STATE_READY];
+    ble_fsm_transition(&g_sm, STATE_MAX);
+    zassert_equal(g_sm.current->id, STATE_ERROR);
+    zassert_equal(g_calls[STATE_ERROR][HOOK_ENTRY], 1);
+}
+
+
+ZTEST(fsm, test_on_exit_error_goes_to_error_state)
+{
+    uint8_t events[FSM_REQUEST_QUEUE_DEPTH];
+
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_IDLE));
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_CALIBRATING));
+    fsm_state_timeout(&g_sm, 1000, STATE_IDLE);
+    g_ret[STATE_READY][HOOK_EXIT] = ERR_API;
+
+    ble_fsm_transition(&g_sm, STATE_RUNNING);
+    zassert_equal(g_sm.current->id, STATE_ERROR);
+    zassert_equal(g_calls[STATE_RUNNING][HOOK_ENTRY], 0);
+    zassert_equal(g_calls[STATE_READY][HOOK_EXIT], 2, "failed exit, then the exit to the error state");
+    zassert_equal(g_calls[STATE_ERROR][HOOK_ENTRY], 1);
+    zassert_equal(g_sm.timeoutAt, 0);
+
+    /*The pending requests were purged, only the wake up for the new period is left*/
+    zassert_equal(drain(events, ARRAY_SIZE(events)), 1);
+    zassert_equal(events[0], FSM_EVENT_RESCHEDULE);
+
+    /*The error state takes no deferred requests*/
+    zassert_equal(ble_fsm_transition_deferred(&g_sm, STATE_READY), ERR_TRANSITION_FORBIDDEN);
+    zassert_equal(k_msgq_num_used_get(&test_requests), 0);
+}
+
+
+ZTEST(fsm, test_on_entry_error_goes_to_error_state)
+{
+    g_ret[STATE_RUNNING][HOOK_ENTRY] = ERR_API;
+
+    ble_fsm_transition(&g_sm, STATE_RUNNING);
+    zassert_equal(g_sm.current->id, STATE_ERROR);
+    zassert_equal(g_calls[STATE_RUNNING][HOOK_EXIT], 1, "left from the state that failed to enter");
+    zassert_equal(g_calls[STATE_ERROR][HOOK_ENTRY], 1);
+}
+
+
+ZTEST(fsm, test_exit_without_implementation_passes)
+{
+    g_ret[STATE_READY][HOOK_EXIT] = ERR_NO_IMPL;
+
+    zassert_equal(ble_fsm_transition(&g_sm, STATE_RUNNING), ERR_NONE);
+    zassert_equal(g_sm.current->id, STATE_RUNNING);
+    zassert_equal(g_calls[STATE_ERROR][HOOK_ENTRY], 0);
+}
+
+
+ZTEST(fsm, test_deferred_requests_coalesce_in_order)
+{
+    static const uint8_t expected[] = {STATE_RUNNING, STATE_IDLE, STATE_RUNNING};
+    uint8_t events[FSM_REQUEST_QUEUE_DEPTH];
+
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_RUNNING));
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_RUNNING));
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_IDLE));
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_IDLE));
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_RUNNING));
+    zassert_equal(drain(events, ARRAY_SIZE(events)), ARRAY_SIZE(expected));
+    zassert_mem_equal(events, expected, sizeof(expected));
+
+    /*Only a still pending request absorbs a duplicate*/
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_RUNNING));
+    zassert_equal(k_msgq_num_used_get(&test_requests), 1);
+}
+
+
+ZTEST(fsm, test_deferred_queue_full)
+{
+    uint8_t events[FSM_REQUEST_QUEUE_DEPTH];
+
+    for (int i = 0; i < FSM_REQUEST_QUEUE_DEPTH; i++)
+    {
+        zassert_ok(ble_fsm_transition_deferred(&g_sm, (i % 2) ? STATE_IDLE : STATE_RUNNING));
+    }
+    const StateID_t newest = (FSM_REQUEST_QUEUE_DEPTH % 2) ? STATE_RUNNING : STATE_IDLE;
+    const StateID_t other = (newest == STATE_IDLE) ? STATE_RUNNING : STATE_IDLE;
+    zassert_equal(ble_fsm_transition_deferred(&g_sm, other), ERR_API);
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, newest), "a duplicate is absorbed even when full");
+
+    zassert_equal(drain(events, ARRAY_SIZE(events)), FSM_REQUEST_QUEUE_DEPTH);
+    for (int i = 0; i < FSM_REQUEST_QUEUE_DEPTH; i++)
+    {
+        zassert_equal(events[i], (i % 2) ? STATE_IDLE : STATE_RUNNING, "request %d out of order", i);
+    }
+}
+
+
+ZTEST(fsm, test_reschedule_events)
+{
+    static const uint8_t expected[] = {FSM_EVENT_RESCHEDULE, STATE_SENDING, FSM_EVENT_RESCHEDULE};
+    uint8_t events[FSM_REQUEST_QUEUE_DEPTH];
+
+    /*Every direct transition from another thread wakes the engine, forbidden ones included, back to back wake ups coalesce*/
+    zassert_equal(ble_fsm_transition(&g_sm, STATE_RUNNING), ERR_NONE);
+    zassert_equal(ble_fsm_transition(&g_sm, STATE_READY), ERR_TRANSITION_FORBIDDEN);
+    fsm_state_timeout(&g_sm, 1000, STATE_SENDING);
+    zassert_equal(k_msgq_num_used_get(&test_requests), 1);
+
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_SENDING));
+    fsm_state_timeout(&g_sm, 500, STATE_SENDING);
+    zassert_equal(drain(events, ARRAY_SIZE(events)), ARRAY_SIZE(expected));
+    zassert_mem_equal(events, expected, sizeof(expected));
+}
+
+
+ZTEST(fsm, test_engine_thread_posts_no_reschedule)
+{
+    /*What the engine runs itself, onEntry arming a state timeout included, needs no wake up*/
+    g_sm.engine = k_current_get();
+    zassert_equal(ble_fsm_transition(&g_sm, STATE_RUNNING), ERR_NONE);
+    fsm_state_timeout(&g_sm, 1000, STATE_SENDING);
+    zassert_equal(k_msgq_num_used_get(&test_requests), 0);
+}
+
+
+ZTEST(fsm, test_engine_runs_requests_in_order)
+{
+    static const StateID_t expected[] = {STATE_RUNNING, STATE_SENDING, STATE_READY, STATE_CALIBRATING};
+
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_RUNNING));
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_SENDING));
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_IDLE)); //forbidden from SENDING, dropped
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_READY));
+    zassert_ok(ble_fsm_transition_deferred(&g_sm, STATE_CALIBRATING));
+    engine_start();
+    k_msleep(ENGINE_SETTLE_MS);
+    zassert_ok(engine_stop());
+
+    zassert_equal(g_num_entered, ARRAY_SIZE(expected));
+    zassert_mem_equal(g_entered, expected, sizeof(expected));
+    zassert_equal(g_calls[STATE_CALIBRATING][HOOK_RUN], 0, "FSM_PERIOD_NONE never polls");
+}
+
+
+ZTEST(fsm, test_engine_state_timeout)
+{
+    fsm_state_timeout(&g_sm, 10, STATE_RUNNING);
+    engine_start();
+    k_msleep(ENGINE_SETTLE_MS);
+    zassert_ok(engine_stop());
+
+    zassert_equal(g_sm.current->id, STATE_RUNNING);
+    zassert_equal(g_sm.timeoutAt, 0);
+}
+
+
+ZTEST(fsm, test_engine_runloop_error_stops)
+{
+    g_sm.period_ms = BENCH_PERIOD_MS;
+    g_ret[STATE_READY][HOOK_RUN] = ERR_API;
+    engine_start();
+    zassert_ok(k_thread_join(&g_engine_thread, K_SECONDS(1)), "engine still running");
+    zassert_equal(g_engine_run, 0);
+    zassert_equal(g_sm.current->id, STATE_ERROR);
+}
+
+
+ZTEST(fsm, test_benchmark_transitions)
+{
+    const uint32_t start = k_cycle_get_32();
+
+    for (int i = 0; i < BENCH_TRANSITIONS; i++)
+    {
+        zassert_ok(ble_fsm_transition(&g_sm, (i % 2) ? STATE_READY : STATE_IDLE));
+    }
+    const uint32_t cycles = k_cycle_get_32() - start;
+
+    zassert_equal(g_calls[STATE_IDLE][HOOK_ENTRY], BENCH_TRANSITIONS / 2);
+    zassert_true(g_sm.maxTransitionCycles > 0);
+    TC_PRINT("%d transitions: %u ns mean, %u ns slowest\n", BENCH_TRANSITIONS,
+             (uint32_t)(k_cyc_to_ns_floor64(cycles) / BENCH_TRANSITIONS),
+             (uint32_t)k_cyc_to_ns_floor64(g_sm.maxTransitionCycles));
+}
+
+
+ZTEST(fsm, test_benchmark_runloop)
+{
+    g_sm.period_ms = BENCH_PERIOD_MS;
+    engine_start();
+    k_msleep(BENCH_RUN_MS);
+    zassert_ok(engine_stop());
+
+    const uint32_t runs = g_calls[STATE_READY][HOOK_RUN];
+    zassert_true(runs >= BENCH_RUN_MS / (4 * BENCH_PERIOD_MS), "only %u runLoops", runs);
+    zassert_true(g_sm.maxRunCycles > 0);
+    TC_PRINT("%u runLoops in %d ms at a %d ms period, %u ns slowest\n", runs, BENCH_RUN_MS, BENCH_PERIOD_MS,
+             (uint32_t)k_cyc_to_ns_floor64(g_sm.maxRunCycles));
+}
+
+
+ZTEST_SUITE(fsm, NULL, NULL, fsm_before, NULL, NULL);